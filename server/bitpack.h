@@ -0,0 +1,218 @@
+/*
+ * Douglass The Keeper - Bit-packed wire encoding
+ *
+ * Bit writer/reader and quantization helpers shared by game_server.c and
+ * bot_client.c for the compact packet formats (PKT_WORLD_DELTA,
+ * PKT_ENTITY_STATE_Q). Bits are packed LSB-first into bytes.
+ *
+ * Header-only: every function is static inline.
+ */
+
+#ifndef BITPACK_H
+#define BITPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+// Quantization ranges - MUST be identical on both ends of the wire.
+// Positions get ~1.6 cm resolution inside the world bounds and are clamped
+// outside them.
+#define QUANT_POS_XZ_MIN   -1024.0f
+#define QUANT_POS_XZ_MAX    1024.0f
+#define QUANT_POS_XZ_BITS   17
+#define QUANT_POS_Y_MIN    -128.0f
+#define QUANT_POS_Y_MAX     384.0f
+#define QUANT_POS_Y_BITS    15
+#define QUANT_ROT_BITS      12         // ~0.09 degrees
+#define QUANT_PLAYER_HEALTH_BITS 8     // Whole points, 0..255
+#define QUANT_ENTITY_HEALTH_BITS 10    // Whole points, 0..1023 (Dragon has 500)
+#define QUANT_STATE_BITS    4
+#define QUANT_COMBAT_BITS   1
+#define QUANT_CLASS_BITS    2
+
+// =============================================================================
+// BIT WRITER
+// =============================================================================
+
+typedef struct {
+    uint8_t *data;
+    size_t capacity;           // Bytes available in data
+    size_t bytes;              // Bytes flushed so far
+    uint64_t scratch;          // Pending bits, LSB first
+    int scratch_bits;
+    int overflow;              // Set if a write ran past capacity
+} BitWriter;
+
+static inline void bw_init(BitWriter *w, uint8_t *data, size_t capacity) {
+    w->data = data;
+    w->capacity = capacity;
+    w->bytes = 0;
+    w->scratch = 0;
+    w->scratch_bits = 0;
+    w->overflow = 0;
+}
+
+// Write the low `bits` bits of value (1..32)
+static inline void bw_write(BitWriter *w, uint32_t value, int bits) {
+    if (bits < 32) value &= (1u << bits) - 1;
+    w->scratch |= (uint64_t)value << w->scratch_bits;
+    w->scratch_bits += bits;
+
+    while (w->scratch_bits >= 8) {
+        if (w->bytes < w->capacity) {
+            w->data[w->bytes++] = (uint8_t)w->scratch;
+        } else {
+            w->overflow = 1;
+        }
+        w->scratch >>= 8;
+        w->scratch_bits -= 8;
+    }
+}
+
+// Variable-length unsigned integer: 7 value bits + 1 continuation bit per group
+static inline void bw_write_varuint(BitWriter *w, uint32_t value) {
+    while (value >= 0x80) {
+        bw_write(w, (value & 0x7F) | 0x80, 8);
+        value >>= 7;
+    }
+    bw_write(w, value, 8);
+}
+
+static inline void bw_write_f32(BitWriter *w, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bw_write(w, bits, 32);
+}
+
+static inline void bw_write_bytes(BitWriter *w, const void *src, size_t len) {
+    const uint8_t *p = (const uint8_t*)src;
+    for (size_t i = 0; i < len; i++) {
+        bw_write(w, p[i], 8);
+    }
+}
+
+// Bytes written so far, counting a partial byte
+static inline size_t bw_length(const BitWriter *w) {
+    return w->bytes + (w->scratch_bits + 7) / 8;
+}
+
+// Flush the partial byte. Returns the encoded length in bytes.
+static inline size_t bw_finish(BitWriter *w) {
+    if (w->scratch_bits > 0) {
+        if (w->bytes < w->capacity) {
+            w->data[w->bytes++] = (uint8_t)w->scratch;
+        } else {
+            w->overflow = 1;
+        }
+        w->scratch = 0;
+        w->scratch_bits = 0;
+    }
+    return w->bytes;
+}
+
+// =============================================================================
+// BIT READER
+// =============================================================================
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t bytes;              // Bytes consumed into scratch so far
+    uint64_t scratch;
+    int scratch_bits;
+    int overflow;              // Set if a read ran past the end
+} BitReader;
+
+static inline void br_init(BitReader *r, const uint8_t *data, size_t len) {
+    r->data = data;
+    r->len = len;
+    r->bytes = 0;
+    r->scratch = 0;
+    r->scratch_bits = 0;
+    r->overflow = 0;
+}
+
+// Read `bits` bits (1..32). Returns 0 and sets overflow past the end.
+static inline uint32_t br_read(BitReader *r, int bits) {
+    while (r->scratch_bits < bits) {
+        if (r->bytes >= r->len) {
+            r->overflow = 1;
+            return 0;
+        }
+        r->scratch |= (uint64_t)r->data[r->bytes++] << r->scratch_bits;
+        r->scratch_bits += 8;
+    }
+
+    uint32_t value = (uint32_t)(r->scratch & ((bits < 32) ? ((1ull << bits) - 1) : 0xFFFFFFFFull));
+    r->scratch >>= bits;
+    r->scratch_bits -= bits;
+    return value;
+}
+
+static inline uint32_t br_read_varuint(BitReader *r) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint32_t group = br_read(r, 8);
+        value |= (group & 0x7F) << shift;
+        if (!(group & 0x80) || r->overflow) break;
+    }
+    return value;
+}
+
+static inline float br_read_f32(BitReader *r) {
+    uint32_t bits = br_read(r, 32);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline void br_read_bytes(BitReader *r, void *dst, size_t len) {
+    uint8_t *p = (uint8_t*)dst;
+    for (size_t i = 0; i < len; i++) {
+        p[i] = (uint8_t)br_read(r, 8);
+    }
+}
+
+// =============================================================================
+// QUANTIZATION
+// =============================================================================
+
+// Map [min, max] onto 0..2^bits-1, clamping out-of-range values
+static inline uint32_t quantize_range(float value, float min, float max, int bits) {
+    uint32_t steps = (1u << bits) - 1;
+    float t = (value - min) / (max - min);
+    if (!(t > 0.0f)) t = 0.0f;  // Also catches NaN
+    if (t > 1.0f) t = 1.0f;
+    return (uint32_t)(t * steps + 0.5f);
+}
+
+static inline float dequantize_range(uint32_t q, float min, float max, int bits) {
+    uint32_t steps = (1u << bits) - 1;
+    return min + (max - min) * ((float)q / steps);
+}
+
+// Angles wrap, so map [-pi, pi) onto 0..2^bits-1 modulo the full turn
+static inline uint32_t quantize_angle(float radians, int bits) {
+    float turns = radians / (2.0f * (float)M_PI);
+    turns -= floorf(turns);
+    uint32_t q = (uint32_t)(turns * (1u << bits) + 0.5f);
+    return q & ((1u << bits) - 1);
+}
+
+static inline float dequantize_angle(uint32_t q, int bits) {
+    float radians = (float)q * (2.0f * (float)M_PI) / (1u << bits);
+    if (radians >= (float)M_PI) radians -= 2.0f * (float)M_PI;
+    return radians;
+}
+
+// Non-negative whole numbers, clamped to the field width
+static inline uint32_t quantize_uint(float value, int bits) {
+    uint32_t max = (1u << bits) - 1;
+    if (!(value > 0.0f)) return 0;
+    if (value >= (float)max) return max;
+    return (uint32_t)(value + 0.5f);
+}
+
+#endif // BITPACK_H
@@ -1,28 +1,60 @@
 /*
  * Headless Bot Client - Player Companion
  * Joins the UDP game server, follows the player, and shoots fire arrows.
+ * With --swarm, one process hosts N such bots as a load generator. Ping
+ * round trips and update-to-echo latency are reported when the run ends.
  *
  * Compile: gcc -o bot_client bot_client.c -lm
- * Run: ./bot_client [player_id] [server_ip] [port]
+ * Run: ./bot_client [player_id] [server_ip] [port] [--legacy-protocol] [--no-bundle]
+ *                   [--rate HZ] [--arrow-ms MS] [--duration SECS]
+ *      ./bot_client --swarm N [first_id] [server_ip] [port] [--ramp SECS] ...
+ *      ./bot_client --stats [server_ip] [port]   (print server stats and exit)
  */
 
+#define _GNU_SOURCE  // recvmmsg, sendmmsg
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <sys/time.h>
 #include <math.h>
 #include <signal.h>
 #include <errno.h>
 
+#include "bitpack.h"
+#include "histogram.h"
+
 #define DEFAULT_PORT 7777
 #define DEFAULT_SERVER "127.0.0.1"
-#define UPDATE_INTERVAL_MS 16  // 60 Hz
-#define ARROW_COOLDOWN_MS 2000  // Shoot every 2 seconds
+#define STATS_TIMEOUT_MS 1000  // --stats: give up waiting for the reply after this
+#define DEFAULT_UPDATE_RATE 60          // Updates per second per bot (--rate)
+#define DEFAULT_ARROW_INTERVAL_MS 2000  // Shoot every 2 seconds (--arrow-ms, 0 = never)
+#define AIM_TIME_MS 500                 // Bow draw before each shot
+#define JOIN_DELAY_MS 1000              // Wait this long before the first JOIN
+#define JOIN_RETRY_MS 1000              // Resend JOIN if no JOIN_ACK arrives by then
+
+// Latency measurement
+#define PING_INTERVAL_MS 500    // Each joined bot pings this often
+#define PING_SLOTS 8            // Pings in flight per bot
+#define ECHO_SLOTS 64           // Sent positions awaiting their echo (~1 s at 60 Hz)
+#define ECHO_MATCH_DIST 0.02f   // Covers quantization (~1.6 cm steps)
+
+// Swarm mode
+#define MAX_SWARM_BOTS 4096
+#define SWARM_REPORT_SEC 5      // Print swarm totals this often
+#define BOT_TX_QUEUE 4          // Datagrams a bot queues before a sendmmsg
+#define BOT_TX_BYTES 128        // Largest datagram a bot sends (UpdatePacket is 70)
+#define RECV_BATCH 16           // Datagrams per recvmmsg
+#define RECV_BUFFER_SIZE 2048
+#define EPOLL_BATCH 64
 
 // Follow distance settings
 #define MIN_FOLLOW_DIST 2.0f   // Minimum distance to player
@@ -40,6 +72,37 @@
 #define PKT_PONG         8   // MSG_PONG
 #define PKT_ARROW_SPAWN  11  // MSG_ARROW_SPAWN
 #define PKT_ARROW_HIT    12  // MSG_ARROW_HIT
+#define PKT_PLAYER_DAMAGE 17 // MSG_PLAYER_DAMAGE
+#define PKT_GAME_RESTART 18  // MSG_GAME_RESTART
+#define PKT_WORLD_DELTA  19  // Delta-encoded world state (see game_server.c)
+#define PKT_ANIM_DICT    21  // Animation ID table (server -> us), or a request for it (us -> server)
+#define PKT_UPDATE_COMPACT 22  // Player update with an animation ID
+#define PKT_STATS        23  // Server stats query/reply
+#define PKT_RELIABLE     24  // Sequenced wrapper (server -> us) / bare ReliableAck (us -> server)
+#define PKT_BUNDLE       25  // Several packets coalesced into one datagram (server -> us)
+
+// Capabilities advertised in the JoinPacket trailer - must match game_server.c
+#define CAP_DELTA_SNAPSHOT (1u << 0)
+#define CAP_QUANTIZED      (1u << 1)
+#define CAP_ANIM_IDS       (1u << 2)
+#define CAP_RELIABLE       (1u << 3)
+#define CAP_BUNDLE         (1u << 4)
+
+// Reliable channel - must match game_server.c
+#define RELIABLE_WINDOW 32
+#define RELIABLE_MAX_PAYLOAD 96
+
+#define MAX_ANIMATIONS 256   // Must match game_server.c
+
+// Delta snapshot decoding - must match game_server.c
+#define SNAPSHOT_RING_SIZE 32
+#define MAX_TRACKED_PLAYERS 1024  // MAX_PLAYERS_LIMIT in game_server.c
+#define DELTA_FIELD_POS    (1u << 0)
+#define DELTA_FIELD_ROT    (1u << 1)
+#define DELTA_FIELD_STATE  (1u << 2)
+#define DELTA_FIELD_HEALTH (1u << 3)
+#define DELTA_FIELD_ANIM   (1u << 4)
+#define DELTA_FIELD_BITS   5
 
 // Player states - match protocol.gd PlayerState
 #define STATE_IDLE        0
@@ -78,12 +141,71 @@ typedef struct {
     char player_name[32];
 } JoinPacket;
 
+// Join packet with capability trailer
+typedef struct {
+    JoinPacket join;
+    uint32_t caps;
+    uint32_t reliable_epoch;  // Names our reliable channel (nonzero)
+} JoinCapsPacket;
+
+// Snapshot ack (PKT_ACK)
+typedef struct {
+    PacketHeader header;
+    uint32_t snapshot_seq;
+} SnapshotAckPacket;
+
+// Reliable channel wrapper (PKT_RELIABLE), followed by the message
+typedef struct {
+    PacketHeader header;     // sequence = channel sequence
+    uint32_t epoch;          // The epoch from our JOIN
+} ReliableHeader;
+
+// Reliable channel ack, appended to PKT_UPDATE, PKT_UPDATE_COMPACT and
+// PKT_ACK, or sent after a bare PKT_RELIABLE header
+typedef struct {
+    uint32_t epoch;          // Channel being acked
+    uint32_t next_seq;       // Every message before this one arrived
+    uint32_t received_bits;  // Bit i: next_seq + 1 + i arrived too
+} ReliableAck;
+
+// Delta world state header, followed by per-player entries. A snapshot may
+// be split across chunk_count datagrams.
+typedef struct {
+    PacketHeader header;
+    uint32_t snapshot_seq;
+    uint32_t baseline_seq;
+    uint16_t player_count;
+    uint16_t first_index;
+    uint8_t entry_count;
+    uint8_t chunk_index;
+    uint8_t chunk_count;
+} WorldDeltaHeader;
+
+// Animation dictionary header, followed by (id u16, len u8, name) entries
+typedef struct {
+    PacketHeader header;
+    uint8_t entry_count;
+} AnimDictHeader;
+
+// Compact player update
+typedef struct {
+    PacketHeader header;
+    float pos_x, pos_y, pos_z;
+    float rot_y;
+    uint8_t state;
+    uint8_t combat_mode;
+    uint8_t character_class;
+    float health;
+    uint16_t anim_id;
+} CompactUpdatePacket;
+
 typedef struct {
     PacketHeader header;
     PlayerData data;
 } UpdatePacket;
 
 // World state packet (server -> client)
+// Variable length: the server only sends the first player_count entries.
 typedef struct {
     PacketHeader header;
     uint32_t state_seq;
@@ -115,23 +237,38 @@ typedef struct {
     uint32_t hit_entity_id;
 } ArrowHitPacket;
 
-#pragma pack(pop)
+// Server stats reply - must match game_server.c. Queries are a PKT_STATS
+// header padded with zeros to this size.
+typedef struct {
+    PacketHeader header;
+    uint32_t uptime_sec;
+    uint16_t players;
+    uint16_t max_players;
+    uint16_t spectators;
+    uint16_t bobbas;
+    uint16_t dragons;
+    uint16_t tick_rate;
+    uint32_t window_ms;
+    float ticks_per_sec;
+    uint32_t tick_avg_us;
+    uint32_t tick_p99_us;
+    uint32_t tick_max_us;
+    uint32_t tick_overruns;
+    float rx_packets_per_sec;
+    float tx_packets_per_sec;
+    uint32_t rx_socket_drops;
+} StatsPacket;
 
-static volatile int running = 1;
-static int bot_id = 1;
-static uint32_t my_player_id = 0;
-static uint32_t sequence = 0;
-static uint32_t arrow_id_counter = 0;
-
-// Bot state
-static float pos_x = 0.0f, pos_y = 1.0f, pos_z = 10.0f;
-static float rot_y = 0.0f;
-static float move_speed = 5.0f;
+#pragma pack(pop)
 
-// Player tracking (the human player we follow)
-static float player_x = 0.0f, player_y = 1.0f, player_z = 0.0f;
-static uint32_t player_id_to_follow = 0;  // 0 = not found yet
-static float target_follow_dist = 5.0f;   // Random distance to maintain
+// Decoded snapshots, kept so later deltas can be applied to them. players
+// grows to the largest player_count seen.
+typedef struct {
+    uint32_t seq;
+    int count;
+    int capacity;
+    PlayerData *players;
+} ClientSnapshot;
 
 // Combat state
 typedef enum {
@@ -141,9 +278,109 @@ typedef enum {
     BOT_STATE_COOLDOWN      // Waiting for next shot
 } BotCombatState;
 
-static BotCombatState combat_state = BOT_STATE_FOLLOWING;
-static uint64_t state_start_time = 0;
-static uint64_t last_arrow_time = 0;
+// A position we sent in an update, waiting to show up in a world state
+typedef struct {
+    float x, y, z;
+    uint64_t sent_ns;
+} EchoProbe;
+
+// Everything one bot knows. Each bot has its own socket because the server
+// tells players apart by source address.
+typedef struct {
+    int id;                            // Names the bot Hunter_<id>
+    int sock;
+    uint32_t player_id;                // Assigned by JOIN_ACK, 0 until then
+    uint32_t sequence;
+    uint32_t arrow_id_counter;
+    uint64_t join_sent_time;
+    uint64_t last_update;
+
+    // Animation IDs learned from PKT_ANIM_DICT ("" = unknown)
+    char anim_names[MAX_ANIMATIONS][32];
+    int anim_dict_requested;
+
+    ClientSnapshot snapshot_ring[SNAPSHOT_RING_SIZE];
+    uint32_t latest_snapshot;
+
+    // Snapshot being reassembled from PKT_WORLD_DELTA chunks (seq 0 = none)
+    ClientSnapshot pending_snapshot;
+    uint32_t pending_baseline;
+    uint8_t pending_chunks[256];       // Received flags by chunk_index
+    int pending_received;
+
+    // Bot state
+    float pos_x, pos_y, pos_z;
+    float rot_y;
+
+    // Player tracking (the player we follow)
+    float player_x, player_y, player_z;
+    uint32_t player_id_to_follow;      // 0 = not found yet
+    float target_follow_dist;          // Random distance to maintain
+
+    BotCombatState combat_state;
+    uint64_t state_start_time;
+    uint64_t last_arrow_time;
+
+    // Latency probes: pings in flight by sequence % PING_SLOTS, and sent
+    // positions (a ring, oldest at echo_head) not yet seen in a world state
+    uint64_t last_ping_time;
+    uint32_t ping_seq[PING_SLOTS];
+    uint64_t ping_sent_ns[PING_SLOTS];
+    EchoProbe echo[ECHO_SLOTS];
+    int echo_head;
+    int echo_count;
+    float seen_x, seen_y, seen_z;      // Our position in the latest world state
+
+    // Receiving half of the reliable channel: messages are handled in
+    // sequence order; early ones wait in held[seq % RELIABLE_WINDOW]
+    uint32_t reliable_epoch;           // Sent in our JOIN (0 = not chosen yet)
+    uint32_t reliable_next;            // Next sequence to handle
+    uint64_t reliable_held_bits;       // Bit i: reliable_next + i is held
+    uint8_t held[RELIABLE_WINDOW][RELIABLE_MAX_PAYLOAD];
+    uint16_t held_len[RELIABLE_WINDOW];
+    int reliable_ack_due;              // Received something not acked yet
+
+    // Datagrams waiting for bot_flush
+    uint8_t tx_data[BOT_TX_QUEUE][BOT_TX_BYTES];
+    struct iovec tx_iov[BOT_TX_QUEUE];
+    struct mmsghdr tx_msgs[BOT_TX_QUEUE];
+    int tx_count;
+} Bot;
+
+static volatile int running = 1;
+static uint32_t client_caps = CAP_DELTA_SNAPSHOT | CAP_QUANTIZED | CAP_ANIM_IDS | CAP_RELIABLE |
+                              CAP_BUNDLE;  // Cleared by --legacy-protocol
+static struct sockaddr_in server_addr;
+static float move_speed = 5.0f;
+static int update_interval_ms = 1000 / DEFAULT_UPDATE_RATE;
+static int arrow_interval_ms = DEFAULT_ARROW_INTERVAL_MS;
+static int verbose = 1;  // Per-bot messages; off in swarms
+
+// Traffic totals across all bots
+static uint64_t tx_packets = 0;
+static uint64_t tx_errors = 0;
+static uint64_t rx_packets = 0;
+static uint64_t rx_bytes = 0;
+
+// Latency across all bots, in nanoseconds
+static Histogram rtt_hist;             // PKT_PING to PKT_PONG
+static Histogram echo_hist;            // PKT_UPDATE to our position in a world state
+static uint64_t pings_sent = 0;
+
+// Reliable channel totals across all bots
+static uint64_t reliable_delivered[256];  // By wrapped packet type
+static uint64_t reliable_held = 0;        // Arrived early, waited for a gap
+static uint64_t reliable_duplicates = 0;
+static uint64_t reliable_stale = 0;       // From another channel epoch
+
+// Bundling totals across all bots
+static uint64_t bundles_received = 0;
+static uint64_t bundled_packets = 0;    // Packets unpacked from them
+
+// Per-bot progress messages, printed only when verbose
+#define BOT_LOG(bot, ...) do { \
+    if (verbose) { printf("[Bot %d] ", (bot)->id); printf(__VA_ARGS__); printf("\n"); } \
+} while (0)
 
 void signal_handler(int sig) {
     (void)sig;
@@ -157,15 +394,21 @@ uint64_t get_time_ms(void) {
     return (uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000ULL;
 }
 
-float distance_to_player(void) {
-    float dx = player_x - pos_x;
-    float dz = player_z - pos_z;
+uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+float distance_to_player(const Bot *bot) {
+    float dx = bot->player_x - bot->pos_x;
+    float dz = bot->player_z - bot->pos_z;
     return sqrtf(dx * dx + dz * dz);
 }
 
-float angle_to_player(void) {
-    float dx = player_x - pos_x;
-    float dz = player_z - pos_z;
+float angle_to_player(const Bot *bot) {
+    float dx = bot->player_x - bot->pos_x;
+    float dz = bot->player_z - bot->pos_z;
     // atan2(x, z) for Godot's coordinate system (Z forward)
     return atan2f(-dx, -dz);  // Negate to face towards target
 }
@@ -175,36 +418,205 @@ float random_range(float min_val, float max_val) {
     return min_val + ((float)rand() / RAND_MAX) * (max_val - min_val);
 }
 
-void send_join(int sock, struct sockaddr_in *server_addr) {
-    JoinPacket pkt;
+// Queue a datagram for the bot's next bot_flush
+void bot_send(Bot *bot, const void *pkt, size_t len);
+void bot_flush(Bot *bot);
+
+ReliableAck reliable_ack_of(const Bot *bot) {
+    ReliableAck ack;
+    ack.epoch = bot->reliable_epoch;
+    ack.next_seq = bot->reliable_next;
+    ack.received_bits = (uint32_t)(bot->reliable_held_bits >> 1);
+    return ack;
+}
+
+// bot_send with the reliable channel ack appended, if we negotiated one
+void bot_send_acked(Bot *bot, const void *pkt, size_t len) {
+    uint8_t buf[BOT_TX_BYTES];
+    if (!(client_caps & CAP_RELIABLE) || len + sizeof(ReliableAck) > sizeof(buf)) {
+        bot_send(bot, pkt, len);
+        return;
+    }
+
+    ReliableAck ack = reliable_ack_of(bot);
+    memcpy(buf, pkt, len);
+    memcpy(buf + len, &ack, sizeof(ack));
+    bot_send(bot, buf, len + sizeof(ack));
+    bot->reliable_ack_due = 0;
+}
+
+// Ack on its own, for when there is nothing to piggyback on
+void send_reliable_ack(Bot *bot) {
+    uint8_t buf[sizeof(PacketHeader) + sizeof(ReliableAck)];
+    PacketHeader header;
+    header.type = PKT_RELIABLE;
+    header.player_id = bot->player_id;
+    header.sequence = ++bot->sequence;
+    ReliableAck ack = reliable_ack_of(bot);
+
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), &ack, sizeof(ack));
+    bot_send(bot, buf, sizeof(buf));
+    bot->reliable_ack_due = 0;
+}
+
+void send_join(Bot *bot) {
+    JoinCapsPacket pkt;
+    memset(&pkt, 0, sizeof(pkt));
+
+    pkt.join.header.type = PKT_JOIN;
+    pkt.join.header.player_id = 0;
+    pkt.join.header.sequence = ++bot->sequence;
+    snprintf(pkt.join.player_name, sizeof(pkt.join.player_name), "Hunter_%d", bot->id);
+    pkt.caps = client_caps;
+
+    // The first JOIN opens a new reliable channel. Retries name the same
+    // epoch, so the server keeps the channel and the JOIN_ACK already on it.
+    if (bot->reliable_epoch == 0) {
+        do {
+            bot->reliable_epoch = ((uint32_t)rand() << 16) ^ (uint32_t)rand() ^ (uint32_t)bot->id;
+        } while (bot->reliable_epoch == 0);
+        bot->reliable_next = 0;
+        bot->reliable_held_bits = 0;
+    }
+    pkt.reliable_epoch = bot->reliable_epoch;
+
+    // Legacy mode sends the plain JoinPacket so the server treats us like
+    // an old client
+    size_t len = client_caps ? sizeof(pkt) : sizeof(pkt.join);
+    bot_send(bot, &pkt, len);
+    bot->join_sent_time = get_time_ms();
+
+    BOT_LOG(bot, "Sent JOIN request as '%s' (caps=0x%x)", pkt.join.player_name, client_caps);
+}
+
+void send_snapshot_ack(Bot *bot, uint32_t snapshot_seq) {
+    SnapshotAckPacket pkt;
     memset(&pkt, 0, sizeof(pkt));
 
-    pkt.header.type = PKT_JOIN;
-    pkt.header.player_id = 0;
-    pkt.header.sequence = ++sequence;
-    snprintf(pkt.player_name, sizeof(pkt.player_name), "Hunter_%d", bot_id);
+    pkt.header.type = PKT_ACK;
+    pkt.header.player_id = bot->player_id;
+    pkt.header.sequence = ++bot->sequence;
+    pkt.snapshot_seq = snapshot_seq;
 
-    sendto(sock, &pkt, sizeof(pkt), 0,
-           (struct sockaddr*)server_addr, sizeof(*server_addr));
+    bot_send_acked(bot, &pkt, sizeof(pkt));
+}
+
+// ID for an animation name, or -1 if the server hasn't announced it yet
+int find_anim_id(const Bot *bot, const char *anim) {
+    for (int i = 1; i < MAX_ANIMATIONS; i++) {
+        if (bot->anim_names[i][0] && strcmp(bot->anim_names[i], anim) == 0) return i;
+    }
+    return -1;
+}
+
+int same_position(float ax, float ay, float az, float bx, float by, float bz) {
+    return fabsf(ax - bx) <= ECHO_MATCH_DIST && fabsf(ay - by) <= ECHO_MATCH_DIST &&
+           fabsf(az - bz) <= ECHO_MATCH_DIST;
+}
+
+// Remember when we first sent the current position, so its echo can be timed
+void add_echo_probe(Bot *bot) {
+    if (bot->echo_count > 0) {
+        const EchoProbe *newest = &bot->echo[(bot->echo_head + bot->echo_count - 1) % ECHO_SLOTS];
+        if (same_position(newest->x, newest->y, newest->z, bot->pos_x, bot->pos_y, bot->pos_z)) return;
+    } else if (same_position(bot->seen_x, bot->seen_y, bot->seen_z, bot->pos_x, bot->pos_y, bot->pos_z)) {
+        return;  // The server already shows us here
+    }
+
+    // A full ring drops the oldest probe (too slow to measure)
+    if (bot->echo_count == ECHO_SLOTS) {
+        bot->echo_head = (bot->echo_head + 1) % ECHO_SLOTS;
+        bot->echo_count--;
+    }
+    EchoProbe *probe = &bot->echo[(bot->echo_head + bot->echo_count++) % ECHO_SLOTS];
+    probe->x = bot->pos_x;
+    probe->y = bot->pos_y;
+    probe->z = bot->pos_z;
+    probe->sent_ns = get_time_ns();
+}
+
+// Our own entry in a world state: time the newest probe it matches. Older
+// probes were superseded before the server broadcast them and are dropped.
+void check_echo(Bot *bot, const PlayerData *pd) {
+    bot->seen_x = pd->pos_x;
+    bot->seen_y = pd->pos_y;
+    bot->seen_z = pd->pos_z;
+
+    for (int i = bot->echo_count - 1; i >= 0; i--) {
+        const EchoProbe *probe = &bot->echo[(bot->echo_head + i) % ECHO_SLOTS];
+        if (same_position(probe->x, probe->y, probe->z, pd->pos_x, pd->pos_y, pd->pos_z)) {
+            hist_record(&echo_hist, get_time_ns() - probe->sent_ns);
+            bot->echo_head = (bot->echo_head + i + 1) % ECHO_SLOTS;
+            bot->echo_count -= i + 1;
+            return;
+        }
+    }
+}
+
+void send_ping(Bot *bot) {
+    PacketHeader pkt;
+    pkt.type = PKT_PING;
+    pkt.player_id = bot->player_id;
+    pkt.sequence = ++bot->sequence;
 
-    printf("[Bot %d] Sent JOIN request as '%s'\n", bot_id, pkt.player_name);
+    int slot = pkt.sequence % PING_SLOTS;
+    bot->ping_seq[slot] = pkt.sequence;
+    bot->ping_sent_ns[slot] = get_time_ns();
+    pings_sent++;
+
+    bot_send(bot, &pkt, sizeof(pkt));
+}
+
+// The server echoes the ping's header; match it to the send time
+void handle_pong(Bot *bot, const PacketHeader *header) {
+    int slot = header->sequence % PING_SLOTS;
+    if (header->sequence == 0 || bot->ping_seq[slot] != header->sequence) return;
+
+    hist_record(&rtt_hist, get_time_ns() - bot->ping_sent_ns[slot]);
+    bot->ping_seq[slot] = 0;
 }
 
-void send_update(int sock, struct sockaddr_in *server_addr, uint8_t state, const char *anim) {
-    if (my_player_id == 0) return;
+void send_update(Bot *bot, uint8_t state, const char *anim) {
+    if (bot->player_id == 0) return;
+
+    add_echo_probe(bot);
+
+    // Use the compact form once the server has given the animation an ID;
+    // the full update below is what gets a new name interned
+    int anim_id = (client_caps & CAP_ANIM_IDS) ? find_anim_id(bot, anim) : -1;
+    if (anim_id > 0) {
+        CompactUpdatePacket cpkt;
+        memset(&cpkt, 0, sizeof(cpkt));
+        cpkt.header.type = PKT_UPDATE_COMPACT;
+        cpkt.header.player_id = bot->player_id;
+        cpkt.header.sequence = ++bot->sequence;
+        cpkt.pos_x = bot->pos_x;
+        cpkt.pos_y = bot->pos_y;
+        cpkt.pos_z = bot->pos_z;
+        cpkt.rot_y = bot->rot_y;
+        cpkt.state = state;
+        cpkt.combat_mode = 1;
+        cpkt.character_class = 2;  // Archer class
+        cpkt.health = 100.0f;
+        cpkt.anim_id = (uint16_t)anim_id;
+
+        bot_send_acked(bot, &cpkt, sizeof(cpkt));
+        return;
+    }
 
     UpdatePacket pkt;
     memset(&pkt, 0, sizeof(pkt));
 
     pkt.header.type = PKT_UPDATE;
-    pkt.header.player_id = my_player_id;
-    pkt.header.sequence = ++sequence;
-
-    pkt.data.player_id = my_player_id;
-    pkt.data.pos_x = pos_x;
-    pkt.data.pos_y = pos_y;
-    pkt.data.pos_z = pos_z;
-    pkt.data.rot_y = rot_y;
+    pkt.header.player_id = bot->player_id;
+    pkt.header.sequence = ++bot->sequence;
+
+    pkt.data.player_id = bot->player_id;
+    pkt.data.pos_x = bot->pos_x;
+    pkt.data.pos_y = bot->pos_y;
+    pkt.data.pos_z = bot->pos_z;
+    pkt.data.rot_y = bot->rot_y;
     pkt.data.state = state;
     pkt.data.combat_mode = 1;
     pkt.data.character_class = 2;  // Archer class
@@ -212,30 +624,29 @@ void send_update(int sock, struct sockaddr_in *server_addr, uint8_t state, const
     strncpy(pkt.data.anim_name, anim, 31);
     pkt.data.active = 1;
 
-    sendto(sock, &pkt, sizeof(pkt), 0,
-           (struct sockaddr*)server_addr, sizeof(*server_addr));
+    bot_send_acked(bot, &pkt, sizeof(pkt));
 }
 
-void send_arrow(int sock, struct sockaddr_in *server_addr) {
-    if (my_player_id == 0) return;
+void send_arrow(Bot *bot) {
+    if (bot->player_id == 0) return;
 
     ArrowSpawnPacket pkt;
     memset(&pkt, 0, sizeof(pkt));
 
     pkt.header.type = PKT_ARROW_SPAWN;
-    pkt.header.player_id = my_player_id;
-    pkt.header.sequence = ++sequence;
+    pkt.header.player_id = bot->player_id;
+    pkt.header.sequence = ++bot->sequence;
 
-    pkt.arrow_id = (my_player_id << 16) | (++arrow_id_counter);
-    pkt.shooter_id = my_player_id;
+    pkt.arrow_id = (bot->player_id << 16) | (++bot->arrow_id_counter);
+    pkt.shooter_id = bot->player_id;
     pkt.active = 1;
 
     // Arrow spawns at bot position + forward offset + height
-    float forward_x = sinf(rot_y);
-    float forward_z = cosf(rot_y);
-    pkt.pos_x = pos_x + forward_x * 1.0f;
-    pkt.pos_y = pos_y + 1.5f;  // Chest height
-    pkt.pos_z = pos_z + forward_z * 1.0f;
+    float forward_x = sinf(bot->rot_y);
+    float forward_z = cosf(bot->rot_y);
+    pkt.pos_x = bot->pos_x + forward_x * 1.0f;
+    pkt.pos_y = bot->pos_y + 1.5f;  // Chest height
+    pkt.pos_z = bot->pos_z + forward_z * 1.0f;
 
     // Shoot forward with a high arc (aim high for visibility)
     // Add random spread to make it interesting
@@ -254,51 +665,241 @@ void send_arrow(int sock, struct sockaddr_in *server_addr) {
         pkt.dir_z = forward_z;
     }
 
-    sendto(sock, &pkt, sizeof(pkt), 0,
-           (struct sockaddr*)server_addr, sizeof(*server_addr));
+    bot_send(bot, &pkt, sizeof(pkt));
 
-    printf("[Bot %d] FIRE! Arrow %u at (%.1f, %.1f, %.1f) -> dir (%.2f, %.2f, %.2f)\n",
-           bot_id, pkt.arrow_id, pkt.pos_x, pkt.pos_y, pkt.pos_z,
-           pkt.dir_x, pkt.dir_y, pkt.dir_z);
+    BOT_LOG(bot, "FIRE! Arrow %u at (%.1f, %.1f, %.1f) -> dir (%.2f, %.2f, %.2f)",
+            pkt.arrow_id, pkt.pos_x, pkt.pos_y, pkt.pos_z,
+            pkt.dir_x, pkt.dir_y, pkt.dir_z);
 }
 
-void send_leave(int sock, struct sockaddr_in *server_addr) {
-    if (my_player_id == 0) return;
+void send_leave(Bot *bot) {
+    if (bot->player_id == 0) return;
 
     PacketHeader pkt;
     pkt.type = PKT_LEAVE;
-    pkt.player_id = my_player_id;
-    pkt.sequence = ++sequence;
+    pkt.player_id = bot->player_id;
+    pkt.sequence = ++bot->sequence;
 
-    sendto(sock, &pkt, sizeof(pkt), 0,
-           (struct sockaddr*)server_addr, sizeof(*server_addr));
+    bot_send(bot, &pkt, sizeof(pkt));
+
+    BOT_LOG(bot, "Sent LEAVE");
+}
+
+// Follow logic for one entry of a world state
+void track_player(Bot *bot, const PlayerData *pd) {
+    // Ourselves: only of interest for latency
+    if (pd->player_id == bot->player_id) {
+        check_echo(bot, pd);
+        return;
+    }
+
+    // Found another player - follow them!
+    if (bot->player_id_to_follow == 0) {
+        bot->player_id_to_follow = pd->player_id;
+        BOT_LOG(bot, "Now following player %u", bot->player_id_to_follow);
+    }
+
+    // Update tracked player position
+    if (pd->player_id == bot->player_id_to_follow) {
+        bot->player_x = pd->pos_x;
+        bot->player_y = pd->pos_y;
+        bot->player_z = pd->pos_z;
+    }
+}
+
+// Make room for count players. Returns -1 if out of memory.
+int snapshot_reserve(ClientSnapshot *snap, int count) {
+    if (count <= snap->capacity) return 0;
+
+    int capacity = (count + 63) & ~63;
+    PlayerData *players = realloc(snap->players, (size_t)capacity * sizeof(PlayerData));
+    if (!players) return -1;
+    snap->players = players;
+    snap->capacity = capacity;
+    return 0;
+}
+
+// Apply a PKT_WORLD_DELTA chunk to its baseline. Returns the reconstructed
+// snapshot (stored in the ring) once its last chunk arrives, or NULL if it
+// is still incomplete or the packet is stale, malformed or references a
+// baseline we don't have.
+ClientSnapshot* decode_world_delta(Bot *bot, const uint8_t *buf, size_t len) {
+    if (len < sizeof(WorldDeltaHeader)) return NULL;
+    const WorldDeltaHeader *hdr = (const WorldDeltaHeader*)buf;
+    int quantized = (client_caps & CAP_QUANTIZED) != 0;
+
+    // Ignore reordered packets older than what we've already applied
+    if (hdr->snapshot_seq == 0 || (int32_t)(hdr->snapshot_seq - bot->latest_snapshot) <= 0) {
+        return NULL;
+    }
+
+    const ClientSnapshot *base = NULL;
+    if (hdr->baseline_seq != 0) {
+        base = &bot->snapshot_ring[hdr->baseline_seq % SNAPSHOT_RING_SIZE];
+        if (base->seq != hdr->baseline_seq) return NULL;
+    }
+    if (hdr->player_count > MAX_TRACKED_PLAYERS ||
+        hdr->first_index + hdr->entry_count > hdr->player_count ||
+        hdr->chunk_index >= hdr->chunk_count) {
+        return NULL;
+    }
+
+    // A chunk of a newer snapshot abandons the one being reassembled
+    ClientSnapshot *decoded = &bot->pending_snapshot;
+    if (decoded->seq != hdr->snapshot_seq) {
+        if (decoded->seq != 0 && (int32_t)(hdr->snapshot_seq - decoded->seq) < 0) {
+            return NULL;
+        }
+        if (snapshot_reserve(decoded, hdr->player_count) < 0) return NULL;
+        decoded->seq = hdr->snapshot_seq;
+        decoded->count = hdr->player_count;
+        bot->pending_baseline = hdr->baseline_seq;
+        bot->pending_received = 0;
+        memset(bot->pending_chunks, 0, sizeof(bot->pending_chunks));
+    }
+    if (hdr->baseline_seq != bot->pending_baseline || hdr->player_count != decoded->count ||
+        bot->pending_chunks[hdr->chunk_index]) {
+        return NULL;
+    }
+
+    BitReader r;
+    br_init(&r, buf + sizeof(WorldDeltaHeader), len - sizeof(WorldDeltaHeader));
+
+    uint32_t player_id = 0;
+    int b = 0;
+    for (int i = hdr->first_index; i < hdr->first_index + hdr->entry_count; i++) {
+        player_id += br_read_varuint(&r);
+        uint8_t mask = (uint8_t)br_read(&r, DELTA_FIELD_BITS);
+
+        // Start from the baseline entry (both lists are sorted by player_id)
+        PlayerData *pd = &decoded->players[i];
+        memset(pd, 0, sizeof(*pd));
+        if (base) {
+            while (b < base->count && base->players[b].player_id < player_id) b++;
+            if (b < base->count && base->players[b].player_id == player_id) {
+                *pd = base->players[b];
+            }
+        }
+        pd->player_id = player_id;
+        pd->active = 1;
+
+        if (mask & DELTA_FIELD_POS) {
+            if (quantized) {
+                pd->pos_x = dequantize_range(br_read(&r, QUANT_POS_XZ_BITS),
+                                             QUANT_POS_XZ_MIN, QUANT_POS_XZ_MAX, QUANT_POS_XZ_BITS);
+                pd->pos_y = dequantize_range(br_read(&r, QUANT_POS_Y_BITS),
+                                             QUANT_POS_Y_MIN, QUANT_POS_Y_MAX, QUANT_POS_Y_BITS);
+                pd->pos_z = dequantize_range(br_read(&r, QUANT_POS_XZ_BITS),
+                                             QUANT_POS_XZ_MIN, QUANT_POS_XZ_MAX, QUANT_POS_XZ_BITS);
+            } else {
+                pd->pos_x = br_read_f32(&r);
+                pd->pos_y = br_read_f32(&r);
+                pd->pos_z = br_read_f32(&r);
+            }
+        }
+        if (mask & DELTA_FIELD_ROT) {
+            pd->rot_y = quantized ? dequantize_angle(br_read(&r, QUANT_ROT_BITS), QUANT_ROT_BITS)
+                                  : br_read_f32(&r);
+        }
+        if (mask & DELTA_FIELD_STATE) {
+            pd->state = br_read(&r, quantized ? QUANT_STATE_BITS : 8);
+            pd->combat_mode = br_read(&r, quantized ? QUANT_COMBAT_BITS : 8);
+            pd->character_class = br_read(&r, quantized ? QUANT_CLASS_BITS : 8);
+        }
+        if (mask & DELTA_FIELD_HEALTH) {
+            pd->health = quantized ? (float)br_read(&r, QUANT_PLAYER_HEALTH_BITS)
+                                   : br_read_f32(&r);
+        }
+        if (mask & DELTA_FIELD_ANIM) {
+            memset(pd->anim_name, 0, sizeof(pd->anim_name));
+            if (client_caps & CAP_ANIM_IDS) {
+                uint32_t anim_id = br_read_varuint(&r);
+                if (anim_id < MAX_ANIMATIONS && bot->anim_names[anim_id][0]) {
+                    strcpy(pd->anim_name, bot->anim_names[anim_id]);
+                } else if (anim_id != 0) {
+                    bot->anim_dict_requested = 1;  // Lost or late PKT_ANIM_DICT
+                }
+            } else {
+                uint32_t anim_len = br_read(&r, 5);
+                br_read_bytes(&r, pd->anim_name, anim_len);
+            }
+        }
+        if (r.overflow) return NULL;
+    }
+
+    bot->pending_chunks[hdr->chunk_index] = 1;
+    if (++bot->pending_received < hdr->chunk_count) return NULL;
+
+    // Swap the finished snapshot into the ring; the slot's old storage
+    // becomes the next pending snapshot
+    ClientSnapshot *slot = &bot->snapshot_ring[decoded->seq % SNAPSHOT_RING_SIZE];
+    ClientSnapshot finished = *decoded;
+    *decoded = *slot;
+    *slot = finished;
+    bot->latest_snapshot = slot->seq;
+    decoded->seq = 0;
+    return slot;
+}
 
-    printf("[Bot %d] Sent LEAVE\n", bot_id);
+// Record entries from a PKT_ANIM_DICT
+void handle_anim_dict(Bot *bot, const uint8_t *buf, size_t len) {
+    if (len < sizeof(AnimDictHeader)) return;
+    const AnimDictHeader *hdr = (const AnimDictHeader*)buf;
+
+    size_t off = sizeof(AnimDictHeader);
+    for (int i = 0; i < hdr->entry_count && off + 3 <= len; i++) {
+        uint16_t id;
+        memcpy(&id, buf + off, 2);
+        uint8_t name_len = buf[off + 2];
+        off += 3;
+        if (off + name_len > len || id >= MAX_ANIMATIONS || name_len >= 32) return;
+
+        memcpy(bot->anim_names[id], buf + off, name_len);
+        bot->anim_names[id][name_len] = '\0';
+        off += name_len;
+    }
 }
 
-void receive_packets(int sock) {
-    char buffer[2048];
-    struct sockaddr_in from_addr;
-    socklen_t from_len = sizeof(from_addr);
+// Ask the server for the whole animation table
+void request_anim_dict(Bot *bot) {
+    PacketHeader pkt;
+    pkt.type = PKT_ANIM_DICT;
+    pkt.player_id = bot->player_id;
+    pkt.sequence = ++bot->sequence;
+    bot_send(bot, &pkt, sizeof(pkt));
+}
 
-    ssize_t len = recvfrom(sock, buffer, sizeof(buffer), MSG_DONTWAIT,
-                           (struct sockaddr*)&from_addr, &from_len);
+void handle_reliable(Bot *bot, const uint8_t *buf, ssize_t len);
+void handle_bundle(Bot *bot, const uint8_t *buf, ssize_t len);
 
+void handle_packet(Bot *bot, const uint8_t *buffer, ssize_t len) {
     if (len < (ssize_t)sizeof(PacketHeader)) return;
 
-    PacketHeader *header = (PacketHeader*)buffer;
+    const PacketHeader *header = (const PacketHeader*)buffer;
+
+    if (header->type == PKT_RELIABLE) {
+        handle_reliable(bot, buffer, len);
+        return;
+    }
+    if (header->type == PKT_BUNDLE) {
+        handle_bundle(bot, buffer, len);
+        return;
+    }
 
     if (header->type == PKT_JOIN_ACK && len >= (ssize_t)sizeof(JoinAckPacket)) {
-        JoinAckPacket *ack = (JoinAckPacket*)buffer;
-        my_player_id = ack->assigned_id;
-        pos_x = ack->data.pos_x;
-        pos_y = ack->data.pos_y;
-        pos_z = ack->data.pos_z;
+        const JoinAckPacket *ack = (const JoinAckPacket*)buffer;
+        bot->player_id = ack->assigned_id;
+        bot->pos_x = ack->data.pos_x;
+        bot->pos_y = ack->data.pos_y;
+        bot->pos_z = ack->data.pos_z;
+        bot->seen_x = bot->pos_x;
+        bot->seen_y = bot->pos_y;
+        bot->seen_z = bot->pos_z;
         // Pick a random follow distance
-        target_follow_dist = random_range(MIN_FOLLOW_DIST, MAX_FOLLOW_DIST);
-        printf("[Bot %d] Received JOIN_ACK - Assigned ID: %u at (%.1f, %.1f, %.1f)\n",
-               bot_id, my_player_id, pos_x, pos_y, pos_z);
-        printf("[Bot %d] Will follow player at %.1fm distance\n", bot_id, target_follow_dist);
+        bot->target_follow_dist = random_range(MIN_FOLLOW_DIST, MAX_FOLLOW_DIST);
+        BOT_LOG(bot, "Received JOIN_ACK - Assigned ID: %u at (%.1f, %.1f, %.1f)",
+                bot->player_id, bot->pos_x, bot->pos_y, bot->pos_z);
+        BOT_LOG(bot, "Will follow player at %.1fm distance", bot->target_follow_dist);
     }
     else if (header->type == PKT_WORLD_STATE) {
         // Parse world state to find player to follow
@@ -307,169 +908,601 @@ void receive_packets(int sock) {
 
         // Skip state_seq (4 bytes)
         offset += 4;
-        uint8_t player_count = *(uint8_t*)(buffer + offset);
+        uint8_t player_count = buffer[offset];
         offset += 1;
 
-        // Look through all players
+        // Look through all players (datagram holds exactly player_count
+        // entries; the length check also guards against truncation)
         for (int i = 0; i < player_count && offset + sizeof(PlayerData) <= (size_t)len; i++) {
-            PlayerData *pd = (PlayerData*)(buffer + offset);
+            const PlayerData *pd = (const PlayerData*)(buffer + offset);
             offset += sizeof(PlayerData);
+            track_player(bot, pd);
+        }
+    }
+    else if (header->type == PKT_PONG) {
+        handle_pong(bot, header);
+    }
+    else if (header->type == PKT_ANIM_DICT) {
+        handle_anim_dict(bot, buffer, len);
+    }
+    else if (header->type == PKT_WORLD_DELTA) {
+        ClientSnapshot *snap = decode_world_delta(bot, buffer, len);
+        if (bot->anim_dict_requested) {
+            bot->anim_dict_requested = 0;
+            request_anim_dict(bot);
+        }
+        if (!snap) return;
+
+        send_snapshot_ack(bot, snap->seq);
+        for (int i = 0; i < snap->count; i++) {
+            track_player(bot, &snap->players[i]);
+        }
+    }
+}
 
-            // Skip ourselves
-            if (pd->player_id == my_player_id) continue;
+// Handle one reliable message and any held ones it unblocks
+void deliver_reliable(Bot *bot, const uint8_t *msg, ssize_t len) {
+    reliable_delivered[msg[0]]++;
+    handle_packet(bot, msg, len);
+    bot->reliable_next++;
+    bot->reliable_held_bits >>= 1;
+}
 
-            // Found another player - follow them!
-            if (player_id_to_follow == 0) {
-                player_id_to_follow = pd->player_id;
-                printf("[Bot %d] Now following player %u\n", bot_id, player_id_to_follow);
-            }
+// A PKT_RELIABLE: handle its message in sequence order, holding it if
+// earlier ones are still missing
+void handle_reliable(Bot *bot, const uint8_t *buf, ssize_t len) {
+    const PacketHeader *header = (const PacketHeader*)buf;
+    const uint8_t *msg = buf + sizeof(ReliableHeader);
+    ssize_t msg_len = len - (ssize_t)sizeof(ReliableHeader);
+    if (msg_len < (ssize_t)sizeof(PacketHeader) || msg_len > RELIABLE_MAX_PAYLOAD ||
+        msg[0] == PKT_RELIABLE) {
+        return;
+    }
 
-            // Update tracked player position
-            if (pd->player_id == player_id_to_follow) {
-                player_x = pd->pos_x;
-                player_y = pd->pos_y;
-                player_z = pd->pos_z;
-            }
-        }
+    // Left over from an earlier channel: its sequence numbers mean nothing now
+    if (((const ReliableHeader*)buf)->epoch != bot->reliable_epoch) {
+        reliable_stale++;
+        return;
+    }
+
+    // Whatever happens next, the server wants to hear about it
+    bot->reliable_ack_due = 1;
+
+    int32_t ahead = (int32_t)(header->sequence - bot->reliable_next);
+    if (ahead > RELIABLE_WINDOW) return;  // Can't be in flight; ignore
+    if (ahead < 0 || (bot->reliable_held_bits >> ahead) & 1) {
+        reliable_duplicates++;
+        return;
+    }
+
+    if (ahead > 0) {
+        int slot = header->sequence % RELIABLE_WINDOW;
+        memcpy(bot->held[slot], msg, msg_len);
+        bot->held_len[slot] = (uint16_t)msg_len;
+        bot->reliable_held_bits |= 1ull << ahead;
+        reliable_held++;
+        return;
+    }
+
+    deliver_reliable(bot, msg, msg_len);
+    while (bot->reliable_held_bits & 1) {
+        int slot = bot->reliable_next % RELIABLE_WINDOW;
+        deliver_reliable(bot, bot->held[slot], bot->held_len[slot]);
+    }
+}
+
+// A PKT_BUNDLE: handle each packet in it as if it had arrived on its own.
+// Each is prefixed with its uint16_t length; a truncated one ends the walk.
+void handle_bundle(Bot *bot, const uint8_t *buf, ssize_t len) {
+    size_t offset = sizeof(PacketHeader);
+    bundles_received++;
+
+    while (offset + sizeof(uint16_t) <= (size_t)len) {
+        uint16_t msg_len;
+        memcpy(&msg_len, buf + offset, sizeof(msg_len));
+        offset += sizeof(msg_len);
+        if (offset + msg_len > (size_t)len) break;
+
+        const uint8_t *msg = buf + offset;
+        offset += msg_len;
+        if (msg_len == 0 || msg[0] == PKT_BUNDLE) continue;
+        bundled_packets++;
+        handle_packet(bot, msg, msg_len);
     }
 }
 
-void update_bot(int sock, struct sockaddr_in *server_addr, float delta) {
+void update_bot(Bot *bot, float delta) {
     uint64_t now = get_time_ms();
-    float dist = distance_to_player();
+    float dist = distance_to_player(bot);
 
     // No player to follow yet - just idle
-    if (player_id_to_follow == 0) {
-        send_update(sock, server_addr, STATE_IDLE, "Idle");
+    if (bot->player_id_to_follow == 0) {
+        send_update(bot, STATE_IDLE, "Idle");
         return;
     }
 
     // Always face the direction we're moving (or the player if close)
-    rot_y = angle_to_player();
+    bot->rot_y = angle_to_player(bot);
 
-    switch (combat_state) {
+    switch (bot->combat_state) {
         case BOT_STATE_FOLLOWING:
             // Follow the player, maintaining target distance
-            if (dist > target_follow_dist + 1.0f) {
+            if (dist > bot->target_follow_dist + 1.0f) {
                 // Too far - run towards player
-                float dx = player_x - pos_x;
-                float dz = player_z - pos_z;
+                float dx = bot->player_x - bot->pos_x;
+                float dz = bot->player_z - bot->pos_z;
                 float len = sqrtf(dx*dx + dz*dz);
                 if (len > 0.1f) {
-                    pos_x += (dx / len) * move_speed * delta;
-                    pos_z += (dz / len) * move_speed * delta;
+                    bot->pos_x += (dx / len) * move_speed * delta;
+                    bot->pos_z += (dz / len) * move_speed * delta;
                 }
-                send_update(sock, server_addr, STATE_RUNNING, "Run");
-            } else if (dist < target_follow_dist - 1.0f) {
+                send_update(bot, STATE_RUNNING, "Run");
+            } else if (dist < bot->target_follow_dist - 1.0f) {
                 // Too close - back up a bit
-                float dx = player_x - pos_x;
-                float dz = player_z - pos_z;
+                float dx = bot->player_x - bot->pos_x;
+                float dz = bot->player_z - bot->pos_z;
                 float len = sqrtf(dx*dx + dz*dz);
                 if (len > 0.1f) {
-                    pos_x -= (dx / len) * move_speed * 0.5f * delta;
-                    pos_z -= (dz / len) * move_speed * 0.5f * delta;
+                    bot->pos_x -= (dx / len) * move_speed * 0.5f * delta;
+                    bot->pos_z -= (dz / len) * move_speed * 0.5f * delta;
                 }
-                send_update(sock, server_addr, STATE_WALKING, "Walk");
-            } else {
+                send_update(bot, STATE_WALKING, "Walk");
+            } else if (arrow_interval_ms > 0) {
                 // Good distance - shoot an arrow!
-                combat_state = BOT_STATE_AIMING;
-                state_start_time = now;
+                bot->combat_state = BOT_STATE_AIMING;
+                bot->state_start_time = now;
+            } else {
+                send_update(bot, STATE_IDLE, "Idle");
             }
             break;
 
         case BOT_STATE_AIMING:
-            // Draw bow animation (500ms)
-            send_update(sock, server_addr, STATE_DRAWING_BOW, "Attack");
-            if (now - state_start_time >= 500) {
-                combat_state = BOT_STATE_SHOOTING;
-                state_start_time = now;
+            // Draw bow animation
+            send_update(bot, STATE_DRAWING_BOW, "Attack");
+            if (now - bot->state_start_time >= AIM_TIME_MS) {
+                bot->combat_state = BOT_STATE_SHOOTING;
+                bot->state_start_time = now;
             }
             break;
 
         case BOT_STATE_SHOOTING:
             // Release arrow
-            send_arrow(sock, server_addr);
-            send_update(sock, server_addr, STATE_ATTACKING, "Attack");
-            combat_state = BOT_STATE_COOLDOWN;
-            state_start_time = now;
-            last_arrow_time = now;
+            send_arrow(bot);
+            send_update(bot, STATE_ATTACKING, "Attack");
+            bot->combat_state = BOT_STATE_COOLDOWN;
+            bot->state_start_time = now;
+            bot->last_arrow_time = now;
             break;
 
         case BOT_STATE_COOLDOWN:
-            // Wait for cooldown, then go back to following
-            send_update(sock, server_addr, STATE_IDLE, "Idle");
-            if (now - state_start_time >= 1500) {
-                combat_state = BOT_STATE_FOLLOWING;
+            // Wait out the rest of the arrow interval, then go back to following
+            send_update(bot, STATE_IDLE, "Idle");
+            if (now - bot->state_start_time + AIM_TIME_MS >= (uint64_t)arrow_interval_ms) {
+                bot->combat_state = BOT_STATE_FOLLOWING;
                 // Pick a new random follow distance occasionally
                 if (rand() % 3 == 0) {
-                    target_follow_dist = random_range(MIN_FOLLOW_DIST, MAX_FOLLOW_DIST);
+                    bot->target_follow_dist = random_range(MIN_FOLLOW_DIST, MAX_FOLLOW_DIST);
                 }
-                state_start_time = now;
+                bot->state_start_time = now;
             }
             break;
     }
 }
 
+void bot_send(Bot *bot, const void *pkt, size_t len) {
+    if (len > BOT_TX_BYTES) return;
+    if (bot->tx_count == BOT_TX_QUEUE) bot_flush(bot);
+
+    int n = bot->tx_count++;
+    memcpy(bot->tx_data[n], pkt, len);
+    bot->tx_iov[n].iov_base = bot->tx_data[n];
+    bot->tx_iov[n].iov_len = len;
+    memset(&bot->tx_msgs[n], 0, sizeof(bot->tx_msgs[n]));
+    bot->tx_msgs[n].msg_hdr.msg_iov = &bot->tx_iov[n];
+    bot->tx_msgs[n].msg_hdr.msg_iovlen = 1;
+}
+
+// Send everything the bot has queued in one sendmmsg. The socket is
+// connected to the server, so the messages carry no address.
+void bot_flush(Bot *bot) {
+    if (bot->tx_count == 0) return;
+
+    int sent = sendmmsg(bot->sock, bot->tx_msgs, bot->tx_count, 0);
+    if (sent < 0) sent = 0;
+    tx_packets += sent;
+    tx_errors += bot->tx_count - sent;
+    bot->tx_count = 0;
+}
+
+// Drain the bot's socket in recvmmsg batches and handle every datagram
+void bot_receive(Bot *bot) {
+    static uint8_t buffers[RECV_BATCH][RECV_BUFFER_SIZE];
+    static struct iovec iov[RECV_BATCH];
+    static struct mmsghdr msgs[RECV_BATCH];
+
+    for (int i = 0; i < RECV_BATCH; i++) {
+        iov[i].iov_base = buffers[i];
+        iov[i].iov_len = RECV_BUFFER_SIZE;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n;
+    do {
+        n = recvmmsg(bot->sock, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+        for (int i = 0; i < n; i++) {
+            rx_packets++;
+            rx_bytes += msgs[i].msg_len;
+            handle_packet(bot, buffers[i], msgs[i].msg_len);
+        }
+    } while (n == RECV_BATCH);
+
+    // Acks and dictionary requests made while handling
+    if (bot->reliable_ack_due) {
+        send_reliable_ack(bot);
+    }
+    bot_flush(bot);
+}
+
+// Give the bot its own socket, connected to the server and watched by
+// epoll_fd. Returns -1 (after reporting why) on failure.
+int init_bot(Bot *bot, int id, int epoll_fd) {
+    memset(bot, 0, sizeof(*bot));
+    bot->id = id;
+    bot->pos_y = 1.0f;
+    bot->pos_z = 10.0f;
+    bot->player_y = 1.0f;
+    bot->target_follow_dist = 5.0f;
+    bot->combat_state = BOT_STATE_FOLLOWING;
+
+    bot->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (bot->sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(bot->sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("connect");
+        close(bot->sock);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = bot;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, bot->sock, &ev) < 0) {
+        perror("epoll_ctl");
+        close(bot->sock);
+        return -1;
+    }
+    return 0;
+}
+
+void free_bot(Bot *bot) {
+    close(bot->sock);
+    for (int i = 0; i < SNAPSHOT_RING_SIZE; i++) {
+        free(bot->snapshot_ring[i].players);
+    }
+    free(bot->pending_snapshot.players);
+}
+
+// Every bot holds a socket; lift the soft descriptor limit as far as allowed
+void raise_fd_limit(int needed) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)needed) {
+        rl.rlim_cur = (rlim_t)needed < rl.rlim_max ? (rlim_t)needed : rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// Swarm totals since the previous report
+void print_swarm_report(const Bot *bots, int bot_count, uint64_t interval_ms) {
+    static uint64_t last_tx = 0, last_rx = 0, last_rx_bytes = 0;
+
+    int joined = 0;
+    for (int i = 0; i < bot_count; i++) {
+        if (bots[i].player_id != 0) joined++;
+    }
+
+    double secs = interval_ms / 1000.0;
+    printf("[Swarm] %d/%d joined | tx %.0f pkt/s | rx %.0f pkt/s, %.1f KB/s | %llu send errors\n",
+           joined, bot_count,
+           (tx_packets - last_tx) / secs,
+           (rx_packets - last_rx) / secs,
+           (rx_bytes - last_rx_bytes) / secs / 1024.0,
+           (unsigned long long)tx_errors);
+    fflush(stdout);
+
+    last_tx = tx_packets;
+    last_rx = rx_packets;
+    last_rx_bytes = rx_bytes;
+}
+
+// --stats: ask the server for its stats block and print it. Returns the
+// process exit code.
+int query_stats(int sock, struct sockaddr_in *server_addr) {
+    StatsPacket query;
+    memset(&query, 0, sizeof(query));
+    query.header.type = PKT_STATS;
+    query.header.sequence = (uint32_t)getpid();
+
+    sendto(sock, &query, sizeof(query), 0,
+           (struct sockaddr*)server_addr, sizeof(*server_addr));
+
+    struct timeval timeout = { STATS_TIMEOUT_MS / 1000, (STATS_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    StatsPacket reply;
+    for (;;) {
+        ssize_t len = recv(sock, &reply, sizeof(reply), 0);
+        if (len < 0) {
+            fprintf(stderr, "No stats reply from the server\n");
+            return 1;
+        }
+        if (len >= (ssize_t)sizeof(reply) && reply.header.type == PKT_STATS &&
+            reply.header.sequence == query.header.sequence) {
+            break;
+        }
+    }
+
+    printf("Uptime: %u s\n", reply.uptime_sec);
+    printf("Players: %u/%u, spectators: %u\n", reply.players, reply.max_players, reply.spectators);
+    printf("Entities: %u Bobbas, %u Dragons\n", reply.bobbas, reply.dragons);
+    printf("Over the last %.1f s:\n", reply.window_ms / 1000.0);
+    printf("  Ticks: %.1f/s (configured %u Hz), %u overruns\n",
+           reply.ticks_per_sec, reply.tick_rate, reply.tick_overruns);
+    printf("  Tick time: avg %u us, p99 %u us, max %u us\n",
+           reply.tick_avg_us, reply.tick_p99_us, reply.tick_max_us);
+    printf("  Packets: rx %.1f/s, tx %.1f/s\n", reply.rx_packets_per_sec, reply.tx_packets_per_sec);
+    printf("Socket receive drops: %u\n", reply.rx_socket_drops);
+    return 0;
+}
+
+void print_latency_row(const char *name, const Histogram *h) {
+    printf("  %-16s %8llu %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", name,
+           (unsigned long long)h->count,
+           hist_mean(h) / 1e6,
+           hist_percentile(h, 0.50) / 1e6,
+           hist_percentile(h, 0.90) / 1e6,
+           hist_percentile(h, 0.99) / 1e6,
+           hist_percentile(h, 0.999) / 1e6,
+           h->max / 1e6);
+}
+
+// End-of-run latency percentiles, in milliseconds
+void print_latency_report(void) {
+    printf("Latency (ms)        samples      mean       p50       p90       p99     p99.9       max\n");
+    print_latency_row("RTT", &rtt_hist);
+    print_latency_row("Update to echo", &echo_hist);
+    printf("Pings answered: %llu of %llu\n",
+           (unsigned long long)rtt_hist.count, (unsigned long long)pings_sent);
+}
+
+void print_reliable_report(void) {
+    uint64_t total = 0;
+    for (int i = 0; i < 256; i++) total += reliable_delivered[i];
+    if (total == 0 && reliable_duplicates == 0 && reliable_stale == 0) return;
+
+    printf("Reliable messages: %llu delivered (%llu join acks, %llu damage, %llu restarts), "
+           "%llu held for ordering, %llu duplicates, %llu from an old channel\n",
+           (unsigned long long)total,
+           (unsigned long long)reliable_delivered[PKT_JOIN_ACK],
+           (unsigned long long)reliable_delivered[PKT_PLAYER_DAMAGE],
+           (unsigned long long)reliable_delivered[PKT_GAME_RESTART],
+           (unsigned long long)reliable_held, (unsigned long long)reliable_duplicates,
+           (unsigned long long)reliable_stale);
+}
+
 int main(int argc, char *argv[]) {
     const char *server_ip = DEFAULT_SERVER;
     int server_port = DEFAULT_PORT;
+    int stats_only = 0;
+    int first_id = 1;
+    int bot_count = 1;
+    int update_rate = DEFAULT_UPDATE_RATE;
+    int ramp_sec = 0;
+    int duration_sec = 0;
+
+    // Positional: [bot_id] [server_ip] [port]; flags may appear anywhere.
+    // --stats takes no bot_id.
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--legacy-protocol") == 0) {
+            client_caps = 0;
+        } else if (strcmp(argv[i], "--no-bundle") == 0) {
+            client_caps &= ~CAP_BUNDLE;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_only = 1;
+            if (positional == 0) positional++;
+        } else if (strcmp(argv[i], "--swarm") == 0 && i + 1 < argc) {
+            bot_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            update_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--arrow-ms") == 0 && i + 1 < argc) {
+            arrow_interval_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ramp") == 0 && i + 1 < argc) {
+            ramp_sec = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            duration_sec = atoi(argv[++i]);
+        } else if (positional == 0) {
+            first_id = atoi(argv[i]); positional++;
+        } else if (positional == 1) {
+            server_ip = argv[i]; positional++;
+        } else if (positional == 2) {
+            server_port = atoi(argv[i]); positional++;
+        }
+    }
+
+    if (bot_count < 1 || bot_count > MAX_SWARM_BOTS) {
+        fprintf(stderr, "--swarm must be between 1 and %d\n", MAX_SWARM_BOTS);
+        return 1;
+    }
+    if (update_rate < 1 || update_rate > 1000) {
+        fprintf(stderr, "--rate must be between 1 and 1000\n");
+        return 1;
+    }
+    if (arrow_interval_ms < 0 || ramp_sec < 0 || duration_sec < 0) {
+        fprintf(stderr, "--arrow-ms, --ramp and --duration can't be negative\n");
+        return 1;
+    }
+    update_interval_ms = 1000 / update_rate;
 
-    if (argc > 1) bot_id = atoi(argv[1]);
-    if (argc > 2) server_ip = argv[2];
-    if (argc > 3) server_port = atoi(argv[3]);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(server_port);
+    inet_pton(AF_INET, server_ip, &server_addr.sin_addr);
 
-    srand(time(NULL) + bot_id);
+    if (stats_only) {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock < 0) {
+            perror("socket");
+            return 1;
+        }
+        int rc = query_stats(sock, &server_addr);
+        close(sock);
+        return rc;
+    }
+
+    srand(time(NULL) + first_id);
 
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
+    verbose = (bot_count == 1);
+
     printf("===========================================\n");
-    printf("  Player Companion Bot #%d\n", bot_id);
+    if (bot_count == 1) {
+        printf("  Player Companion Bot #%d\n", first_id);
+    } else {
+        printf("  Bot Swarm: %d bots (#%d-#%d)\n", bot_count, first_id, first_id + bot_count - 1);
+    }
     printf("===========================================\n");
     printf("Server: %s:%d\n", server_ip, server_port);
     printf("Follow distance: %.1f-%.1fm\n", MIN_FOLLOW_DIST, MAX_FOLLOW_DIST);
+    printf("Updates: %d Hz, arrows: ", update_rate);
+    if (arrow_interval_ms > 0) {
+        printf("every %d ms\n", arrow_interval_ms);
+    } else {
+        printf("off\n");
+    }
+    if (bot_count > 1) {
+        printf("Ramp-up: %d s\n", ramp_sec);
+    }
+    if (duration_sec > 0) {
+        printf("Duration: %d s\n", duration_sec);
+    }
     printf("Press Ctrl+C to stop\n");
     printf("===========================================\n\n");
 
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0) {
-        perror("socket");
+    raise_fd_limit(bot_count + 16);
+    hist_reset(&rtt_hist);
+    hist_reset(&echo_hist);
+
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
         return 1;
     }
 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(server_port);
-    inet_pton(AF_INET, server_ip, &server_addr.sin_addr);
-
-    printf("[Bot %d] Waiting 1 second before joining...\n", bot_id);
-    sleep(1);
+    Bot *bots = calloc(bot_count, sizeof(Bot));
+    if (!bots) {
+        fprintf(stderr, "Out of memory for %d bots\n", bot_count);
+        return 1;
+    }
+    for (int i = 0; i < bot_count; i++) {
+        if (init_bot(&bots[i], first_id + i, epoll_fd) < 0) {
+            fprintf(stderr, "Could only create %d of %d bots\n", i, bot_count);
+            return 1;
+        }
+    }
 
-    send_join(sock, &server_addr);
+    if (verbose) {
+        printf("[Bot %d] Waiting 1 second before joining...\n", first_id);
+    }
 
-    uint64_t last_update = get_time_ms();
+    // Bots join JOIN_DELAY_MS in, spread evenly over the ramp-up
+    uint64_t start = get_time_ms();
+    uint64_t ramp_ms = (uint64_t)ramp_sec * 1000;
+    uint64_t last_report = start;
+    int started = 0;
+    struct epoll_event events[EPOLL_BATCH];
 
     while (running) {
         uint64_t now = get_time_ms();
+        if (duration_sec > 0 && now - start >= (uint64_t)duration_sec * 1000) break;
+
+        while (started < bot_count &&
+               now >= start + JOIN_DELAY_MS + ramp_ms * started / bot_count) {
+            Bot *bot = &bots[started++];
+            send_join(bot);
+            bot_flush(bot);
+            bot->last_update = now;
+        }
 
-        receive_packets(sock);
+        uint64_t next_due = now + update_interval_ms;
+        for (int i = 0; i < started; i++) {
+            Bot *bot = &bots[i];
 
-        if (now - last_update >= UPDATE_INTERVAL_MS) {
-            float delta = (now - last_update) / 1000.0f;
-            last_update = now;
+            if (bot->player_id == 0) {
+                // JOIN or JOIN_ACK lost, or the server is full
+                if (now - bot->join_sent_time >= JOIN_RETRY_MS) {
+                    send_join(bot);
+                    bot_flush(bot);
+                }
+                continue;
+            }
 
-            if (my_player_id != 0) {
-                update_bot(sock, &server_addr, delta);
+            if (now - bot->last_ping_time >= PING_INTERVAL_MS) {
+                bot->last_ping_time = now;
+                send_ping(bot);
+            }
+            if (now - bot->last_update >= (uint64_t)update_interval_ms) {
+                float delta = (now - bot->last_update) / 1000.0f;
+                bot->last_update = now;
+                update_bot(bot, delta);
+                bot_flush(bot);
             }
+            uint64_t due = bot->last_update + update_interval_ms;
+            if (due < next_due) next_due = due;
+        }
+
+        if (!verbose && now - last_report >= SWARM_REPORT_SEC * 1000) {
+            print_swarm_report(bots, bot_count, now - last_report);
+            last_report = now;
         }
 
-        usleep(1000);
+        int timeout = next_due > now ? (int)(next_due - now) : 0;
+        int n = epoll_wait(epoll_fd, events, EPOLL_BATCH, timeout);
+        for (int i = 0; i < n; i++) {
+            bot_receive((Bot*)events[i].data.ptr);
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        send_leave(&bots[i]);
+        bot_flush(&bots[i]);
+    }
+
+    if (!verbose) {
+        double secs = (get_time_ms() - start) / 1000.0;
+        printf("[Swarm] Done after %.1f s: sent %llu packets (%llu errors), received %llu packets, %.1f KB\n",
+               secs, (unsigned long long)tx_packets, (unsigned long long)tx_errors,
+               (unsigned long long)rx_packets, rx_bytes / 1024.0);
+    } else {
+        printf("[Bot %d] Disconnected\n", first_id);
+    }
+    print_latency_report();
+    print_reliable_report();
+    if (bundles_received > 0) {
+        printf("Bundles: %llu datagrams carrying %llu packets\n",
+               (unsigned long long)bundles_received, (unsigned long long)bundled_packets);
     }
 
-    send_leave(sock, &server_addr);
-    close(sock);
-    printf("[Bot %d] Disconnected\n", bot_id);
+    for (int i = 0; i < bot_count; i++) {
+        free_bot(&bots[i]);
+    }
+    free(bots);
+    close(epoll_fd);
 
     return 0;
 }
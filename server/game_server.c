@@ -2,15 +2,26 @@
  * Douglass The Keeper - Multiplayer UDP Server
  *
  * A simple UDP game server that handles multiple players.
- * Single-threaded event loop with non-blocking UDP socket.
+ * Single-threaded epoll event loop with non-blocking UDP socket; a timerfd
+ * wakes the loop for broadcast, simulation step and stats deadlines. Entity
+ * AI runs in fixed-size steps (see SimClock) spread over a small worker pool
+ * (see JOB SYSTEM).
  *
- * Compile: gcc -o game_server game_server.c -lm
- * Run: ./game_server [port]
+ * Compile: gcc -o game_server game_server.c -lpthread -lm
+ * Run: ./game_server [port] [--max-players N] [--bobbas N] [--threads N] [--no-simd]
+ *                    [--tick-rate HZ] [--log-level LEVEL] [--metrics-file PATH]
+ *                    [--record PATH] [--test-multiplayer]
+ *      ./game_server --replay PATH [--replay-fast] [--threads N] [--log-level LEVEL]
  */
 
+#define _GNU_SOURCE  // recvmmsg
+
 #include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -21,15 +32,49 @@
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "bitpack.h"
+#include "histogram.h"
 
 #define DEFAULT_PORT 7777
-#define MAX_PLAYERS 32
+#define DEFAULT_MAX_PLAYERS 32     // Player slots unless --max-players is given
+#define MAX_PLAYERS_LIMIT 1024     // Upper bound for --max-players
+#define WORLD_STATE_MAX_PLAYERS 32 // PlayerData slots in WorldStatePacket (protocol.gd)
 #define MAX_ENTITIES 64
-#define MAX_BOBBAS 4
+#define DEFAULT_MAX_BOBBAS 4       // Bobba slots unless --bobbas asks for more
+#define MAX_BOBBAS_LIMIT 16384     // Upper bound for --bobbas (entity state must fit the send arena)
+#define BOBBA_SPAWN_SPREAD 200.0f  // Extra --bobbas spawn within this square around the origin
 #define BUFFER_SIZE 2048
+#define MAX_DATAGRAM_BYTES 1200    // Split world state so each datagram fits a typical MTU
+#define RECV_BATCH_SIZE 64         // Datagrams pulled per recvmmsg call
+#define RECV_MAX_BATCHES 16        // Cap per drain so broadcasts can't starve
+#define SEND_QUEUE_SIZE 256        // Datagrams per sendmmsg call
+#define SEND_ARENA_SIZE (1024 * 1024) // Payload bytes staged per flush
+#define NET_STATS_INTERVAL_SEC 10  // How often syscall counters are printed
+#define METRICS_INTERVAL_SEC 5     // How often --metrics-file is rewritten
+#define PHASE_HIST_MIN_LOG2 10     // Exported phase time buckets: ~1 us ..
+#define PHASE_HIST_MAX_LOG2 32     // ~4.3 s
+#define BATCH_HIST_MAX_LOG2 9      // Exported batch size buckets: 1 .. 512
+#define STATS_WINDOW_SEC 5         // PKT_STATS rates and tick times cover the last window this long
 #define PLAYER_TIMEOUT_SEC 10
+#define TIMER_WHEEL_TICK_MS 10     // Resolution of AI timers and player timeouts
+#define TIMER_WHEEL_BITS 6         // 64 slots per wheel level
+#define TIMER_WHEEL_LEVELS 4       // 64^4 ticks (~46 hours) before timers wrap the outer level
 #define BROADCAST_INTERVAL_MS 50   // 20 Hz (slower to avoid buffer overflow)
-#define ENTITY_UPDATE_INTERVAL_MS 50  // 20 Hz for entity updates (same as world state)
+#define DEFAULT_TICK_RATE 20       // Fixed simulation steps per second unless --tick-rate is given
+#define MAX_TICK_RATE 120          // Upper bound for --tick-rate
+#define SIM_MAX_SUBSTEPS 5         // Catch-up steps per wakeup after a stall; the rest is dropped
+#define NS_PER_MS 1000000ULL
 
 // Player state flags
 #define STATE_IDLE      0
@@ -58,6 +103,82 @@
 #define PKT_SPECTATE_ACK 16  // MSG_SPECTATE_ACK
 #define PKT_PLAYER_DAMAGE 17 // MSG_PLAYER_DAMAGE - Server -> Client when entity hits player
 #define PKT_GAME_RESTART  18 // MSG_GAME_RESTART - Bidirectional: request/broadcast game restart
+#define PKT_WORLD_DELTA   19 // Server -> Client: world state delta-encoded against an acked snapshot
+#define PKT_ENTITY_STATE_Q 20 // Server -> Client: quantized, bit-packed entity state
+#define PKT_ANIM_DICT     21 // Server -> Client: animation ID table entries; Client -> Server: request full table
+#define PKT_UPDATE_COMPACT 22 // Client -> Server: player update carrying an animation ID
+#define PKT_STATS         23 // Client -> Server: stats query (padded); Server -> Client: StatsPacket
+#define PKT_RELIABLE      24 // Server -> Client: sequenced wrapper for a message that must arrive; Client -> Server: bare ReliableAck
+#define PKT_BUNDLE        25 // Server -> Client: several packets for one client coalesced into one datagram
+
+// Client capabilities, advertised in the optional JoinPacket trailer.
+// Clients that send a plain JoinPacket get the original protocol.
+#define CAP_DELTA_SNAPSHOT (1u << 0)  // Understands PKT_WORLD_DELTA, acks with PKT_ACK
+#define CAP_QUANTIZED      (1u << 1)  // Quantized fields (bitpack.h) in PKT_WORLD_DELTA, gets PKT_ENTITY_STATE_Q
+#define CAP_ANIM_IDS       (1u << 2)  // Animation IDs in PKT_WORLD_DELTA, gets PKT_ANIM_DICT, may send PKT_UPDATE_COMPACT
+#define CAP_RELIABLE       (1u << 3)  // Gets PKT_JOIN_ACK, PKT_PLAYER_DAMAGE and PKT_GAME_RESTART inside PKT_RELIABLE, acks with ReliableAck; needs reliable_epoch
+#define CAP_BUNDLE         (1u << 4)  // Gets a tick's packets coalesced into PKT_BUNDLE datagrams
+
+// Reliable channel (CAP_RELIABLE)
+#define RELIABLE_WINDOW 32         // Messages in flight per client, as far as one ReliableAck reaches
+#define RELIABLE_MAX_PAYLOAD 96    // Largest wrapped message (JoinAckPacket is 74 bytes)
+#define RELIABLE_INITIAL_RTO_MS 200  // Retransmission timeout before the first RTT sample
+#define RELIABLE_MIN_RTO_MS 50
+#define RELIABLE_MAX_RTO_MS 2000   // Also caps exponential backoff
+#define RELIABLE_MAX_RETRIES 8     // Retransmissions of one message before the channel is stopped (~11 s)
+
+// Message bundling (CAP_BUNDLE)
+#define BUNDLE_MAX_BYTES MAX_DATAGRAM_BYTES  // Packets that would overflow a bundle start the next one
+#define BUNDLE_ARENA_SIZE (1024 * 1024)      // Open and queued bundles per flush
+
+// Animation interning
+#define MAX_ANIMATIONS 256         // Interned animation names (ID 0 = unknown/empty)
+#define ANIM_NAME_LEN 32           // Matches PlayerData.anim_name
+#define ANIM_MAX_PER_PLAYER 32     // New names one player may add to the shared table
+#define ANIM_DICT_MAX_BYTES 1200   // Split PKT_ANIM_DICT so each datagram fits a typical MTU
+
+// Session recording (--record / --replay)
+#define RECORDING_MAGIC "LOBREC01"
+#define RECORDING_GROW_BYTES (64 * 1024 * 1024)  // The log file grows and is remapped this much at a time
+
+// Logging
+#define LOG_RING_SIZE 4096         // Records buffered for the writer thread (power of two)
+#define LOG_RECORD_BYTES 128       // Fixed record size, header included
+#define LOG_WRITER_IDLE_US 5000    // Writer sleep while the ring is empty
+
+// Log levels (--log-level); a record is kept if its level <= log_level
+#define LOG_ERROR 0
+#define LOG_WARN  1
+#define LOG_INFO  2
+#define LOG_DEBUG 3
+
+// AI job system
+#define JOB_MAX_WORKERS 64         // Upper bound for --threads (counts the event loop thread)
+#define JOB_DEFAULT_WORKERS 8      // --threads default: one per CPU, up to this many
+#define JOB_MAX_BATCH 256          // Jobs per batch; also each worker deque's capacity (power of two)
+#define BOBBA_JOB_MIN_SLOTS 256    // Smallest Bobba slot range worth handing to a job
+
+// Spatial grid for AI range queries
+#define GRID_CELL_SIZE 16.0f       // Meters; Bobba detection checks touch at most 3x3 cells
+#define GRID_COARSE_CELL_SIZE 80.0f // Meters; coarse occupancy for AI level of detail
+
+// Delta snapshot settings
+#define SNAPSHOT_RING_SIZE 32      // Snapshots kept as baselines (1.6 s at 20 Hz)
+#define DELTA_ENTRY_MAX_BYTES 64   // Worst-case entry: raw floats + 31-char animation name
+#define DELTA_CHUNK_MAX_ENTRIES 255  // WorldDeltaHeader.entry_count is a uint8_t
+
+// PKT_WORLD_DELTA per-player field mask
+#define DELTA_FIELD_POS    (1u << 0)  // pos_x, pos_y, pos_z
+#define DELTA_FIELD_ROT    (1u << 1)  // rot_y
+#define DELTA_FIELD_STATE  (1u << 2)  // state, combat_mode, character_class
+#define DELTA_FIELD_HEALTH (1u << 3)  // health
+#define DELTA_FIELD_ANIM   (1u << 4)  // Animation (ID or 5-bit length + name bytes)
+#define DELTA_FIELD_ALL    0x1F
+#define DELTA_FIELD_BITS   5
+
+// PKT_ENTITY_STATE_Q chunking
+#define ENTITY_Q_ENTRY_MAX_BYTES 24  // Worst-case entry: Dragon with 5-byte varuints
+#define ENTITY_Q_CHUNK_MAX_ENTRIES 255  // EntityStateQHeader.entity_count is a uint8_t
 
 // Entity types
 #define ENTITY_BOBBA     0
@@ -85,6 +206,18 @@
 #define BOBBA_HIT_WINDOW_START 0.3f  // 30% into attack animation
 #define BOBBA_HIT_WINDOW_END   0.7f  // 70% into attack animation
 
+// AI level of detail: Bobbas with no player nearby think less often, over a
+// correspondingly longer delta. Tiers by nearest player distance:
+//   near  targeting, attacking, stunned, or a player within BOBBA_LOSE_RADIUS
+//   mid   possibly a player within GRID_COARSE_CELL_SIZE (players_possibly_near)
+//   far   every player farther than that, so one would need 70 m to reach
+//         detection range between steps
+#define AI_LOD_NEAR 0
+#define AI_LOD_MID  1
+#define AI_LOD_FAR  2
+#define AI_LOD_MID_RATE 5          // AI steps per second
+#define AI_LOD_FAR_RATE 2
+
 // Dragon states (must match protocol.gd DragonState)
 #define DRAGON_PATROL        0
 #define DRAGON_FLYING_TO_LAND 1
@@ -132,6 +265,65 @@ typedef struct {
     char player_name[32];
 } JoinPacket;
 
+// Join packet with capability trailer (newer clients). Trailer fields are
+// optional: older clients stop after caps.
+typedef struct {
+    JoinPacket join;
+    uint32_t caps;             // CAP_* bits
+    uint32_t reliable_epoch;   // CAP_RELIABLE: nonzero ID of the client's reliable channel
+} JoinCapsPacket;
+
+// Snapshot ack (client -> server, PKT_ACK)
+typedef struct {
+    PacketHeader header;
+    uint32_t snapshot_seq;     // Newest PKT_WORLD_DELTA the client has applied
+} SnapshotAckPacket;
+
+// Reliable channel wrapper (server -> client, PKT_RELIABLE), followed by
+// the whole message. The epoch is the one the client sent in its JOIN, so
+// neither side mistakes a message or ack from an earlier channel for the
+// current one.
+typedef struct {
+    PacketHeader header;       // sequence = channel sequence
+    uint32_t epoch;
+} ReliableHeader;
+
+// Reliable channel ack (client -> server). CAP_RELIABLE clients append it to
+// PKT_UPDATE, PKT_UPDATE_COMPACT and PKT_ACK, or send it after a bare
+// PKT_RELIABLE header.
+typedef struct {
+    uint32_t epoch;            // Channel being acked
+    uint32_t next_seq;         // Every message before this one arrived
+    uint32_t received_bits;    // Bit i: next_seq + 1 + i arrived too (held for ordering)
+} ReliableAck;
+
+// Delta world state header (server -> client, PKT_WORLD_DELTA). A snapshot
+// is split into chunk_count datagrams of at most MAX_DATAGRAM_BYTES; each
+// carries entry_count consecutive players starting at first_index of the
+// player_count in the snapshot. The header is followed by a bitstream
+// (bitpack.h) of entries, sorted by player_id:
+//   varuint  player_id minus the previous entry's id (0 before the first
+//            entry of each chunk, so chunks decode independently)
+//   5 bits   DELTA_FIELD_* mask
+//   fields named by the mask, in bit order. With CAP_QUANTIZED:
+//     pos 17/15/17 bits, rot 12 bits, state 4+1+2 bits, health 8 bits;
+//   otherwise raw 32-bit floats and 8-bit state fields. The animation is
+//   a varuint ID with CAP_ANIM_IDS, otherwise a 5-bit length plus bytes.
+// Players missing from the reassembled snapshot have left. Clients ack a
+// snapshot only once every chunk has arrived. baseline_seq 0 means a full
+// snapshot. Clients that negotiated CAP_QUANTIZED but not
+// CAP_DELTA_SNAPSHOT always get full snapshots.
+typedef struct {
+    PacketHeader header;
+    uint32_t snapshot_seq;
+    uint32_t baseline_seq;
+    uint16_t player_count;     // Players in the whole snapshot
+    uint16_t first_index;      // Snapshot position of this chunk's first entry
+    uint8_t entry_count;       // Entries in this chunk
+    uint8_t chunk_index;
+    uint8_t chunk_count;
+} WorldDeltaHeader;
+
 // Update packet (client -> server)
 typedef struct {
     PacketHeader header;
@@ -146,11 +338,14 @@ typedef struct {
 } JoinAckPacket;
 
 // World state packet (server -> client) - MUST match Godot protocol.gd
+// Variable length on the wire: only the first player_count entries are sent.
+// Always one datagram holding the whole roster, which old clients replace
+// wholesale; rosters past WORLD_STATE_MAX_PLAYERS are cut to fit.
 typedef struct {
     PacketHeader header;
     uint32_t state_seq;        // 4 bytes - State sequence number
     uint8_t player_count;      // 1 byte - Number of players
-    PlayerData players[MAX_PLAYERS];
+    PlayerData players[WORLD_STATE_MAX_PLAYERS];
 } WorldStatePacket;
 
 // Entity data for network sync (Bobba, Dragon)
@@ -166,6 +361,9 @@ typedef struct {
 } EntityData;
 
 // Entity state packet (host -> server -> clients)
+// Variable length on the wire: only the first entity_count entries are sent.
+// Always one datagram holding the whole entity set, which old clients
+// replace wholesale; sets past MAX_ENTITIES are cut to fit.
 typedef struct {
     PacketHeader header;
     uint8_t entity_count;
@@ -206,51 +404,207 @@ typedef struct {
     float knockback_x, knockback_y, knockback_z;
 } PlayerDamagePacket;
 
+// Animation dictionary (server -> client, PKT_ANIM_DICT). Followed by
+// entry_count entries of: id u16, name length u8, name bytes. A client that
+// sees an unknown ID sends a bare PKT_ANIM_DICT header to get the full table.
+typedef struct {
+    PacketHeader header;
+    uint8_t entry_count;
+} AnimDictHeader;
+
+// Compact player update (client -> server, PKT_UPDATE_COMPACT). Same fields
+// as UpdatePacket, with the animation as an ID from the dictionary and the
+// player ID taken from the header.
+typedef struct {
+    PacketHeader header;
+    float pos_x, pos_y, pos_z;
+    float rot_y;
+    uint8_t state;
+    uint8_t combat_mode;
+    uint8_t character_class;
+    float health;
+    uint16_t anim_id;
+} CompactUpdatePacket;
+
+// Quantized entity state header (server -> client, PKT_ENTITY_STATE_Q).
+// Split like PKT_ENTITY_STATE; each datagram is followed by a bitstream of
+// entity_count entries:
+//   2 bits entity_type, varuint entity_id, pos 17/15/17 bits, rot 12 bits,
+//   3 bits state, 10 bits health; Dragons add varuint extra1 (laps) and
+//   12 bits extra2 (patrol angle, wrap the decoded value into [0, 2pi)).
+typedef struct {
+    PacketHeader header;
+    uint8_t entity_count;
+} EntityStateQHeader;
+
+// Server stats (PKT_STATS). A query is a PKT_STATS header padded with
+// zeros to sizeof(StatsPacket), so answering it never amplifies traffic;
+// the reply echoes the query's sequence. Rates and tick times cover the
+// last complete STATS_WINDOW_SEC window (the current one until the first
+// window completes).
+typedef struct {
+    PacketHeader header;
+    uint32_t uptime_sec;
+    uint16_t players;
+    uint16_t max_players;
+    uint16_t spectators;
+    uint16_t bobbas;
+    uint16_t dragons;
+    uint16_t tick_rate;        // Configured simulation steps per second
+    uint32_t window_ms;        // Span the figures below were measured over
+    float ticks_per_sec;
+    uint32_t tick_avg_us;      // Simulation step time
+    uint32_t tick_p99_us;
+    uint32_t tick_max_us;
+    uint32_t tick_overruns;    // Steps longer than one period in the window
+    float rx_packets_per_sec;
+    float tx_packets_per_sec;
+    uint32_t rx_socket_drops;  // Since startup (SO_RXQ_OVFL)
+} StatsPacket;
+
 // Game restart packet (client -> server -> all clients)
 typedef struct {
     PacketHeader header;
     uint32_t reason;  // 0 = player died, 1 = bobba died, 2 = manual restart
 } GameRestartPacket;
 
+// Session recording file (--record). The header is followed by
+// record_count records of a RecordEntry plus len datagram bytes. Counts are
+// updated with every record, so a log cut short by a crash still replays up
+// to its last datagram.
+typedef struct {
+    char magic[8];             // RECORDING_MAGIC
+    uint32_t seed;             // srand() seed of the session
+    uint16_t tick_rate;        // Options that shape the simulation, reapplied on replay
+    uint16_t max_players;
+    uint16_t bobba_count;
+    uint8_t test_multiplayer;
+    uint8_t allow_simd;
+    uint64_t start_unix_sec;   // When recording began (informational)
+    uint64_t end_step;         // Steps run at shutdown (0 = the server didn't stop cleanly)
+    uint64_t record_count;
+    uint64_t data_bytes;       // Record bytes following the header
+} RecordingHeader;
+
+typedef struct {
+    uint64_t time_ns;          // Arrival, relative to the start of recording
+    uint64_t step;             // Simulation steps completed when it arrived
+    uint32_t addr;             // Source IPv4 address (network order)
+    uint16_t port;             // Source port (network order)
+    uint16_t len;
+} RecordEntry;
+
 #pragma pack(pop)
 
+// A player's PlayerData fields as the server keeps them. The animation is
+// held as an interned ID (Player.anim_id) instead of the 32-byte name, and
+// the ID and active flag live in Player.
+typedef struct {
+    float pos_x, pos_y, pos_z;
+    float rot_y;
+    uint8_t state;
+    uint8_t combat_mode;
+    uint8_t character_class;
+    float health;
+} PlayerState;
+
 // Player info stored on server
 typedef struct {
     uint32_t player_id;
     char name[32];
     struct sockaddr_in addr;
-    time_t last_seen;
-    PlayerData data;
+    time_t last_seen;          // sim_seconds() of the last packet
+    PlayerState data;
+    uint16_t anim_id;          // Interned animation (see anim_table)
+    uint16_t anims_interned;   // Names this player added to anim_table
     int active;
+    uint32_t caps;             // CAP_* bits negotiated at join
+    uint32_t acked_snapshot;   // Newest snapshot acked (0 = none)
 } Player;
 
+// A message on a reliable channel, kept until acked
+typedef struct {
+    uint8_t in_flight;
+    uint8_t retries;
+    uint16_t len;              // Wrapped datagram length
+    uint64_t sent_ns;          // First transmission
+    uint64_t resend_ns;        // Next retransmission
+    uint8_t data[sizeof(ReliableHeader) + RELIABLE_MAX_PAYLOAD];
+} ReliableSlot;
+
+// Sending half of a client's reliable channel. Messages [oldest, next_seq)
+// occupy slots[seq % RELIABLE_WINDOW]; acked ones are freed at once and
+// oldest moves past them.
+typedef struct {
+    uint32_t epoch;            // From the client's JOIN
+    uint8_t stopped;           // A message ran out of retries; nothing more is sent
+    uint32_t next_seq;
+    uint32_t oldest;
+    uint64_t srtt_ns;          // Smoothed RTT (0 = no sample yet)
+    uint64_t rttvar_ns;
+    uint64_t rto_ns;
+    ReliableSlot slots[RELIABLE_WINDOW];
+} ReliableChannel;
+
+// Packets queued for one client this tick, coalesced into a PKT_BUNDLE
+typedef struct {
+    uint8_t *buf;              // Open bundle in bundle_arena (NULL = none)
+    struct sockaddr_in addr;   // Recipient when it was opened
+    uint32_t player_id;
+    uint16_t len;              // Bytes used in buf, PacketHeader included
+    uint16_t count;            // Packets in it
+} Bundle;
+
 // Spectator info (receives world state but doesn't play)
 typedef struct {
     struct sockaddr_in addr;
-    time_t last_seen;
+    time_t last_seen;          // sim_seconds() of the last packet
     int active;
 } Spectator;
 
 #define MAX_SPECTATORS 32
 
-// Server-side Bobba entity (AI runs on server)
+// Server-side Bobba entities (AI runs on server), stored as a structure of
+// arrays so the per-tick AI pass streams through contiguous fields. Slots
+// are handed out once and reused by respawns; live[] lists the active ones.
 typedef struct {
-    uint32_t entity_id;
-    float pos_x, pos_y, pos_z;
-    float rot_y;
-    uint8_t state;
-    float health;
-    int active;
+    int capacity;
+    int spawned;                  // Slots handed out so far
+    int live_count;
+
+    uint32_t *entity_id;
+    float *pos_x, *pos_y, *pos_z;
+    float *rot_y;
+    uint8_t *state;
+    float *health;
+    float *spawn_x, *spawn_y, *spawn_z;  // Respawn point
 
     // AI state
-    uint32_t target_player_id;  // 0 = no target
-    float roam_dir_x, roam_dir_z;
-    float roam_timer;
-    float attack_timer;
-    float attack_start_time;    // When attack started (for hit window calculation)
-    float stun_timer;
-    int has_hit_this_attack;    // True if already dealt damage this attack
-} ServerBobba;
+    uint32_t *target_player_id;   // 0 = no target
+    float *roam_dir_x, *roam_dir_z;
+    uint8_t *has_hit_this_attack; // True if already dealt damage this attack
+    float *roam_rot;              // Heading of roam_dir, cached when it is picked
+    uint32_t *rng;                // Per-Bobba xorshift state, so AI jobs never share rand()
+
+    // Level of detail (see AI_LOD_*)
+    uint8_t *lod_tier;
+    uint8_t *lod_wait;            // Simulation steps to skip before the next AI step
+    float *lod_elapsed;           // Time since the last AI step
+
+    // Per-tick scratch for the vectorized passes (see update_all_bobbas)
+    int32_t *thinking;            // Live slots not held by a stun or attack timer
+    int32_t *target_slot;         // players[] index of the target (-1 = none)
+    float *target_x, *target_y, *target_z;
+    float *target_dist;
+    uint8_t *move_kind;           // BOBBA_MOVE_*
+    float *move_dx, *move_dz;     // Unnormalized heading
+    float *ai_delta;              // Seconds this AI step covers
+    float *move_step;             // Meters to move this step (0 = stay put)
+    float *face_x, *face_z;       // Unit heading actually moved along (0 = didn't move)
+
+    int32_t *live;                // Dense list of active slots
+    int32_t *live_index;          // Slot -> position in live (-1 = dead)
+} BobbaStore;
 
 // Server-side Dragon entity (AI runs on server)
 typedef struct {
@@ -266,9 +620,8 @@ typedef struct {
     float patrol_center_x, patrol_center_z;
     int laps_completed;
 
-    // Landing/waiting state
-    float wait_timer;
-    float attack_timer;
+    // Landing/waiting and attack durations run on the timer wheel
+    // (see dragon_state_timer_expired)
 
     // Target player for attacks
     uint32_t target_player_id;
@@ -278,15 +631,20 @@ typedef struct {
 
 // Global server state
 static int server_socket = -1;
-static Player players[MAX_PLAYERS];
+static Player *players;              // max_players slots, allocated at startup
+static ReliableChannel *reliable_channels;  // One per players[] slot
+static Bundle *bundles;              // One per players[] slot
+static int32_t player_timers;        // Timeout timer of slot i is player_timers + i
+static int max_players = DEFAULT_MAX_PLAYERS;
 static Spectator spectators[MAX_SPECTATORS];
-static ServerBobba bobbas[MAX_BOBBAS];
+static BobbaStore bobbas;
 static ServerDragon dragons[MAX_DRAGONS];
 static volatile int running = 1;
 static uint32_t next_player_id = 1;
 static uint32_t next_entity_id = 1;
 static uint32_t state_sequence = 0;  // Increments each broadcast
 static int test_multiplayer = 0;     // --test-multiplayer flag: disables enemy AI
+static int sim_tick_rate = DEFAULT_TICK_RATE;  // --tick-rate: fixed simulation steps per second
 
 // Original spawn point
 static float spawn_x = 0.0f;
@@ -298,1303 +656,4965 @@ void send_player_damage(uint32_t target_player_id, float damage, uint32_t attack
                         float knockback_x, float knockback_y, float knockback_z);
 void broadcast_entity_state(void);
 void broadcast_world_state(void);
+uint64_t monotonic_ns(void);
+static inline time_t sim_seconds(void);
+static inline uint64_t sim_clock_steps(void);
 
 void signal_handler(int sig) {
-    printf("\nShutting down server...\n");
     running = 0;
 }
 
-// Spawn positions at foot of hills near the Tower of Hakutnas (-80, 0, -60)
-static const float spawn_points[][3] = {
-    { -60.0f, 2.0f, -80.0f },   // Near tower, foot of hills area
-    { -40.0f, 2.0f, -100.0f },  // Between tower and TheHills
-    { -80.0f, 2.0f, -40.0f },   // Other side of tower
-};
-static const int NUM_SPAWN_POINTS = 3;
+// =============================================================================
+// LOGGING
+// =============================================================================
 
-// Generate random spawn position at foot of hills near tower
-void generate_spawn_position(float *x, float *y, float *z) {
-    // Pick a random spawn point
-    int spawn_idx = rand() % NUM_SPAWN_POINTS;
+// The event loop never formats or writes log output itself. LOG() copies the
+// format string pointer and the raw argument values into a fixed-size
+// record on a single-producer ring; a writer thread formats records and
+// writes them to stdout in batches. If the ring is full the record is
+// dropped and counted rather than blocking.
+//
+// Only the event loop thread may log. Formats must be string literals and
+// support the printf conversions d i u x X c e f g p s with flags, width and
+// precision (no '*') and the h/l/ll/z length modifiers. %s arguments are
+// copied, so they may point at buffers that change right after the call.
+#define LOG(level, ...) \
+    do { if ((level) <= log_level) log_write((level), __VA_ARGS__); } while (0)
 
-    // Small random offset (within 8m radius)
-    float angle = ((float)rand() / RAND_MAX) * 2.0f * M_PI;
-    float distance = ((float)rand() / RAND_MAX) * 8.0f;
+typedef struct {
+    uint64_t time_ns;              // CLOCK_MONOTONIC when logged
+    const char *fmt;
+    uint8_t level;
+    uint8_t truncated;             // Arguments past arg_bytes didn't fit
+    uint16_t arg_bytes;
+    uint8_t args[LOG_RECORD_BYTES - 24];  // 8 bytes per number, length + bytes per string
+} LogRecord;
 
-    *x = spawn_points[spawn_idx][0] + cos(angle) * distance;
-    *y = spawn_points[spawn_idx][1];  // Keep at ground level
-    *z = spawn_points[spawn_idx][2] + sin(angle) * distance;
+_Static_assert(sizeof(LogRecord) == LOG_RECORD_BYTES, "LogRecord must fill its slot");
 
-    printf("Spawn position: point %d at (%.1f, %.1f, %.1f)\n", spawn_idx + 1, *x, *y, *z);
+typedef struct {
+    _Alignas(64) atomic_uint head;     // Next record the writer formats
+    _Alignas(64) atomic_uint tail;     // Next record the event loop fills
+    _Alignas(64) atomic_ulong dropped; // Records lost to a full ring
+    LogRecord records[LOG_RING_SIZE];
+} LogRing;
+
+static LogRing log_ring;
+static int log_level = LOG_INFO;
+static uint64_t log_start_ns;
+static pthread_t log_thread;
+static int log_thread_running = 0;
+static atomic_int log_shutdown;
+
+static const char *const log_level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+// Parse a --log-level name. Returns -1 if unknown.
+int log_level_from_name(const char *name) {
+    for (int level = LOG_ERROR; level <= LOG_DEBUG; level++) {
+        if (strcasecmp(name, log_level_names[level]) == 0) return level;
+    }
+    return -1;
 }
 
-// Find player by address
-Player* find_player_by_addr(struct sockaddr_in *addr) {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active &&
-            players[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
-            players[i].addr.sin_port == addr->sin_port) {
-            return &players[i];
+// Step over one conversion spec starting after its '%'. Returns a pointer to
+// the conversion character and sets *longs to 0 (int), 1 (long),
+// 2 (long long) or 3 (size_t).
+static const char *log_parse_spec(const char *p, int *longs) {
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') p++;
+    while ((*p >= '0' && *p <= '9') || *p == '.') p++;
+
+    *longs = 0;
+    if (*p == 'z') {
+        *longs = 3;
+        p++;
+    } else {
+        while (*p == 'h') p++;
+        while (*p == 'l') {
+            (*longs)++;
+            p++;
         }
     }
-    return NULL;
+    return p;
 }
 
-// Find player by ID
-Player* find_player_by_id(uint32_t id) {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active && players[i].player_id == id) {
-            return &players[i];
+static inline int log_is_integer_conversion(char c) {
+    return c == 'd' || c == 'i' || c == 'u' || c == 'x' || c == 'X' || c == 'c';
+}
+
+static inline int log_is_float_conversion(char c) {
+    return c == 'f' || c == 'F' || c == 'e' || c == 'E' || c == 'g' || c == 'G';
+}
+
+// Format one record into out (always NUL-terminated). Returns the length.
+static size_t log_format_record(const LogRecord *rec, char *out, size_t size) {
+    size_t len = (size_t)snprintf(out, size, "%10.3f %-5s ",
+                                  (rec->time_ns - log_start_ns) / 1e9, log_level_names[rec->level]);
+    size_t pos = 0;
+
+    for (const char *p = rec->fmt; *p && len < size - 1; p++) {
+        if (*p != '%') {
+            out[len++] = *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[len++] = '%';
+            p++;
+            continue;
+        }
+
+        int longs;
+        const char *conv = log_parse_spec(p + 1, &longs);
+        char spec[24];
+        size_t spec_len = (size_t)(conv - p) + 1;
+        if (spec_len >= sizeof(spec) || !*conv) break;
+        memcpy(spec, p, spec_len);
+        spec[spec_len] = '\0';
+        p = conv;
+
+        size_t need = (*conv == 's') ? 1 : 8;
+        if (pos + need > rec->arg_bytes) break;  // Truncated record
+
+        int n = 0;
+        if (*conv == 's') {
+            char text[256];
+            uint8_t text_len = rec->args[pos++];
+            if (pos + text_len > rec->arg_bytes) break;
+            memcpy(text, rec->args + pos, text_len);
+            text[text_len] = '\0';
+            pos += text_len;
+            n = snprintf(out + len, size - len, spec, text);
+        } else {
+            uint64_t bits;
+            memcpy(&bits, rec->args + pos, sizeof(bits));
+            pos += sizeof(bits);
+            if (log_is_float_conversion(*conv)) {
+                double value;
+                memcpy(&value, &bits, sizeof(value));
+                n = snprintf(out + len, size - len, spec, value);
+            } else if (*conv == 'p') {
+                n = snprintf(out + len, size - len, spec, (void*)(uintptr_t)bits);
+            } else if (longs == 3) {
+                n = snprintf(out + len, size - len, spec, (size_t)bits);
+            } else if (longs == 2) {
+                n = snprintf(out + len, size - len, spec, (long long)bits);
+            } else if (longs == 1) {
+                n = snprintf(out + len, size - len, spec, (long)bits);
+            } else {
+                n = snprintf(out + len, size - len, spec, (int)bits);
+            }
         }
+        if (n > 0) len += (size_t)n;
+        if (len > size - 1) len = size - 1;
     }
-    return NULL;
+
+    if (rec->truncated && len + 4 < size) {
+        memcpy(out + len, "...", 3);
+        len += 3;
+    }
+    if (len > 0 && out[len - 1] != '\n' && len < size - 1) {
+        out[len++] = '\n';
+    }
+    out[len] = '\0';
+    return len;
 }
 
-// Find free player slot
-int find_free_slot() {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (!players[i].active) {
-            return i;
-        }
+// Format and write every record in the ring. Returns how many there were.
+static int log_drain(void) {
+    static unsigned long reported_drops = 0;
+    char line[1024];
+    unsigned head = atomic_load_explicit(&log_ring.head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&log_ring.tail, memory_order_acquire);
+    int written = 0;
+
+    while (head != tail) {
+        size_t len = log_format_record(&log_ring.records[head & (LOG_RING_SIZE - 1)], line, sizeof(line));
+        fwrite(line, 1, len, stdout);
+        atomic_store_explicit(&log_ring.head, ++head, memory_order_release);
+        written++;
     }
-    return -1;
+
+    unsigned long dropped = atomic_load_explicit(&log_ring.dropped, memory_order_relaxed);
+    if (dropped != reported_drops) {
+        fprintf(stdout, "Log: %lu records dropped (ring full)\n", dropped - reported_drops);
+        reported_drops = dropped;
+        written++;
+    }
+
+    if (written > 0) {
+        fflush(stdout);
+    }
+    return written;
 }
 
-// Count active players
-int count_active_players() {
-    int count = 0;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active) count++;
+static void *log_writer_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        int stopping = atomic_load_explicit(&log_shutdown, memory_order_acquire);
+        if (log_drain() == 0) {
+            if (stopping) break;
+            usleep(LOG_WRITER_IDLE_US);
+        }
     }
-    return count;
+    return NULL;
 }
 
-// =============================================================================
-// BOBBA AI (Server-authoritative)
-// =============================================================================
+__attribute__((format(printf, 2, 3)))
+void log_write(int level, const char *fmt, ...) {
+    unsigned tail = atomic_load_explicit(&log_ring.tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&log_ring.head, memory_order_acquire);
+    if (tail - head >= LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&log_ring.dropped, 1, memory_order_relaxed);
+        return;
+    }
 
-// Initialize a Bobba at a position
-void spawn_bobba(float x, float y, float z) {
+    LogRecord *rec = &log_ring.records[tail & (LOG_RING_SIZE - 1)];
+    rec->time_ns = monotonic_ns();
+    rec->fmt = fmt;
+    rec->level = (uint8_t)level;
+    rec->truncated = 0;
+
+    // Copy arguments in the order the format consumes them
+    size_t pos = 0;
+    va_list ap;
+    va_start(ap, fmt);
+    for (const char *p = fmt; *p; p++) {
+        if (*p != '%') continue;
+        if (p[1] == '%') {
+            p++;
+            continue;
+        }
 
-    for (int i = 0; i < MAX_BOBBAS; i++) {
-        if (!bobbas[i].active) {
-            memset(&bobbas[i], 0, sizeof(ServerBobba));
-            bobbas[i].entity_id = next_entity_id++;
-            bobbas[i].pos_x = x;
-            bobbas[i].pos_y = y;
-            bobbas[i].pos_z = z;
-            bobbas[i].rot_y = 0;
-            bobbas[i].state = BOBBA_ROAMING;
-            bobbas[i].health = 100.0f;
-            bobbas[i].active = 1;
-            bobbas[i].target_player_id = 0;
-
-            // Random initial roam direction
-            float angle = ((float)rand() / RAND_MAX) * 2.0f * M_PI;
-            bobbas[i].roam_dir_x = cos(angle);
-            bobbas[i].roam_dir_z = sin(angle);
-            bobbas[i].roam_timer = BOBBA_ROAM_CHANGE_TIME;
-
-            printf("Spawned Bobba %u at (%.1f, %.1f, %.1f)\n",
-                   bobbas[i].entity_id, x, y, z);
-            fflush(stdout);
+        int longs;
+        p = log_parse_spec(p + 1, &longs);
+        uint64_t bits = 0;
+        if (*p == 's') {
+            const char *text = va_arg(ap, const char*);
+            if (!text) text = "(null)";
+            if (pos + 1 > sizeof(rec->args)) {
+                rec->truncated = 1;
+                break;
+            }
+            // Long strings are cut to the space left; later arguments are lost
+            size_t text_len = strnlen(text, 255);
+            if (pos + 1 + text_len > sizeof(rec->args)) {
+                text_len = sizeof(rec->args) - pos - 1;
+                rec->truncated = 1;
+            }
+            rec->args[pos++] = (uint8_t)text_len;
+            memcpy(rec->args + pos, text, text_len);
+            pos += text_len;
+            if (rec->truncated) break;
+            continue;
+        } else if (log_is_float_conversion(*p)) {
+            double value = va_arg(ap, double);
+            memcpy(&bits, &value, sizeof(bits));
+        } else if (*p == 'p') {
+            bits = (uintptr_t)va_arg(ap, void*);
+        } else if (log_is_integer_conversion(*p)) {
+            if (longs == 3) bits = va_arg(ap, size_t);
+            else if (longs == 2) bits = (uint64_t)va_arg(ap, long long);
+            else if (longs == 1) bits = (uint64_t)va_arg(ap, long);
+            else bits = (uint64_t)(int64_t)va_arg(ap, int);
+        } else {
+            break;  // Unsupported conversion: the writer stops here too
+        }
+
+        if (pos + sizeof(bits) > sizeof(rec->args)) {
+            rec->truncated = 1;
             break;
         }
+        memcpy(rec->args + pos, &bits, sizeof(bits));
+        pos += sizeof(bits);
     }
+    va_end(ap);
+    rec->arg_bytes = (uint16_t)pos;
 
+    atomic_store_explicit(&log_ring.tail, tail + 1, memory_order_release);
+
+    // Before the writer starts (and after it stops) write synchronously
+    if (!log_thread_running) {
+        log_drain();
+    }
 }
 
-// Calculate distance between two 3D points
-float distance_3d(float x1, float y1, float z1, float x2, float y2, float z2) {
-    float dx = x2 - x1;
-    float dy = y2 - y1;
-    float dz = z2 - z1;
-    return sqrt(dx*dx + dy*dy + dz*dz);
+// Set the level and time origin. Call before the first LOG, which is
+// written synchronously until init_logger starts the writer.
+void log_configure(int level) {
+    log_level = level;
+    log_start_ns = monotonic_ns();
 }
 
-// Find nearest player to a position
-Player* find_nearest_player(float x, float y, float z, float *out_distance) {
-    Player *nearest = NULL;
-    float min_dist = 999999.0f;
+int init_logger(void) {
+    atomic_store(&log_shutdown, 0);
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active) {
-            float dist = distance_3d(x, y, z,
-                                     players[i].data.pos_x,
-                                     players[i].data.pos_y,
-                                     players[i].data.pos_z);
-            if (dist < min_dist) {
-                min_dist = dist;
-                nearest = &players[i];
-            }
-        }
-    }
+    // Signals belong to the event loop thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int rc = pthread_create(&log_thread, NULL, log_writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) return -1;
 
-    if (out_distance) *out_distance = min_dist;
-    return nearest;
+    log_thread_running = 1;
+    return 0;
 }
 
-// Pick a new random roam direction
-void bobba_pick_roam_direction(ServerBobba *bobba) {
-    float angle = ((float)rand() / RAND_MAX) * 2.0f * M_PI;
-    bobba->roam_dir_x = cos(angle);
-    bobba->roam_dir_z = sin(angle);
-    bobba->roam_timer = BOBBA_ROAM_CHANGE_TIME;
+// Stop the writer once it has written everything logged so far
+void shutdown_logger(void) {
+    if (!log_thread_running) return;
+    atomic_store_explicit(&log_shutdown, 1, memory_order_release);
+    pthread_join(log_thread, NULL);
+    log_thread_running = 0;
 }
 
-// Update a single Bobba's AI
-void update_bobba_ai(ServerBobba *bobba, float delta) {
-    if (!bobba->active) return;
+// =============================================================================
+// METRICS
+// =============================================================================
 
-    // TEST_MULTIPLAYER mode: skip AI, just idle in place
-    if (test_multiplayer) {
-        bobba->state = BOBBA_IDLE;
-        return;
-    }
+// Cumulative counters and histograms for --metrics-file (Prometheus text
+// format). Everything here is written only by the event loop thread, so
+// updates are plain increments; the AI workers never touch the network.
+#define PHASE_RECV             0  // Draining and dispatching received datagrams
+#define PHASE_SIM_STEP         1  // One fixed simulation step (timers, grid, AI)
+#define PHASE_WORLD_BROADCAST  2
+#define PHASE_ENTITY_BROADCAST 3
+#define PHASE_SEND_FLUSH       4  // End-of-tick sendmmsg flush
+#define PHASE_AI_UPDATE        5  // The AI part of PHASE_SIM_STEP (update_all_entities)
+#define PHASE_COUNT            6
+
+static const char *const phase_names[PHASE_COUNT] = {
+    "recv", "sim_step", "world_broadcast", "entity_broadcast", "send_flush", "ai_update"
+};
 
-    // Handle stun timer
-    if (bobba->stun_timer > 0) {
-        bobba->stun_timer -= delta;
-        if (bobba->stun_timer <= 0) {
-            bobba->state = (bobba->target_player_id != 0) ? BOBBA_CHASING : BOBBA_ROAMING;
-        }
-        return;
+typedef struct {
+    uint64_t rx_packets[256];      // Indexed by PacketHeader.type
+    uint64_t rx_bytes[256];
+    uint64_t tx_packets[256];
+    uint64_t tx_bytes[256];
+    uint64_t rx_datagrams;
+    uint64_t tx_datagrams;
+    uint64_t rx_syscalls;
+    uint64_t tx_syscalls;
+    uint64_t tx_errors;            // Datagrams sendmmsg refused
+    uint32_t rx_socket_drops;      // Kernel receive queue overflows (SO_RXQ_OVFL)
+    uint64_t sim_steps;
+    uint64_t sim_overruns;
+    uint64_t sim_dropped_steps;
+    uint64_t reliable_sent;        // Messages queued on reliable channels
+    uint64_t reliable_retransmits;
+    uint64_t reliable_overflows;   // Messages sent unreliably because a client's window was full
+    uint64_t reliable_failures;    // Channels stopped after RELIABLE_MAX_RETRIES
+    uint64_t bundled_packets;      // Packets sent inside PKT_BUNDLE
+    size_t send_arena_peak;        // Most arena bytes staged in one tick
+    Histogram phase_ns[PHASE_COUNT];
+    Histogram recv_batch;          // Datagrams per recvmmsg call
+    Histogram send_batch;          // Datagrams queued per flush
+    uint64_t start_ns;             // When the server started counting (uptime)
+} Metrics;
+
+static Metrics metrics;
+
+// Recent figures for PKT_STATS. Simulation steps fill the current window;
+// when it is STATS_WINDOW_SEC old it is summarized and restarted.
+typedef struct {
+    uint32_t window_ms;
+    float ticks_per_sec;
+    uint32_t tick_avg_us;
+    uint32_t tick_p99_us;
+    uint32_t tick_max_us;
+    uint32_t tick_overruns;
+    float rx_packets_per_sec;
+    float tx_packets_per_sec;
+} StatsSummary;
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t rx_start;             // metrics.rx_datagrams when the window began
+    uint64_t tx_start;
+    uint32_t overruns;
+    Histogram step_ns;
+} StatsWindow;
+
+static StatsWindow stats_window;
+static StatsSummary stats_summary;     // Last complete window (window_ms 0 = none yet)
+static const char *metrics_path = NULL;  // --metrics-file
+
+static const char *const packet_type_names[256] = {
+    [PKT_JOIN] = "join",
+    [PKT_JOIN_ACK] = "join_ack",
+    [PKT_LEAVE] = "leave",
+    [PKT_WORLD_STATE] = "world_state",
+    [PKT_UPDATE] = "update",
+    [PKT_ACK] = "ack",
+    [PKT_PING] = "ping",
+    [PKT_PONG] = "pong",
+    [PKT_ENTITY_STATE] = "entity_state",
+    [PKT_ENTITY_DAMAGE] = "entity_damage",
+    [PKT_ARROW_SPAWN] = "arrow_spawn",
+    [PKT_ARROW_HIT] = "arrow_hit",
+    [PKT_HOST_CHANGE] = "host_change",
+    [PKT_HEARTBEAT] = "heartbeat",
+    [PKT_SPECTATE] = "spectate",
+    [PKT_SPECTATE_ACK] = "spectate_ack",
+    [PKT_PLAYER_DAMAGE] = "player_damage",
+    [PKT_GAME_RESTART] = "game_restart",
+    [PKT_WORLD_DELTA] = "world_delta",
+    [PKT_ENTITY_STATE_Q] = "entity_state_q",
+    [PKT_ANIM_DICT] = "anim_dict",
+    [PKT_UPDATE_COMPACT] = "update_compact",
+    [PKT_STATS] = "stats",
+    [PKT_RELIABLE] = "reliable",
+    [PKT_BUNDLE] = "bundle",
+};
+
+void init_metrics(void) {
+    memset(&metrics, 0, sizeof(metrics));
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        hist_reset(&metrics.phase_ns[p]);
     }
+    hist_reset(&metrics.recv_batch);
+    hist_reset(&metrics.send_batch);
+    metrics.start_ns = monotonic_ns();
+
+    memset(&stats_window, 0, sizeof(stats_window));
+    memset(&stats_summary, 0, sizeof(stats_summary));
+    stats_window.start_ns = metrics.start_ns;
+    hist_reset(&stats_window.step_ns);
+}
 
-    // Handle attack timer
-    if (bobba->state == BOBBA_ATTACKING) {
-        bobba->attack_timer -= delta;
+void stats_summarize(const StatsWindow *w, uint64_t now_ns, StatsSummary *out) {
+    double seconds = (now_ns - w->start_ns) / 1e9;
+    if (seconds <= 0) seconds = 1e-9;
+
+    out->window_ms = (uint32_t)(seconds * 1000);
+    out->ticks_per_sec = (float)(w->step_ns.count / seconds);
+    out->tick_avg_us = (uint32_t)(hist_mean(&w->step_ns) / 1000);
+    out->tick_p99_us = (uint32_t)(hist_percentile(&w->step_ns, 0.99) / 1000);
+    out->tick_max_us = (uint32_t)(w->step_ns.count ? w->step_ns.max / 1000 : 0);
+    out->tick_overruns = w->overruns;
+    out->rx_packets_per_sec = (float)((metrics.rx_datagrams - w->rx_start) / seconds);
+    out->tx_packets_per_sec = (float)((metrics.tx_datagrams - w->tx_start) / seconds);
+}
 
-        // Calculate attack progress (0.0 to 1.0)
-        float attack_progress = 1.0f - (bobba->attack_timer / bobba->attack_start_time);
+// Account one simulation step in the stats window, rolling it over when due
+void stats_window_record_step(uint64_t work_ns, int overrun) {
+    StatsWindow *w = &stats_window;
+    hist_record(&w->step_ns, work_ns);
+    w->overruns += overrun;
+
+    uint64_t now_ns = monotonic_ns();
+    if (now_ns - w->start_ns >= STATS_WINDOW_SEC * 1000000000ULL) {
+        stats_summarize(w, now_ns, &stats_summary);
+        w->start_ns = now_ns;
+        w->rx_start = metrics.rx_datagrams;
+        w->tx_start = metrics.tx_datagrams;
+        w->overruns = 0;
+        hist_reset(&w->step_ns);
+    }
+}
 
-        // Check if we're in the hit window and haven't hit yet
-        if (!bobba->has_hit_this_attack &&
-            attack_progress >= BOBBA_HIT_WINDOW_START &&
-            attack_progress <= BOBBA_HIT_WINDOW_END &&
-            bobba->target_player_id != 0) {
+// Record how long a phase took since start_ns. Returns the current time so
+// consecutive phases can be chained.
+static inline uint64_t metrics_phase_end(int phase, uint64_t start_ns) {
+    uint64_t now_ns = monotonic_ns();
+    hist_record(&metrics.phase_ns[phase], now_ns - start_ns);
+    return now_ns;
+}
 
-            // Check if target is still in range
-            Player *target = find_player_by_id(bobba->target_player_id);
-            if (target && target->active) {
-                float dist = distance_3d(bobba->pos_x, bobba->pos_y, bobba->pos_z,
-                                         target->data.pos_x, target->data.pos_y, target->data.pos_z);
+// =============================================================================
+// BATCHED SEND
+// =============================================================================
 
-                if (dist <= BOBBA_ATTACK_DISTANCE * 2.0f) {  // Slightly larger hit range
-                    // Calculate knockback direction (from Bobba to player)
-                    float dx = target->data.pos_x - bobba->pos_x;
-                    float dy = 0.3f;  // Slight upward component
-                    float dz = target->data.pos_z - bobba->pos_z;
-                    float len = sqrt(dx*dx + dz*dz);
-                    if (len > 0.01f) {
-                        dx /= len;
-                        dz /= len;
-                    }
+// Outgoing datagrams are queued during a tick and flushed with sendmmsg.
+// A payload is staged once into the arena and then referenced by every
+// recipient's iovec, so a broadcast costs one copy regardless of fan-out.
+static char send_arena[SEND_ARENA_SIZE];
+static size_t send_arena_used = 0;
+static struct sockaddr_in send_addrs[SEND_QUEUE_SIZE];
+static struct iovec send_iovecs[SEND_QUEUE_SIZE];
+static struct mmsghdr send_msgs[SEND_QUEUE_SIZE];
+static int send_queue_len = 0;
+static uint32_t send_arena_generation = 0;  // Bumped whenever the arena is recycled
+
+// Send everything queued so far. Staged payloads stay valid.
+void sendq_flush(void) {
+    int sent = 0;
+
+    if (send_queue_len > 0) {
+        hist_record(&metrics.send_batch, send_queue_len);
+    }
 
-                    // Mark as hit and send damage
-                    bobba->has_hit_this_attack = 1;
-                    send_player_damage(bobba->target_player_id, BOBBA_ATTACK_DAMAGE,
-                                       bobba->entity_id,
-                                       dx * BOBBA_KNOCKBACK_FORCE,
-                                       dy * BOBBA_KNOCKBACK_FORCE,
-                                       dz * BOBBA_KNOCKBACK_FORCE);
-                }
-            }
+    while (sent < send_queue_len) {
+        // A replay has no socket: everything queued counts as sent
+        int n = send_queue_len - sent;
+        if (server_socket >= 0) {
+            n = sendmmsg(server_socket, &send_msgs[sent], send_queue_len - sent, 0);
+            metrics.tx_syscalls++;
         }
-
-        if (bobba->attack_timer <= 0) {
-            bobba->state = BOBBA_CHASING;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Socket buffer full or bad address: drop this datagram and
+            // carry on with the rest, as individual sendto calls would
+            metrics.tx_errors++;
+            sent++;
+            continue;
         }
-        return;
+        // Every packet starts with its PacketHeader type byte
+        for (int i = sent; i < sent + n; i++) {
+            uint8_t type = *(const uint8_t*)send_iovecs[i].iov_base;
+            metrics.tx_packets[type]++;
+            metrics.tx_bytes[type] += send_iovecs[i].iov_len;
+        }
+        metrics.tx_datagrams += n;
+        sent += n;
     }
 
-    // Find target
-    float dist_to_target = 999999.0f;
-    Player *target = NULL;
+    send_queue_len = 0;
+}
 
-    if (bobba->target_player_id != 0) {
-        target = find_player_by_id(bobba->target_player_id);
-        if (target && target->active) {
-            dist_to_target = distance_3d(bobba->pos_x, bobba->pos_y, bobba->pos_z,
-                                         target->data.pos_x, target->data.pos_y, target->data.pos_z);
-            // Lose target if too far
-            if (dist_to_target > BOBBA_LOSE_RADIUS) {
-                bobba->target_player_id = 0;
-                target = NULL;
-                bobba->state = BOBBA_ROAMING;
-                bobba_pick_roam_direction(bobba);
-            }
-        } else {
-            bobba->target_player_id = 0;
-            target = NULL;
-        }
+// Copy a payload into the arena. The returned pointer may be pushed to any
+// number of recipients and is valid until the next sendq_stage call.
+const void* sendq_stage(const void *data, size_t len) {
+    if (len > SEND_ARENA_SIZE) {
+        return NULL;
+    }
+    if (send_arena_used + len > SEND_ARENA_SIZE) {
+        // Out of room: push queued datagrams out before reusing the arena
+        sendq_flush();
+        send_arena_used = 0;
+        send_arena_generation++;
     }
 
-    // Look for new target if none
-    if (bobba->target_player_id == 0) {
-        Player *nearest = find_nearest_player(bobba->pos_x, bobba->pos_y, bobba->pos_z, &dist_to_target);
-        if (nearest && dist_to_target <= BOBBA_DETECTION_RADIUS) {
-            bobba->target_player_id = nearest->player_id;
-            target = nearest;
-            bobba->state = BOBBA_CHASING;
-        }
+    void *dst = send_arena + send_arena_used;
+    memcpy(dst, data, len);
+    send_arena_used += len;
+    return dst;
+}
+
+// Queue a staged payload for one recipient
+void sendq_push(const void *staged, size_t len, const struct sockaddr_in *addr) {
+    if (!staged) return;
+
+    if (send_queue_len >= SEND_QUEUE_SIZE) {
+        sendq_flush();
     }
 
-    // State machine
-    switch (bobba->state) {
-        case BOBBA_ROAMING: {
-            // Move in roam direction
-            bobba->pos_x += bobba->roam_dir_x * BOBBA_ROAM_SPEED * delta;
-            bobba->pos_z += bobba->roam_dir_z * BOBBA_ROAM_SPEED * delta;
+    int i = send_queue_len++;
+    send_addrs[i] = *addr;
+    send_iovecs[i].iov_base = (void*)staged;
+    send_iovecs[i].iov_len = len;
+    memset(&send_msgs[i], 0, sizeof(send_msgs[i]));
+    send_msgs[i].msg_hdr.msg_name = &send_addrs[i];
+    send_msgs[i].msg_hdr.msg_namelen = sizeof(send_addrs[i]);
+    send_msgs[i].msg_hdr.msg_iov = &send_iovecs[i];
+    send_msgs[i].msg_hdr.msg_iovlen = 1;
+}
 
-            // Face roam direction
-            bobba->rot_y = atan2(bobba->roam_dir_x, bobba->roam_dir_z);
+// Queue a single unicast datagram
+void sendq_send(const void *data, size_t len, const struct sockaddr_in *addr) {
+    sendq_push(sendq_stage(data, len), len, addr);
+}
 
-            // Change direction periodically
-            bobba->roam_timer -= delta;
-            if (bobba->roam_timer <= 0) {
-                bobba_pick_roam_direction(bobba);
-            }
-            break;
+// A tick sends each client a world state, entity state and whatever events
+// happened (arrows, damage, pongs, reliable messages), each in its own
+// datagram. For CAP_BUNDLE clients they are instead copied into a
+// per-client PKT_BUNDLE: a PacketHeader followed by the packets, each
+// prefixed with its uint16_t length. A bundle is queued when the next
+// packet would overflow BUNDLE_MAX_BYTES, or at the end of the tick.
+// Bundles live in their own arena, so filling one never recycles the
+// payloads callers have staged for the rest of a broadcast.
+// Only sends that go through the *_player variants are bundled; replies
+// addressed by source address (pongs, stats) go out on their own.
+static uint8_t bundle_arena[BUNDLE_ARENA_SIZE];
+static size_t bundle_arena_used = 0;
+static int bundle_open_count = 0;
+static uint32_t bundle_sequence = 0;
+
+#define BUNDLE_PREFIX_BYTES sizeof(uint16_t)
+
+// Bigger packets (e.g. a world state chunk) are already a full datagram
+#define BUNDLE_FITS(len) (sizeof(PacketHeader) + BUNDLE_PREFIX_BYTES + (len) <= BUNDLE_MAX_BYTES)
+
+// Queue an open bundle. A bundle holding one packet is sent unwrapped.
+static void bundle_close(Bundle *b) {
+    if (b->count == 1) {
+        size_t skip = sizeof(PacketHeader) + BUNDLE_PREFIX_BYTES;
+        sendq_push(b->buf + skip, b->len - skip, &b->addr);
+    } else {
+        PacketHeader header;
+        header.type = PKT_BUNDLE;
+        header.sequence = ++bundle_sequence;
+        header.player_id = b->player_id;
+        memcpy(b->buf, &header, sizeof(header));
+        sendq_push(b->buf, b->len, &b->addr);
+        metrics.bundled_packets += b->count;
+    }
+    b->buf = NULL;
+    bundle_open_count--;
+}
+
+// Queue every open bundle
+void bundle_close_all(void) {
+    for (int i = 0; i < max_players && bundle_open_count > 0; i++) {
+        if (bundles[i].buf) {
+            bundle_close(&bundles[i]);
         }
+    }
+}
 
-        case BOBBA_CHASING: {
-            if (!target) {
-                bobba->state = BOBBA_ROAMING;
-                break;
-            }
+// Copy a packet into the player's open bundle, opening one if needed.
+// The packet must satisfy BUNDLE_FITS.
+static void bundle_append(Player *player, const void *data, size_t len) {
+    Bundle *b = &bundles[player - players];
 
-            // Attack if close enough
-            if (dist_to_target <= BOBBA_ATTACK_DISTANCE) {
-                bobba->state = BOBBA_ATTACKING;
-                bobba->attack_timer = BOBBA_ATTACK_DURATION;
-                bobba->attack_start_time = BOBBA_ATTACK_DURATION;  // Record for progress calc
-                bobba->has_hit_this_attack = 0;  // Reset hit flag for new attack
-                break;
-            }
+    // The slot may have changed hands since the bundle was opened
+    if (b->buf && (b->len + BUNDLE_PREFIX_BYTES + len > BUNDLE_MAX_BYTES ||
+                   b->addr.sin_addr.s_addr != player->addr.sin_addr.s_addr ||
+                   b->addr.sin_port != player->addr.sin_port)) {
+        bundle_close(b);
+    }
 
-            // Move toward target
-            float dx = target->data.pos_x - bobba->pos_x;
-            float dz = target->data.pos_z - bobba->pos_z;
-            float len = sqrt(dx*dx + dz*dz);
-            if (len > 0.1f) {
-                dx /= len;
-                dz /= len;
-                bobba->pos_x += dx * BOBBA_CHASE_SPEED * delta;
-                bobba->pos_z += dz * BOBBA_CHASE_SPEED * delta;
-                bobba->rot_y = atan2(dx, dz);
-            }
-            break;
+    if (!b->buf) {
+        if (bundle_arena_used + BUNDLE_MAX_BYTES > BUNDLE_ARENA_SIZE) {
+            // Out of room: send every bundle before reusing the arena
+            bundle_close_all();
+            sendq_flush();
+            bundle_arena_used = 0;
         }
+        b->buf = bundle_arena + bundle_arena_used;
+        bundle_arena_used += BUNDLE_MAX_BYTES;
+        b->addr = player->addr;
+        b->player_id = player->player_id;
+        b->len = sizeof(PacketHeader);
+        b->count = 0;
+        bundle_open_count++;
+    }
 
-        case BOBBA_ATTACKING:
-            // Handled above
-            break;
-
-        case BOBBA_IDLE:
-            // Do nothing, wait for player
-            break;
+    uint16_t prefix = (uint16_t)len;
+    memcpy(b->buf + b->len, &prefix, sizeof(prefix));
+    memcpy(b->buf + b->len + BUNDLE_PREFIX_BYTES, data, len);
+    b->len += BUNDLE_PREFIX_BYTES + len;
+    b->count++;
+}
 
-        case BOBBA_STUNNED:
-            // Handled above
-            break;
+// Queue the player's open bundle ahead of a packet that can't join it, so
+// the client still gets its packets in the order they were sent
+static void bundle_close_player(Player *player) {
+    Bundle *b = &bundles[player - players];
+    if (b->buf) {
+        bundle_close(b);
     }
 }
 
-// Update all Bobbas
-void update_all_bobbas(float delta) {
+// Queue a staged payload for a player, in their bundle if they have one
+void sendq_push_player(Player *player, const void *staged, size_t len) {
+    if (!staged) return;
 
-    for (int i = 0; i < MAX_BOBBAS; i++) {
-        if (bobbas[i].active) {
-            update_bobba_ai(&bobbas[i], delta);
-        }
+    if ((player->caps & CAP_BUNDLE) && BUNDLE_FITS(len)) {
+        bundle_append(player, staged, len);
+    } else {
+        bundle_close_player(player);
+        sendq_push(staged, len, &player->addr);
     }
+}
 
+// Queue a single datagram for a player. A bundled packet is copied straight
+// into the bundle, so it skips the send arena.
+void sendq_send_player(Player *player, const void *data, size_t len) {
+    if ((player->caps & CAP_BUNDLE) && BUNDLE_FITS(len)) {
+        bundle_append(player, data, len);
+    } else {
+        bundle_close_player(player);
+        sendq_send(data, len, &player->addr);
+    }
 }
 
-// Respawn all Bobbas (reset health, position, state)
-void respawn_all_bobbas() {
+// A payload staged once and pushed to many recipients. It must be
+// restaged if the arena was recycled since (see sendq_stage).
+typedef struct {
+    const void *staged;
+    size_t len;
+    uint32_t generation;
+} StagedPayload;
 
-    for (int i = 0; i < MAX_BOBBAS; i++) {
-        // Only respawn Bobbas that were actually spawned (have valid entity_id)
-        if (bobbas[i].entity_id == 0) {
-            continue;  // Skip slots that were never used
-        }
+static inline int staged_valid(const StagedPayload *p) {
+    return p->staged && p->generation == send_arena_generation;
+}
+
+static inline void staged_set(StagedPayload *p, const void *data, size_t len) {
+    p->staged = sendq_stage(data, len);
+    p->len = len;
+    p->generation = send_arena_generation;  // Read after staging: the copy lives in the current arena
+}
 
-        // Respawn at original position
-        bobbas[i].pos_x = 5.0f;
-        bobbas[i].pos_y = 0.0f;
-        bobbas[i].pos_z = 5.0f;
-        bobbas[i].rot_y = 0;
-        bobbas[i].state = BOBBA_ROAMING;
-        bobbas[i].health = 100.0f;
-        bobbas[i].active = 1;
-        bobbas[i].target_player_id = 0;
-        bobbas[i].has_hit_this_attack = 0;
-        bobbas[i].stun_timer = 0;
-        bobbas[i].attack_timer = 0;
+// Several datagrams staged back to back as one block, so they stay valid
+// (or go stale) together
+typedef struct {
+    StagedPayload payload;
+    int chunk_count;
+    uint16_t *chunk_lens;
+} StagedChunks;
+
+// Queue every chunk of a staged block for one recipient
+void sendq_push_chunks(const StagedChunks *chunks, const struct sockaddr_in *addr) {
+    const uint8_t *chunk = chunks->payload.staged;
+    if (!chunk) return;
+
+    for (int c = 0; c < chunks->chunk_count; c++) {
+        sendq_push(chunk, chunks->chunk_lens[c], addr);
+        chunk += chunks->chunk_lens[c];
+    }
+}
 
-        // Random roam direction
-        float angle = ((float)rand() / RAND_MAX) * 2.0f * M_PI;
-        bobbas[i].roam_dir_x = cos(angle);
-        bobbas[i].roam_dir_z = sin(angle);
-        bobbas[i].roam_timer = BOBBA_ROAM_CHANGE_TIME;
+// Queue every chunk of a staged block for a player
+void sendq_push_chunks_player(const StagedChunks *chunks, Player *player) {
+    const uint8_t *chunk = chunks->payload.staged;
+    if (!chunk) return;
 
-        printf("Respawned Bobba %u at (%.1f, %.1f, %.1f)\n",
-               bobbas[i].entity_id, bobbas[i].pos_x, bobbas[i].pos_y, bobbas[i].pos_z);
+    for (int c = 0; c < chunks->chunk_count; c++) {
+        sendq_push_player(player, chunk, chunks->chunk_lens[c]);
+        chunk += chunks->chunk_lens[c];
     }
+}
 
+// End of tick: flush the queue and recycle the arenas
+void sendq_end_tick(void) {
+    bundle_close_all();
+    sendq_flush();
+    bundle_arena_used = 0;
+    if (send_arena_used > metrics.send_arena_peak) {
+        metrics.send_arena_peak = send_arena_used;
+    }
+    send_arena_used = 0;
+    send_arena_generation++;
 }
 
-// Reset all players' health and respawn positions
-void respawn_all_players() {
+// Syscall counters as of the last print_net_stats
+static struct {
+    uint64_t rx_datagrams;
+    uint64_t rx_syscalls;
+    uint64_t tx_datagrams;
+    uint64_t tx_syscalls;
+    uint64_t tx_errors;
+} net_stats_printed;
+
+// Print the syscall counters' growth since the last call
+void print_net_stats(void) {
+    uint64_t rx = metrics.rx_datagrams - net_stats_printed.rx_datagrams;
+    uint64_t tx = metrics.tx_datagrams - net_stats_printed.tx_datagrams;
+    if (rx == 0 && tx == 0) {
+        return;
+    }
+    LOG(LOG_INFO, "Net: rx %llu datagrams in %llu syscalls, tx %llu datagrams in %llu syscalls (%llu dropped)\n",
+                  (unsigned long long)rx,
+                  (unsigned long long)(metrics.rx_syscalls - net_stats_printed.rx_syscalls),
+                  (unsigned long long)tx,
+                  (unsigned long long)(metrics.tx_syscalls - net_stats_printed.tx_syscalls),
+                  (unsigned long long)(metrics.tx_errors - net_stats_printed.tx_errors));
+    net_stats_printed.rx_datagrams = metrics.rx_datagrams;
+    net_stats_printed.rx_syscalls = metrics.rx_syscalls;
+    net_stats_printed.tx_datagrams = metrics.tx_datagrams;
+    net_stats_printed.tx_syscalls = metrics.tx_syscalls;
+    net_stats_printed.tx_errors = metrics.tx_errors;
+}
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active) {
-            // Reset health
-            players[i].data.health = 100.0f;
-            players[i].data.state = STATE_IDLE;
+// Spawn positions at foot of hills near the Tower of Hakutnas (-80, 0, -60)
+static const float spawn_points[][3] = {
+    { -60.0f, 2.0f, -80.0f },   // Near tower, foot of hills area
+    { -40.0f, 2.0f, -100.0f },  // Between tower and TheHills
+    { -80.0f, 2.0f, -40.0f },   // Other side of tower
+};
+static const int NUM_SPAWN_POINTS = 3;
 
-            // Generate new spawn position
-            generate_spawn_position(&players[i].data.pos_x,
-                                    &players[i].data.pos_y,
-                                    &players[i].data.pos_z);
+// Generate random spawn position at foot of hills near tower
+void generate_spawn_position(float *x, float *y, float *z) {
+    // Pick a random spawn point
+    int spawn_idx = rand() % NUM_SPAWN_POINTS;
 
-            printf("Respawned player %u at (%.1f, %.1f, %.1f)\n",
-                   players[i].player_id,
-                   players[i].data.pos_x, players[i].data.pos_y, players[i].data.pos_z);
-        }
-    }
+    // Small random offset (within 8m radius)
+    float angle = ((float)rand() / RAND_MAX) * 2.0f * M_PI;
+    float distance = ((float)rand() / RAND_MAX) * 8.0f;
+
+    *x = spawn_points[spawn_idx][0] + cos(angle) * distance;
+    *y = spawn_points[spawn_idx][1];  // Keep at ground level
+    *z = spawn_points[spawn_idx][2] + sin(angle) * distance;
 
+    LOG(LOG_INFO, "Spawn position: point %d at (%.1f, %.1f, %.1f)\n", spawn_idx + 1, *x, *y, *z);
 }
 
-// Handle game restart request - broadcast to all players and respawn entities
-void handle_game_restart(uint32_t reason, uint32_t requester_id) {
-    printf("=== GAME RESTART ===\n");
-    printf("Requested by player %u (reason: %u)\n", requester_id, reason);
-    fflush(stdout);
+// =============================================================================
+// RELIABLE CHANNEL
+// =============================================================================
 
-    // Respawn all entities
-    respawn_all_bobbas();
-    respawn_all_players();
+// Join acks, damage and restarts must not be lost: a dropped one desyncs
+// the client until the next restart. For CAP_RELIABLE clients they travel
+// in PKT_RELIABLE on a per-client channel with cumulative + selective acks
+// (ReliableAck, piggybacked on the client's regular traffic). Only unacked
+// messages are retransmitted, after an RFC 6298 timeout derived from the
+// measured RTT. Everything else stays unreliable.
+
+static uint64_t reliable_next_resend = UINT64_MAX;  // Earliest resend_ns over all channels
+
+// Start the player's channel over as the client's channel epoch
+void reliable_reset(Player *player, uint32_t epoch) {
+    ReliableChannel *ch = &reliable_channels[player - players];
+    memset(ch, 0, sizeof(*ch));
+    ch->epoch = epoch;
+    ch->rto_ns = RELIABLE_INITIAL_RTO_MS * NS_PER_MS;
+}
 
-    // Build restart packet to broadcast
-    GameRestartPacket packet;
-    memset(&packet, 0, sizeof(packet));
-    packet.header.type = PKT_GAME_RESTART;
-    packet.header.sequence = ++state_sequence;
-    packet.header.player_id = 0;  // From server
-    packet.reason = reason;
+// Queue a complete packet on the player's channel and send it now.
+// Returns -1 if it is too big, the window is full (the client has stopped
+// acking) or the channel was stopped; the caller then sends it unreliably.
+int reliable_send(Player *player, const void *msg, size_t len) {
+    ReliableChannel *ch = &reliable_channels[player - players];
+    if (len > RELIABLE_MAX_PAYLOAD || ch->stopped) {
+        return -1;
+    }
+    if (ch->next_seq - ch->oldest >= RELIABLE_WINDOW) {
+        metrics.reliable_overflows++;
+        LOG(LOG_WARN, "Reliable window full for player %u, sending message type %u unreliably",
+            player->player_id, *(const uint8_t*)msg);
+        return -1;
+    }
 
-    // Broadcast to all players
-    int player_count = 0;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active) {
-            sendto(server_socket, &packet, sizeof(packet), 0,
-                   (struct sockaddr*)&players[i].addr, sizeof(players[i].addr));
-            player_count++;
-        }
+    uint32_t seq = ch->next_seq++;
+    ReliableSlot *slot = &ch->slots[seq % RELIABLE_WINDOW];
+    ReliableHeader header;
+    header.header.type = PKT_RELIABLE;
+    header.header.sequence = seq;
+    header.header.player_id = player->player_id;
+    header.epoch = ch->epoch;
+    memcpy(slot->data, &header, sizeof(header));
+    memcpy(slot->data + sizeof(header), msg, len);
+    slot->len = (uint16_t)(sizeof(header) + len);
+    slot->in_flight = 1;
+    slot->retries = 0;
+    slot->sent_ns = monotonic_ns();
+    slot->resend_ns = slot->sent_ns + ch->rto_ns;
+    if (slot->resend_ns < reliable_next_resend) {
+        reliable_next_resend = slot->resend_ns;
     }
 
-    printf("Game restart broadcast sent to %d players\n", player_count);
+    sendq_send_player(player, slot->data, slot->len);
+    metrics.reliable_sent++;
+    return 0;
+}
 
-    // Immediately broadcast updated entity state so clients see respawned entities
-    broadcast_entity_state();
-    broadcast_world_state();
+// Fold an RTT sample into the channel's timeout (RFC 6298)
+void reliable_rtt_sample(ReliableChannel *ch, uint64_t rtt_ns) {
+    if (ch->srtt_ns == 0) {
+        ch->srtt_ns = rtt_ns;
+        ch->rttvar_ns = rtt_ns / 2;
+    } else {
+        uint64_t diff = ch->srtt_ns > rtt_ns ? ch->srtt_ns - rtt_ns : rtt_ns - ch->srtt_ns;
+        ch->rttvar_ns = (3 * ch->rttvar_ns + diff) / 4;
+        ch->srtt_ns = (7 * ch->srtt_ns + rtt_ns) / 8;
+    }
 
-    printf("=== RESTART COMPLETE ===\n");
-    fflush(stdout);
+    uint64_t rto = ch->srtt_ns + 4 * ch->rttvar_ns;
+    if (rto < RELIABLE_MIN_RTO_MS * NS_PER_MS) rto = RELIABLE_MIN_RTO_MS * NS_PER_MS;
+    if (rto > RELIABLE_MAX_RTO_MS * NS_PER_MS) rto = RELIABLE_MAX_RTO_MS * NS_PER_MS;
+    ch->rto_ns = rto;
 }
 
-// Broadcast entity state to all players
-void broadcast_entity_state() {
-
-    int entity_count = 0;
-    for (int i = 0; i < MAX_BOBBAS; i++) {
-        if (bobbas[i].active) entity_count++;
-    }
-    for (int i = 0; i < MAX_DRAGONS; i++) {
-        if (dragons[i].active) entity_count++;
-    }
+void reliable_handle_ack(Player *player, const ReliableAck *ack) {
+    ReliableChannel *ch = &reliable_channels[player - players];
 
-    if (entity_count == 0) {
-            return;
+    // Acks for an earlier channel, or for messages never sent, are ignored
+    if (ack->epoch != ch->epoch || (int32_t)(ack->next_seq - ch->next_seq) > 0) {
+        return;
     }
 
-    // Build entity state packet
-    EntityStatePacket packet;
-    memset(&packet, 0, sizeof(packet));
-    packet.header.type = PKT_ENTITY_STATE;
-    packet.header.sequence = ++state_sequence;
-    packet.header.player_id = 0;  // From server
+    uint64_t now = monotonic_ns();
+    for (uint32_t seq = ch->oldest; seq != ch->next_seq; seq++) {
+        ReliableSlot *slot = &ch->slots[seq % RELIABLE_WINDOW];
+        if (!slot->in_flight) continue;
 
-    int idx = 0;
+        int32_t ahead = (int32_t)(seq - ack->next_seq);
+        int acked = ahead < 0 ||
+                    (ahead >= 1 && ahead <= 32 && ((ack->received_bits >> (ahead - 1)) & 1));
+        if (!acked) continue;
 
-    // Add Bobbas
-    for (int i = 0; i < MAX_BOBBAS && idx < MAX_ENTITIES; i++) {
-        if (bobbas[i].active) {
-            packet.entities[idx].entity_type = ENTITY_BOBBA;
-            packet.entities[idx].entity_id = bobbas[i].entity_id;
-            packet.entities[idx].pos_x = bobbas[i].pos_x;
-            packet.entities[idx].pos_y = bobbas[i].pos_y;
-            packet.entities[idx].pos_z = bobbas[i].pos_z;
-            packet.entities[idx].rot_y = bobbas[i].rot_y;
-            packet.entities[idx].state = bobbas[i].state;
-            packet.entities[idx].health = bobbas[i].health;
-            idx++;
+        // Karn: a retransmitted message's ack can't tell which copy arrived
+        if (slot->retries == 0) {
+            reliable_rtt_sample(ch, now - slot->sent_ns);
         }
+        slot->in_flight = 0;
     }
 
-    // Add Dragons
-    for (int i = 0; i < MAX_DRAGONS && idx < MAX_ENTITIES; i++) {
-        if (dragons[i].active) {
-            packet.entities[idx].entity_type = ENTITY_DRAGON;
-            packet.entities[idx].entity_id = dragons[i].entity_id;
-            packet.entities[idx].pos_x = dragons[i].pos_x;
-            packet.entities[idx].pos_y = dragons[i].pos_y;
-            packet.entities[idx].pos_z = dragons[i].pos_z;
-            packet.entities[idx].rot_y = dragons[i].rot_y;
-            packet.entities[idx].state = dragons[i].state;
-            packet.entities[idx].health = dragons[i].health;
-            // Extra data for dragon: lap_count and patrol_angle
-            packet.entities[idx].extra1 = dragons[i].laps_completed;
-            packet.entities[idx].extra2 = dragons[i].patrol_angle;
-            idx++;
-        }
+    while (ch->oldest != ch->next_seq && !ch->slots[ch->oldest % RELIABLE_WINDOW].in_flight) {
+        ch->oldest++;
     }
+}
 
-    packet.entity_count = idx;
+// Give up on a channel whose client doesn't ack: free its messages. Until
+// the client joins again, its messages go out as plain datagrams.
+void reliable_stop(Player *player, ReliableChannel *ch) {
+    for (int i = 0; i < RELIABLE_WINDOW; i++) {
+        ch->slots[i].in_flight = 0;
+    }
+    ch->oldest = ch->next_seq;
+    ch->stopped = 1;
+    metrics.reliable_failures++;
+    LOG(LOG_WARN, "Reliable channel of player %u stopped after %d unacked retransmissions",
+        player->player_id, RELIABLE_MAX_RETRIES);
+}
 
-    // Send to all active players
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active) {
-            sendto(server_socket, &packet, sizeof(PacketHeader) + 1 + idx * sizeof(EntityData), 0,
-                   (struct sockaddr*)&players[i].addr, sizeof(players[i].addr));
-        }
+// Retransmit every message whose timeout has passed, backing off
+// exponentially per message. A message that runs out of retries stops
+// its channel.
+void reliable_resend_due(uint64_t now) {
+    if (now < reliable_next_resend) {
+        return;
     }
 
-    // Also send to all spectators (so they can see entities before joining)
-    for (int i = 0; i < MAX_SPECTATORS; i++) {
-        if (spectators[i].active) {
-            sendto(server_socket, &packet, sizeof(PacketHeader) + 1 + idx * sizeof(EntityData), 0,
-                   (struct sockaddr*)&spectators[i].addr, sizeof(spectators[i].addr));
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < max_players; i++) {
+        Player *player = &players[i];
+        if (!player->active || !(player->caps & CAP_RELIABLE)) continue;
+
+        ReliableChannel *ch = &reliable_channels[i];
+        for (uint32_t seq = ch->oldest; seq != ch->next_seq; seq++) {
+            ReliableSlot *slot = &ch->slots[seq % RELIABLE_WINDOW];
+            if (!slot->in_flight) continue;
+
+            if (slot->resend_ns <= now) {
+                if (slot->retries >= RELIABLE_MAX_RETRIES) {
+                    reliable_stop(player, ch);
+                    break;
+                }
+                slot->retries++;
+                int shift = slot->retries < 5 ? slot->retries : 5;
+                uint64_t timeout = ch->rto_ns << shift;
+                if (timeout > RELIABLE_MAX_RTO_MS * NS_PER_MS) timeout = RELIABLE_MAX_RTO_MS * NS_PER_MS;
+                slot->resend_ns = now + timeout;
+
+                sendq_send_player(player, slot->data, slot->len);
+                metrics.reliable_retransmits++;
+            }
+            if (slot->resend_ns < next) next = slot->resend_ns;
         }
     }
+    reliable_next_resend = next;
+}
 
+// Deadline for the event loop timer (UINT64_MAX = nothing in flight)
+static inline uint64_t reliable_next_deadline(void) {
+    return reliable_next_resend;
 }
 
-// Send damage to a specific player (called when entity attacks player)
-void send_player_damage(uint32_t target_player_id, float damage, uint32_t attacker_entity_id,
-                        float knockback_x, float knockback_y, float knockback_z) {
+// =============================================================================
+// TIMER WHEEL
+// =============================================================================
 
-    Player *target = find_player_by_id(target_player_id);
-    if (target && target->active) {
-        PlayerDamagePacket packet;
-        memset(&packet, 0, sizeof(packet));
-        packet.header.type = PKT_PLAYER_DAMAGE;
-        packet.header.sequence = ++state_sequence;
-        packet.header.player_id = 0;  // From server
-        packet.target_player_id = target_player_id;
-        packet.damage = damage;
-        packet.attacker_entity_id = attacker_entity_id;
-        packet.knockback_x = knockback_x;
-        packet.knockback_y = knockback_y;
-        packet.knockback_z = knockback_z;
+// Hierarchical timing wheel for AI timers and player timeouts, so each
+// update only touches timers that actually expire. Level 0 has one slot per
+// tick; each higher level has one slot per full turn of the level below,
+// and its timers are re-filed downward as time reaches them.
+//
+// Timers are preallocated in per-owner ranges (timer_create_range) and
+// identified by base + index; the callback gets the index. Only the event
+// loop thread may schedule, cancel or advance.
 
-        sendto(server_socket, &packet, sizeof(packet), 0,
-               (struct sockaddr*)&target->addr, sizeof(target->addr));
+typedef void (*TimerFn)(int index);
 
-        printf("Sent player damage: player %u takes %.1f damage from entity %u\n",
-               target_player_id, damage, attacker_entity_id);
-        fflush(stdout);
+typedef struct {
+    uint64_t expires;          // Wheel tick
+    int32_t next, prev;        // Slot list links (-1 = none)
+    int32_t slot;              // Index into wheel heads (-1 = not scheduled)
+    int32_t index;             // Passed to fn
+    TimerFn fn;
+} TimerNode;
+
+typedef struct {
+    TimerNode *nodes;
+    int capacity;
+    int count;
+    int32_t heads[TIMER_WHEEL_LEVELS << TIMER_WHEEL_BITS];
+    uint64_t now;              // Last tick processed
+    uint64_t origin_ms;        // Monotonic time of tick 0
+} TimerWheel;
+
+static TimerWheel timer_wheel;
+
+int init_timer_wheel(int capacity, uint64_t now_ms) {
+    TimerWheel *w = &timer_wheel;
+    w->nodes = calloc(capacity, sizeof(TimerNode));
+    if (!w->nodes) return -1;
+    w->capacity = capacity;
+    w->count = 0;
+    w->now = 0;
+    w->origin_ms = now_ms;
+    for (size_t s = 0; s < sizeof(w->heads) / sizeof(w->heads[0]); s++) {
+        w->heads[s] = -1;
     }
+    return 0;
+}
 
+// Reserve count timers calling fn. Returns the first ID, or -1 if the wheel is full.
+int32_t timer_create_range(TimerFn fn, int count) {
+    TimerWheel *w = &timer_wheel;
+    if (w->count + count > w->capacity) return -1;
+
+    int32_t base = w->count;
+    for (int n = 0; n < count; n++) {
+        TimerNode *t = &w->nodes[base + n];
+        t->slot = -1;
+        t->index = n;
+        t->fn = fn;
+    }
+    w->count += count;
+    return base;
 }
 
-// Handle entity damage from a player
-void handle_entity_damage_server(uint32_t entity_id, float damage, uint32_t attacker_id) {
-    printf(">>> ENTITY DAMAGE: entity=%u damage=%.1f attacker=%u\n", entity_id, damage, attacker_id);
-    fflush(stdout);
+static void timer_link(int32_t id) {
+    TimerWheel *w = &timer_wheel;
+    TimerNode *t = &w->nodes[id];
+
+    // Level: how far out the timer is, capped at the outermost level (it
+    // gets re-filed when that slot comes round)
+    uint64_t delta = t->expires - w->now;
+    uint64_t max_delta = (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    uint64_t at = (delta > max_delta) ? w->now + max_delta : t->expires;
+    if (delta > max_delta) delta = max_delta;
+
+    int level = 0;
+    while (delta >= (1ull << (TIMER_WHEEL_BITS * (level + 1)))) level++;
+
+    int32_t slot = (level << TIMER_WHEEL_BITS) |
+                   (int32_t)((at >> (TIMER_WHEEL_BITS * level)) & ((1u << TIMER_WHEEL_BITS) - 1));
+    t->slot = slot;
+    t->prev = -1;
+    t->next = w->heads[slot];
+    if (t->next >= 0) w->nodes[t->next].prev = id;
+    w->heads[slot] = id;
+}
 
-    for (int i = 0; i < MAX_BOBBAS; i++) {
-        if (bobbas[i].active && bobbas[i].entity_id == entity_id) {
-            bobbas[i].health -= damage;
-            bobbas[i].stun_timer = 0.5f;
-            bobbas[i].state = BOBBA_STUNNED;
-
-            // Switch target to attacker
-            bobbas[i].target_player_id = attacker_id;
-
-            printf("Bobba %u took %.1f damage from player %u (health: %.1f)\n",
-                   entity_id, damage, attacker_id, bobbas[i].health);
-            fflush(stdout);
-
-            if (bobbas[i].health <= 0) {
-                printf("Bobba %u died! Broadcasting restart to all players.\n", entity_id);
-                fflush(stdout);
-                bobbas[i].active = 0;
-                // Server broadcasts restart - don't wait for client request
-                handle_game_restart(1, 0);  // reason=1 (Bobba died), requester=0 (server)
-            }
-            return;
-        }
-    }
-    printf(">>> Entity %u not found in Bobbas\n", entity_id);
-    fflush(stdout);
+static void timer_unlink(int32_t id) {
+    TimerWheel *w = &timer_wheel;
+    TimerNode *t = &w->nodes[id];
 
-    // Also check dragons
-    for (int i = 0; i < MAX_DRAGONS; i++) {
-        if (dragons[i].active && dragons[i].entity_id == entity_id) {
-            dragons[i].health -= damage;
-            printf("Dragon %u took %.1f damage from player %u (health: %.1f)\n",
-                   entity_id, damage, attacker_id, dragons[i].health);
-            fflush(stdout);
+    if (t->prev >= 0) w->nodes[t->prev].next = t->next;
+    else w->heads[t->slot] = t->next;
+    if (t->next >= 0) w->nodes[t->next].prev = t->prev;
+    t->slot = -1;
+}
 
-            if (dragons[i].health <= 0) {
-                printf("Dragon %u died!\n", entity_id);
-                dragons[i].active = 0;
+static inline int timer_pending(int32_t id) {
+    return timer_wheel.nodes[id].slot >= 0;
+}
+
+// (Re)arm a timer to fire after the given number of seconds
+void timer_schedule(int32_t id, float seconds) {
+    TimerWheel *w = &timer_wheel;
+    if (timer_pending(id)) timer_unlink(id);
+
+    float ticks = ceilf(seconds * 1000.0f / TIMER_WHEEL_TICK_MS);
+    w->nodes[id].expires = w->now + (ticks < 1.0f ? 1 : (uint64_t)ticks);
+    timer_link(id);
+}
+
+void timer_cancel(int32_t id) {
+    if (timer_pending(id)) timer_unlink(id);
+}
+
+// Seconds until a timer fires (0 if it isn't scheduled). Reads only the
+// timer's own expiry, so AI jobs may call it for their own entities.
+static inline float timer_remaining(int32_t id) {
+    const TimerNode *t = &timer_wheel.nodes[id];
+    if (t->slot < 0) return 0.0f;
+    return (float)(t->expires - timer_wheel.now) * (TIMER_WHEEL_TICK_MS / 1000.0f);
+}
+
+// Fire every timer due up to now_ms, re-filing outer levels as their slots
+// come round. Callbacks may schedule and cancel timers.
+void advance_timers(uint64_t now_ms) {
+    TimerWheel *w = &timer_wheel;
+    const uint32_t mask = (1u << TIMER_WHEEL_BITS) - 1;
+    uint64_t target = (now_ms - w->origin_ms) / TIMER_WHEEL_TICK_MS;
+
+    while (w->now < target) {
+        uint64_t tick = ++w->now;
+
+        // Crossing into a new turn of a level: pull the outer slot for this
+        // turn down a level (or straight to level 0)
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if ((tick & ((1ull << (TIMER_WHEEL_BITS * level)) - 1)) != 0) break;
+            int32_t slot = (level << TIMER_WHEEL_BITS) | (int32_t)((tick >> (TIMER_WHEEL_BITS * level)) & mask);
+            int32_t id = w->heads[slot];
+            w->heads[slot] = -1;
+            while (id >= 0) {
+                int32_t next = w->nodes[id].next;
+                timer_link(id);
+                id = next;
             }
-            break;
         }
-    }
 
+        int32_t slot = (int32_t)(tick & mask);
+        while (w->heads[slot] >= 0) {
+            int32_t id = w->heads[slot];
+            timer_unlink(id);
+            w->nodes[id].fn(w->nodes[id].index);
+        }
+    }
 }
 
 // =============================================================================
-// DRAGON AI (Server-authoritative)
+// PLAYER LOOKUP INDEX
 // =============================================================================
 
-// Initialize a Dragon
-void spawn_dragon(float center_x, float center_z) {
-
-    for (int i = 0; i < MAX_DRAGONS; i++) {
-        if (!dragons[i].active) {
-            memset(&dragons[i], 0, sizeof(ServerDragon));
-            dragons[i].entity_id = next_entity_id++;
-            dragons[i].patrol_center_x = center_x;
-            dragons[i].patrol_center_z = center_z;
-            dragons[i].patrol_angle = 0.0f;
+// Open-addressing hash index from a 64-bit key to a slot in players[] or
+// spectators[]. Linear probing with backward-shift deletion (no tombstones),
+// sized to at least twice the slot count so probes stay short.
+typedef struct {
+    uint64_t *keys;
+    int32_t *values;           // Slot index, -1 = empty bucket
+    uint32_t mask;             // Bucket count - 1 (power of two)
+} SlotIndex;
+
+static SlotIndex player_addr_index;     // (addr, port) -> players[] slot
+static SlotIndex player_id_index;       // player_id -> players[] slot
+static SlotIndex spectator_addr_index;  // (addr, port) -> spectators[] slot
+
+// 64-bit finalizer (splitmix64) so sequential IDs and ports spread out
+static inline uint32_t slot_index_hash(uint64_t key) {
+    key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27; key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (uint32_t)key;
+}
 
-            // Start at patrol position
-            dragons[i].pos_x = center_x + DRAGON_PATROL_RADIUS;
-            dragons[i].pos_y = DRAGON_PATROL_HEIGHT;
-            dragons[i].pos_z = center_z;
-            dragons[i].rot_y = 0;
-            dragons[i].state = DRAGON_PATROL;
-            dragons[i].health = 500.0f;
-            dragons[i].active = 1;
-            dragons[i].laps_completed = 0;
+static inline uint64_t addr_key(const struct sockaddr_in *addr) {
+    return ((uint64_t)addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
 
-            printf("Spawned Dragon %u at (%.1f, %.1f, %.1f), patrol center (%.1f, %.1f)\n",
-                   dragons[i].entity_id, dragons[i].pos_x, dragons[i].pos_y, dragons[i].pos_z,
-                   center_x, center_z);
-            fflush(stdout);
-            break;
-        }
-    }
+int slot_index_init(SlotIndex *idx, int capacity) {
+    uint32_t buckets = 16;
+    while (buckets < (uint32_t)capacity * 2) buckets <<= 1;
 
+    idx->keys = calloc(buckets, sizeof(uint64_t));
+    idx->values = malloc(buckets * sizeof(int32_t));
+    if (!idx->keys || !idx->values) return -1;
+    for (uint32_t i = 0; i < buckets; i++) idx->values[i] = -1;
+    idx->mask = buckets - 1;
+    return 0;
 }
 
-// Get dragon patrol position based on angle
-void get_dragon_patrol_position(ServerDragon *dragon, float *out_x, float *out_y, float *out_z) {
-    // Oval patrol path with slight height variation
-    *out_x = dragon->patrol_center_x + cos(dragon->patrol_angle) * DRAGON_PATROL_RADIUS;
-    *out_z = dragon->patrol_center_z + sin(dragon->patrol_angle) * DRAGON_PATROL_RADIUS * 0.7f;  // Oval
-    *out_y = DRAGON_PATROL_HEIGHT + sin(dragon->patrol_angle * 2) * 5.0f;  // Gentle undulation
+int32_t slot_index_find(const SlotIndex *idx, uint64_t key) {
+    uint32_t b = slot_index_hash(key) & idx->mask;
+    while (idx->values[b] >= 0) {
+        if (idx->keys[b] == key) return idx->values[b];
+        b = (b + 1) & idx->mask;
+    }
+    return -1;
 }
 
-// Update a single Dragon's AI
-void update_dragon_ai(ServerDragon *dragon, float delta) {
-    if (!dragon->active) return;
+// Insert or overwrite
+void slot_index_put(SlotIndex *idx, uint64_t key, int32_t value) {
+    uint32_t b = slot_index_hash(key) & idx->mask;
+    while (idx->values[b] >= 0 && idx->keys[b] != key) {
+        b = (b + 1) & idx->mask;
+    }
+    idx->keys[b] = key;
+    idx->values[b] = value;
+}
 
-    // TEST_MULTIPLAYER mode: skip AI, just patrol (no attacks)
-    if (test_multiplayer) {
-        dragon->state = DRAGON_PATROL;
-        // Still update patrol position for visual interest
-        dragon->patrol_angle += DRAGON_PATROL_SPEED * delta / DRAGON_PATROL_RADIUS;
-        if (dragon->patrol_angle > 2.0f * M_PI) {
-            dragon->patrol_angle -= 2.0f * M_PI;
+void slot_index_remove(SlotIndex *idx, uint64_t key) {
+    uint32_t b = slot_index_hash(key) & idx->mask;
+    while (idx->values[b] >= 0 && idx->keys[b] != key) {
+        b = (b + 1) & idx->mask;
+    }
+    if (idx->values[b] < 0) return;
+
+    // Backward-shift: pull later entries of the probe run into the hole
+    // unless their home bucket lies cyclically after it
+    uint32_t hole = b;
+    uint32_t next = (hole + 1) & idx->mask;
+    while (idx->values[next] >= 0) {
+        uint32_t home = slot_index_hash(idx->keys[next]) & idx->mask;
+        if (((next - home) & idx->mask) >= ((next - hole) & idx->mask)) {
+            idx->keys[hole] = idx->keys[next];
+            idx->values[hole] = idx->values[next];
+            hole = next;
         }
-        float target_x, target_y, target_z;
-        get_dragon_patrol_position(dragon, &target_x, &target_y, &target_z);
-        dragon->pos_x = target_x;
-        dragon->pos_y = target_y;
-        dragon->pos_z = target_z;
-        return;
+        next = (next + 1) & idx->mask;
     }
+    idx->values[hole] = -1;
+}
 
-    switch (dragon->state) {
-        case DRAGON_PATROL: {
-            // Move along circular patrol path
-            dragon->patrol_angle += (DRAGON_PATROL_SPEED / DRAGON_PATROL_RADIUS) * delta;
+// Find player by address
+Player* find_player_by_addr(struct sockaddr_in *addr) {
+    int32_t slot = slot_index_find(&player_addr_index, addr_key(addr));
+    return slot >= 0 ? &players[slot] : NULL;
+}
 
-            // Check for lap completion
-            if (dragon->patrol_angle >= 2.0f * M_PI) {
-                dragon->patrol_angle -= 2.0f * M_PI;
-                dragon->laps_completed++;
-                printf("Dragon %u completed lap %d\n", dragon->entity_id, dragon->laps_completed);
+// Find player by ID
+Player* find_player_by_id(uint32_t id) {
+    int32_t slot = slot_index_find(&player_id_index, id);
+    return slot >= 0 ? &players[slot] : NULL;
+}
 
-                // Land after specified laps
-                if (dragon->laps_completed >= DRAGON_LAPS_BEFORE_LANDING) {
-                    dragon->laps_completed = 0;
-                    dragon->state = DRAGON_FLYING_TO_LAND;
-                    printf("Dragon %u flying to landing spot\n", dragon->entity_id);
-                }
-            }
+// Find spectator slot by address (-1 if not spectating)
+int find_spectator_by_addr(struct sockaddr_in *addr) {
+    return slot_index_find(&spectator_addr_index, addr_key(addr));
+}
 
-            // Move towards patrol position
-            float target_x, target_y, target_z;
-            get_dragon_patrol_position(dragon, &target_x, &target_y, &target_z);
+// Mark a player slot active and index it
+void activate_player(Player *player) {
+    player->active = 1;
+    int32_t slot = (int32_t)(player - players);
+    slot_index_put(&player_addr_index, addr_key(&player->addr), slot);
+    slot_index_put(&player_id_index, player->player_id, slot);
+    timer_schedule(player_timers + slot, PLAYER_TIMEOUT_SEC + 1);
+}
 
-            float dx = target_x - dragon->pos_x;
-            float dy = target_y - dragon->pos_y;
-            float dz = target_z - dragon->pos_z;
-            float len = sqrt(dx*dx + dy*dy + dz*dz);
+// Free a player slot (leave or timeout)
+void deactivate_player(Player *player) {
+    if (!player->active) return;
+    player->active = 0;
+    slot_index_remove(&player_addr_index, addr_key(&player->addr));
+    slot_index_remove(&player_id_index, player->player_id);
+    timer_cancel(player_timers + (player - players));
+}
 
-            if (len > 0.1f) {
-                dx /= len; dy /= len; dz /= len;
-                dragon->pos_x += dx * DRAGON_PATROL_SPEED * delta;
-                dragon->pos_y += dy * DRAGON_PATROL_SPEED * delta;
-                dragon->pos_z += dz * DRAGON_PATROL_SPEED * delta;
-                dragon->rot_y = atan2(dx, dz);
-            }
-            break;
+// Find free player slot
+int find_free_slot() {
+    for (int i = 0; i < max_players; i++) {
+        if (!players[i].active) {
+            return i;
         }
+    }
+    return -1;
+}
 
-        case DRAGON_FLYING_TO_LAND: {
-            // Fly towards landing spot (approach from above)
-            float approach_x = DRAGON_LANDING_SPOT_X;
-            float approach_y = DRAGON_LANDING_SPOT_Y + 20.0f;  // Approach from above
-            float approach_z = DRAGON_LANDING_SPOT_Z;
+// Count active players
+int count_active_players() {
+    int count = 0;
+    for (int i = 0; i < max_players; i++) {
+        if (players[i].active) count++;
+    }
+    return count;
+}
 
-            float dx = approach_x - dragon->pos_x;
-            float dy = approach_y - dragon->pos_y;
+// =============================================================================
+// PLAYER SPATIAL GRID
+// =============================================================================
+
+// Uniform grid over player XZ positions, rebuilt at the start of each entity
+// tick so AI range checks only visit nearby cells. The world is unbounded,
+// so cells are hashed into a fixed bucket array; each bucket's players are
+// stored contiguously by a counting sort.
+typedef struct {
+    int32_t cell_x, cell_z;
+    int32_t slot;              // Index into players[]
+} GridEntry;
+
+static GridEntry *grid_entries;      // Active players, grouped by bucket
+static uint32_t *grid_bucket_start;  // grid_bucket_count + 1 offsets into grid_entries
+static uint32_t grid_bucket_count;   // Power of two
+static int grid_entry_count;
+static uint8_t *grid_coarse_occupied; // Coarse cells holding a player, hashed like the buckets
+
+int init_player_grid(void) {
+    grid_bucket_count = 16;
+    while (grid_bucket_count < (uint32_t)max_players * 2) grid_bucket_count <<= 1;
+
+    grid_entries = malloc(max_players * sizeof(GridEntry));
+    grid_bucket_start = calloc(grid_bucket_count + 1, sizeof(uint32_t));
+    grid_coarse_occupied = calloc(grid_bucket_count, 1);
+    return (grid_entries && grid_bucket_start && grid_coarse_occupied) ? 0 : -1;
+}
+
+static inline int32_t grid_cell(float coord) {
+    return (int32_t)floorf(coord / GRID_CELL_SIZE);
+}
+
+static inline uint32_t grid_bucket(int32_t cell_x, int32_t cell_z) {
+    uint32_t h = ((uint32_t)cell_x * 0x9E3779B1u) ^ ((uint32_t)cell_z * 0x85EBCA77u);
+    return (h ^ (h >> 15)) & (grid_bucket_count - 1);
+}
+
+static inline int32_t grid_coarse_cell(float coord) {
+    return (int32_t)floorf(coord / GRID_COARSE_CELL_SIZE);
+}
+
+// Re-bin every active player at its current position
+void rebuild_player_grid(void) {
+    memset(grid_bucket_start, 0, (grid_bucket_count + 1) * sizeof(uint32_t));
+    memset(grid_coarse_occupied, 0, grid_bucket_count);
+
+    // Count per bucket, then prefix-sum into start offsets
+    for (int i = 0; i < max_players; i++) {
+        if (!players[i].active) continue;
+        uint32_t b = grid_bucket(grid_cell(players[i].data.pos_x), grid_cell(players[i].data.pos_z));
+        grid_bucket_start[b + 1]++;
+        grid_coarse_occupied[grid_bucket(grid_coarse_cell(players[i].data.pos_x),
+                                         grid_coarse_cell(players[i].data.pos_z))] = 1;
+    }
+    for (uint32_t b = 0; b < grid_bucket_count; b++) {
+        grid_bucket_start[b + 1] += grid_bucket_start[b];
+    }
+
+    // Scatter, using each bucket's start as its write cursor...
+    for (int i = 0; i < max_players; i++) {
+        if (!players[i].active) continue;
+        int32_t cx = grid_cell(players[i].data.pos_x);
+        int32_t cz = grid_cell(players[i].data.pos_z);
+        GridEntry *e = &grid_entries[grid_bucket_start[grid_bucket(cx, cz)]++];
+        e->cell_x = cx;
+        e->cell_z = cz;
+        e->slot = i;
+    }
+
+    // ...which leaves start[b] at the end of bucket b, so shift back by one
+    for (uint32_t b = grid_bucket_count; b > 0; b--) {
+        grid_bucket_start[b] = grid_bucket_start[b - 1];
+    }
+    grid_bucket_start[0] = 0;
+    grid_entry_count = grid_bucket_start[grid_bucket_count];
+}
+
+// Returns 0 only if every player is more than GRID_COARSE_CELL_SIZE away
+// from (x, z) horizontally. Hash collisions can only give false positives.
+int players_possibly_near(float x, float z) {
+    int32_t cx = grid_coarse_cell(x);
+    int32_t cz = grid_coarse_cell(z);
+    for (int32_t dz = -1; dz <= 1; dz++) {
+        for (int32_t dx = -1; dx <= 1; dx++) {
+            if (grid_coarse_occupied[grid_bucket(cx + dx, cz + dz)]) return 1;
+        }
+    }
+    return 0;
+}
+
+typedef void (*GridVisitFn)(Player *player, float dist, void *ctx);
+
+static inline void grid_visit_entry(const GridEntry *e, float x, float y, float z,
+                                    float radius_sq, GridVisitFn visit, void *ctx) {
+    Player *player = &players[e->slot];
+    float dx = player->data.pos_x - x;
+    float dy = player->data.pos_y - y;
+    float dz = player->data.pos_z - z;
+    float dist_sq = dx*dx + dy*dy + dz*dz;
+    if (player->active && dist_sq <= radius_sq) {
+        visit(player, sqrtf(dist_sq), ctx);
+    }
+}
+
+// Call visit for every player in the grid within radius of (x, y, z)
+void query_players_in_radius(float x, float y, float z, float radius,
+                             GridVisitFn visit, void *ctx) {
+    int32_t min_cx = grid_cell(x - radius), max_cx = grid_cell(x + radius);
+    int32_t min_cz = grid_cell(z - radius), max_cz = grid_cell(z + radius);
+    float radius_sq = radius * radius;
+
+    // A radius spanning more cells than there are buckets is cheaper as a
+    // straight pass over every entry
+    uint64_t span = (uint64_t)(max_cx - min_cx + 1) * (uint64_t)(max_cz - min_cz + 1);
+    if (span > grid_bucket_count) {
+        for (int e = 0; e < grid_entry_count; e++) {
+            grid_visit_entry(&grid_entries[e], x, y, z, radius_sq, visit, ctx);
+        }
+        return;
+    }
+
+    for (int32_t cz = min_cz; cz <= max_cz; cz++) {
+        for (int32_t cx = min_cx; cx <= max_cx; cx++) {
+            uint32_t b = grid_bucket(cx, cz);
+            for (uint32_t e = grid_bucket_start[b]; e < grid_bucket_start[b + 1]; e++) {
+                // Buckets are shared by colliding cells; only take this cell's players
+                if (grid_entries[e].cell_x != cx || grid_entries[e].cell_z != cz) continue;
+                grid_visit_entry(&grid_entries[e], x, y, z, radius_sq, visit, ctx);
+            }
+        }
+    }
+}
+
+// =============================================================================
+// BOBBA KERNELS
+// =============================================================================
+
+// Straight-line math over contiguous Bobba slots. Each kernel has a scalar
+// version plus SSE/AVX versions picked at startup by init_bobba_kernels.
+// All versions give bit-identical results: same operation order, IEEE
+// sqrt/div, and no FMA.
+
+// Bobba movement queued for the move kernel
+#define BOBBA_MOVE_NONE  0
+#define BOBBA_MOVE_ROAM  1
+#define BOBBA_MOVE_CHASE 2
+#define BOBBA_MIN_MOVE_DIST 0.1f   // Chasing stops closer than this to the target
+
+typedef void (*TargetDistanceFn)(int count, const float *px, const float *py, const float *pz,
+                                 const float *tx, const float *ty, const float *tz, float *dist);
+
+// Move step[i] meters along (dx, dz) normalized, unless step is 0 or the
+// heading is shorter than BOBBA_MIN_MOVE_DIST. face_x/face_z receive the unit
+// heading moved along, or 0 for lanes that stayed put.
+typedef void (*MoveFn)(int count, const float *step,
+                       const float *dx, const float *dz, float *px, float *pz,
+                       float *face_x, float *face_z);
+
+static void target_distance_scalar(int count, const float *px, const float *py, const float *pz,
+                                   const float *tx, const float *ty, const float *tz, float *dist) {
+    for (int i = 0; i < count; i++) {
+        float dx = tx[i] - px[i];
+        float dy = ty[i] - py[i];
+        float dz = tz[i] - pz[i];
+        dist[i] = sqrtf(dx*dx + dy*dy + dz*dz);
+    }
+}
+
+static void move_scalar(int count, const float *step,
+                        const float *dx, const float *dz, float *px, float *pz,
+                        float *face_x, float *face_z) {
+    for (int i = 0; i < count; i++) {
+        float len = sqrtf(dx[i]*dx[i] + dz[i]*dz[i]);
+        if (step[i] > 0 && len > BOBBA_MIN_MOVE_DIST) {
+            float ux = dx[i] / len;
+            float uz = dz[i] / len;
+            px[i] += ux * step[i];
+            pz[i] += uz * step[i];
+            face_x[i] = ux;
+            face_z[i] = uz;
+        } else {
+            face_x[i] = 0;
+            face_z[i] = 0;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static void target_distance_sse(int count, const float *px, const float *py, const float *pz,
+                                const float *tx, const float *ty, const float *tz, float *dist) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(tx + i), _mm_loadu_ps(px + i));
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(ty + i), _mm_loadu_ps(py + i));
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(tz + i), _mm_loadu_ps(pz + i));
+        __m128 sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        _mm_storeu_ps(dist + i, _mm_sqrt_ps(sq));
+    }
+    target_distance_scalar(count - i, px + i, py + i, pz + i, tx + i, ty + i, tz + i, dist + i);
+}
+
+__attribute__((target("sse2")))
+static void move_sse(int count, const float *step,
+                     const float *dx, const float *dz, float *px, float *pz,
+                     float *face_x, float *face_z) {
+    const __m128 vmin = _mm_set1_ps(BOBBA_MIN_MOVE_DIST);
+    const __m128 zero = _mm_setzero_ps();
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 hx = _mm_loadu_ps(dx + i);
+        __m128 hz = _mm_loadu_ps(dz + i);
+        __m128 stp = _mm_loadu_ps(step + i);
+        __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(hx, hx), _mm_mul_ps(hz, hz)));
+
+        // Lanes that stay put get a zero heading (also masks 0/0 NaNs)
+        __m128 moving = _mm_and_ps(_mm_cmpgt_ps(stp, zero), _mm_cmpgt_ps(len, vmin));
+        __m128 ux = _mm_and_ps(_mm_div_ps(hx, len), moving);
+        __m128 uz = _mm_and_ps(_mm_div_ps(hz, len), moving);
+
+        _mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(ux, stp)));
+        _mm_storeu_ps(pz + i, _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(uz, stp)));
+        _mm_storeu_ps(face_x + i, ux);
+        _mm_storeu_ps(face_z + i, uz);
+    }
+    move_scalar(count - i, step + i, dx + i, dz + i, px + i, pz + i, face_x + i, face_z + i);
+}
+
+__attribute__((target("avx")))
+static void target_distance_avx(int count, const float *px, const float *py, const float *pz,
+                                const float *tx, const float *ty, const float *tz, float *dist) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(tx + i), _mm256_loadu_ps(px + i));
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ty + i), _mm256_loadu_ps(py + i));
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(tz + i), _mm256_loadu_ps(pz + i));
+        __m256 sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                  _mm256_mul_ps(dz, dz));
+        _mm256_storeu_ps(dist + i, _mm256_sqrt_ps(sq));
+    }
+    target_distance_scalar(count - i, px + i, py + i, pz + i, tx + i, ty + i, tz + i, dist + i);
+}
+
+__attribute__((target("avx")))
+static void move_avx(int count, const float *step,
+                     const float *dx, const float *dz, float *px, float *pz,
+                     float *face_x, float *face_z) {
+    const __m256 vmin = _mm256_set1_ps(BOBBA_MIN_MOVE_DIST);
+    const __m256 zero = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 hx = _mm256_loadu_ps(dx + i);
+        __m256 hz = _mm256_loadu_ps(dz + i);
+        __m256 stp = _mm256_loadu_ps(step + i);
+        __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(hx, hx), _mm256_mul_ps(hz, hz)));
+
+        // Lanes that stay put get a zero heading (also masks 0/0 NaNs)
+        __m256 moving = _mm256_and_ps(_mm256_cmp_ps(stp, zero, _CMP_GT_OQ),
+                                      _mm256_cmp_ps(len, vmin, _CMP_GT_OQ));
+        __m256 ux = _mm256_and_ps(_mm256_div_ps(hx, len), moving);
+        __m256 uz = _mm256_and_ps(_mm256_div_ps(hz, len), moving);
+
+        _mm256_storeu_ps(px + i, _mm256_add_ps(_mm256_loadu_ps(px + i), _mm256_mul_ps(ux, stp)));
+        _mm256_storeu_ps(pz + i, _mm256_add_ps(_mm256_loadu_ps(pz + i), _mm256_mul_ps(uz, stp)));
+        _mm256_storeu_ps(face_x + i, ux);
+        _mm256_storeu_ps(face_z + i, uz);
+    }
+    move_scalar(count - i, step + i, dx + i, dz + i, px + i, pz + i, face_x + i, face_z + i);
+}
+
+#endif
+
+static TargetDistanceFn bobba_target_distance = target_distance_scalar;
+static MoveFn bobba_move = move_scalar;
+static const char *bobba_kernel_name = "scalar";
+
+// Pick the widest kernels this CPU supports (scalar if allow_simd is 0)
+void init_bobba_kernels(int allow_simd) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (!allow_simd) return;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        bobba_target_distance = target_distance_avx;
+        bobba_move = move_avx;
+        bobba_kernel_name = "avx";
+    } else if (__builtin_cpu_supports("sse2")) {
+        bobba_target_distance = target_distance_sse;
+        bobba_move = move_sse;
+        bobba_kernel_name = "sse2";
+    }
+#else
+    (void)allow_simd;
+#endif
+}
+
+// =============================================================================
+// JOB SYSTEM
+// =============================================================================
+
+// Fixed pool of worker threads that run batches of independent jobs. The
+// event loop thread is worker 0 and works on every batch alongside the pool.
+// Each worker owns a Chase-Lev deque: it pops its own jobs from the bottom
+// and steals from the top of the others' when it runs dry. Jobs are dealt
+// into the deques before the batch is published, and never pushed while it
+// runs, so the deques don't need to grow.
+//
+// Jobs must not touch shared server state (sockets, stdout, rand()); they
+// record side effects in per-job buffers for the caller to apply in job
+// order once the batch is done.
+
+typedef void (*JobFn)(void *ctx, int job);
+
+typedef struct {
+    _Alignas(64) atomic_long top;       // Next job to steal
+    _Alignas(64) atomic_long bottom;    // One past the owner's next job
+    atomic_int jobs[JOB_MAX_BATCH];
+} JobDeque;
+
+typedef struct {
+    int worker_count;                   // Including the event loop thread
+    pthread_t threads[JOB_MAX_WORKERS];
+    JobDeque *deques;                   // worker_count entries
+
+    // Current batch
+    JobFn fn;
+    void *ctx;
+    atomic_int remaining;               // Jobs not yet finished
+    atomic_int busy;                    // Pool threads still inside the batch
+
+    // Pool threads sleep here between batches
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    uint64_t generation;                // Bumped for each published batch
+    int shutdown;
+} JobSystem;
+
+static JobSystem job_system;
+
+// Busy-wait step: spin briefly, then give the core away in case the thread
+// we're waiting on shares it
+static inline void job_backoff(int *spins) {
+    if (++*spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+// Owner only: add a job at the bottom
+static void deque_push(JobDeque *q, int job) {
+    long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    atomic_store_explicit(&q->jobs[b & (JOB_MAX_BATCH - 1)], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+}
+
+// Owner only: take the newest job. Returns -1 if empty or a thief won the last one.
+static int deque_take(JobDeque *q) {
+    long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return -1;
+    }
+
+    int job = atomic_load_explicit(&q->jobs[b & (JOB_MAX_BATCH - 1)], memory_order_relaxed);
+    if (t == b) {
+        // Last job: race any thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed)) {
+            job = -1;
+        }
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+    return job;
+}
+
+// Any thread: take the oldest job. Returns -1 if empty or another thread won it.
+static int deque_steal(JobDeque *q) {
+    long t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if (t >= b) return -1;
+
+    int job = atomic_load_explicit(&q->jobs[t & (JOB_MAX_BATCH - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return -1;
+    }
+    return job;
+}
+
+// Run jobs from our own deque, then steal, until the whole batch is done
+static void job_work(int self) {
+    JobSystem *js = &job_system;
+    int spins = 0;
+
+    while (atomic_load_explicit(&js->remaining, memory_order_acquire) > 0) {
+        int job = deque_take(&js->deques[self]);
+        for (int k = 1; job < 0 && k < js->worker_count; k++) {
+            job = deque_steal(&js->deques[(self + k) % js->worker_count]);
+        }
+        if (job < 0) {
+            // Everything is claimed; wait for the stragglers
+            job_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        js->fn(js->ctx, job);
+        atomic_fetch_sub_explicit(&js->remaining, 1, memory_order_release);
+    }
+}
+
+static void *job_worker_main(void *arg) {
+    JobSystem *js = &job_system;
+    int self = (int)(intptr_t)arg;
+    uint64_t seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&js->lock);
+        while (js->generation == seen && !js->shutdown) {
+            pthread_cond_wait(&js->wake, &js->lock);
+        }
+        if (js->shutdown) {
+            pthread_mutex_unlock(&js->lock);
+            return NULL;
+        }
+        seen = js->generation;
+        pthread_mutex_unlock(&js->lock);
+
+        job_work(self);
+        atomic_fetch_sub_explicit(&js->busy, 1, memory_order_release);
+    }
+}
+
+// Start worker_count - 1 pool threads. Returns 0 on success.
+int init_job_system(int worker_count) {
+    JobSystem *js = &job_system;
+    memset(js, 0, sizeof(*js));
+    pthread_mutex_init(&js->lock, NULL);
+    pthread_cond_init(&js->wake, NULL);
+
+    js->deques = aligned_alloc(64, worker_count * sizeof(JobDeque));
+    if (!js->deques) return -1;
+    memset(js->deques, 0, worker_count * sizeof(JobDeque));
+
+    // Signals belong to the event loop thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    js->worker_count = 1;
+    for (int w = 1; w < worker_count; w++) {
+        if (pthread_create(&js->threads[w], NULL, job_worker_main, (void*)(intptr_t)w) != 0) {
+            break;
+        }
+        js->worker_count++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return 0;
+}
+
+void shutdown_job_system(void) {
+    JobSystem *js = &job_system;
+
+    pthread_mutex_lock(&js->lock);
+    js->shutdown = 1;
+    pthread_cond_broadcast(&js->wake);
+    pthread_mutex_unlock(&js->lock);
+
+    for (int w = 1; w < js->worker_count; w++) {
+        pthread_join(js->threads[w], NULL);
+    }
+    js->worker_count = 1;
+}
+
+// Deal job_count jobs (at most JOB_MAX_BATCH) across the workers and wake
+// the pool. The caller may do other work before job_batch_wait, which
+// helps finish the batch; both must be called from the event loop thread.
+void job_batch_begin(JobFn fn, void *ctx, int job_count) {
+    JobSystem *js = &job_system;
+
+    js->fn = fn;
+    js->ctx = ctx;
+    atomic_store_explicit(&js->remaining, job_count, memory_order_relaxed);
+
+    // A single job isn't worth a wakeup; job_batch_wait runs it here
+    int workers = (job_count > 1) ? js->worker_count : 1;
+
+    // Contiguous runs per worker keep neighbouring jobs on one core
+    for (int w = 0; w < workers; w++) {
+        int first = (int)((int64_t)job_count * w / workers);
+        int last = (int)((int64_t)job_count * (w + 1) / workers);
+        // Pushed in reverse so the owner pops them in ascending order
+        for (int job = last - 1; job >= first; job--) {
+            deque_push(&js->deques[w], job);
+        }
+    }
+
+    if (workers > 1) {
+        atomic_store_explicit(&js->busy, workers - 1, memory_order_relaxed);
+        pthread_mutex_lock(&js->lock);
+        js->generation++;
+        pthread_cond_broadcast(&js->wake);
+        pthread_mutex_unlock(&js->lock);
+    }
+}
+
+// Help run the current batch, then wait until every pool thread has left
+// it (so the deques are quiet for the next job_batch_begin)
+void job_batch_wait(void) {
+    JobSystem *js = &job_system;
+
+    job_work(0);
+    int spins = 0;
+    while (atomic_load_explicit(&js->busy, memory_order_acquire) > 0) {
+        job_backoff(&spins);
+    }
+}
+
+// =============================================================================
+// BOBBA AI (Server-authoritative)
+// =============================================================================
+
+static SlotIndex bobba_id_index;   // entity_id -> Bobba slot
+
+// A player hit found by an AI job, sent once the batch is done
+typedef struct {
+    uint32_t target_player_id;
+    uint32_t attacker_entity_id;
+    float damage;
+    float knockback_x, knockback_y, knockback_z;
+} PendingHit;
+
+// One AI job: a contiguous range of Bobba slots. Its hits and the slots
+// that started an attack are queued in bobba_hits and bobba_attack_starts
+// starting at index begin (at most one of each per Bobba per tick).
+typedef struct {
+    int begin, end;
+    int hit_count;
+    int attack_count;
+} BobbaJob;
+
+static BobbaJob bobba_jobs[JOB_MAX_BATCH];
+static int bobba_job_count;
+static PendingHit *bobba_hits;     // capacity entries
+static int32_t *bobba_attack_starts;  // capacity entries
+static float bobba_tick_delta;
+
+// Timer wheel IDs: slot i's stun/attack timer is bobba_state_timers + i
+static int32_t bobba_state_timers;
+static int32_t bobba_roam_timers;
+
+void bobba_state_timer_expired(int i);
+void bobba_roam_timer_expired(int i);
+
+// Allocate the Bobba store for capacity entities
+int init_bobba_store(int capacity) {
+    BobbaStore *b = &bobbas;
+    memset(b, 0, sizeof(*b));
+    b->capacity = capacity;
+
+#define BOBBA_ALLOC(field) \
+    if (!(b->field = calloc(capacity, sizeof(*b->field)))) return -1
+    BOBBA_ALLOC(entity_id);
+    BOBBA_ALLOC(pos_x); BOBBA_ALLOC(pos_y); BOBBA_ALLOC(pos_z);
+    BOBBA_ALLOC(rot_y);
+    BOBBA_ALLOC(state);
+    BOBBA_ALLOC(health);
+    BOBBA_ALLOC(spawn_x); BOBBA_ALLOC(spawn_y); BOBBA_ALLOC(spawn_z);
+    BOBBA_ALLOC(target_player_id);
+    BOBBA_ALLOC(roam_dir_x); BOBBA_ALLOC(roam_dir_z);
+    BOBBA_ALLOC(has_hit_this_attack);
+    BOBBA_ALLOC(roam_rot);
+    BOBBA_ALLOC(rng);
+    BOBBA_ALLOC(lod_tier); BOBBA_ALLOC(lod_wait); BOBBA_ALLOC(lod_elapsed);
+    BOBBA_ALLOC(thinking);
+    BOBBA_ALLOC(target_slot);
+    BOBBA_ALLOC(target_x); BOBBA_ALLOC(target_y); BOBBA_ALLOC(target_z);
+    BOBBA_ALLOC(target_dist);
+    BOBBA_ALLOC(move_kind);
+    BOBBA_ALLOC(move_dx); BOBBA_ALLOC(move_dz);
+    BOBBA_ALLOC(ai_delta);
+    BOBBA_ALLOC(move_step);
+    BOBBA_ALLOC(face_x); BOBBA_ALLOC(face_z);
+    BOBBA_ALLOC(live);
+    BOBBA_ALLOC(live_index);
+#undef BOBBA_ALLOC
+
+    for (int i = 0; i < capacity; i++) b->live_index[i] = -1;
+    bobba_hits = calloc(capacity, sizeof(PendingHit));
+    bobba_attack_starts = calloc(capacity, sizeof(int32_t));
+    if (!bobba_hits || !bobba_attack_starts) return -1;
+
+    bobba_state_timers = timer_create_range(bobba_state_timer_expired, capacity);
+    bobba_roam_timers = timer_create_range(bobba_roam_timer_expired, capacity);
+    if (bobba_state_timers < 0 || bobba_roam_timers < 0) return -1;
+
+    return slot_index_init(&bobba_id_index, capacity);
+}
+
+static inline int bobba_active(int slot) {
+    return bobbas.live_index[slot] >= 0;
+}
+
+// Add a slot to the live list
+void bobba_set_live(int slot) {
+    if (bobba_active(slot)) return;
+    bobbas.live_index[slot] = bobbas.live_count;
+    bobbas.live[bobbas.live_count++] = slot;
+}
+
+// Remove a slot from the live list (swap with the last entry)
+void bobba_set_dead(int slot) {
+    int pos = bobbas.live_index[slot];
+    if (pos < 0) return;
+    int last = bobbas.live[--bobbas.live_count];
+    bobbas.live[pos] = last;
+    bobbas.live_index[last] = pos;
+    bobbas.live_index[slot] = -1;
+    bobbas.move_step[slot] = 0;   // Keep the move kernel from shifting it
+    timer_cancel(bobba_state_timers + slot);
+    timer_cancel(bobba_roam_timers + slot);
+}
+
+// Next value in [0, 1) from this Bobba's own generator
+static inline float bobba_random(int i) {
+    uint32_t x = bobbas.rng[i];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    bobbas.rng[i] = x;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Pick a new random roam direction
+void bobba_pick_roam_direction(int i) {
+    float angle = bobba_random(i) * 2.0f * M_PI;
+    bobbas.roam_dir_x[i] = cos(angle);
+    bobbas.roam_dir_z[i] = sin(angle);
+    bobbas.roam_rot[i] = atan2(bobbas.roam_dir_x[i], bobbas.roam_dir_z[i]);
+}
+
+// Stun or attack over
+void bobba_state_timer_expired(int i) {
+    BobbaStore *b = &bobbas;
+    if (!bobba_active(i)) return;
+
+    if (b->state[i] == BOBBA_STUNNED) {
+        b->state[i] = (b->target_player_id[i] != 0) ? BOBBA_CHASING : BOBBA_ROAMING;
+    } else if (b->state[i] == BOBBA_ATTACKING) {
+        b->state[i] = BOBBA_CHASING;
+    }
+}
+
+// Change roam direction periodically. The timer keeps running while the
+// Bobba chases, so state changes never need to re-arm it.
+void bobba_roam_timer_expired(int i) {
+    if (!bobba_active(i)) return;
+    bobba_pick_roam_direction(i);
+    timer_schedule(bobba_roam_timers + i, BOBBA_ROAM_CHANGE_TIME);
+}
+
+// Simulation steps per AI step for a tier running at rate Hz
+static inline int ai_lod_period(int rate) {
+    int period = sim_tick_rate / rate;
+    return period < 1 ? 1 : period;
+}
+
+// Put a Bobba at its spawn point with fresh health and AI state
+void bobba_reset(int i) {
+    BobbaStore *b = &bobbas;
+    b->pos_x[i] = b->spawn_x[i];
+    b->pos_y[i] = b->spawn_y[i];
+    b->pos_z[i] = b->spawn_z[i];
+    b->rot_y[i] = 0;
+    b->state[i] = BOBBA_ROAMING;
+    b->health[i] = 100.0f;
+    b->target_player_id[i] = 0;
+    b->has_hit_this_attack[i] = 0;
+    timer_cancel(bobba_state_timers + i);
+
+    // Stagger AI steps by slot so the slower tiers don't all think on one tick
+    b->lod_tier[i] = AI_LOD_NEAR;
+    b->lod_wait[i] = i % ai_lod_period(AI_LOD_FAR_RATE);
+    b->lod_elapsed[i] = 0;
+
+    // Random initial roam direction, first changing after a random part of
+    // the period so roam timers don't all fire together
+    bobba_pick_roam_direction(i);
+    timer_schedule(bobba_roam_timers + i, BOBBA_ROAM_CHANGE_TIME * bobba_random(i));
+}
+
+// Add a Bobba at a position. Returns its slot, or -1 if the store is full.
+int add_bobba(float x, float y, float z) {
+    BobbaStore *b = &bobbas;
+    if (b->spawned >= b->capacity) return -1;
+
+    int i = b->spawned++;
+    b->entity_id[i] = next_entity_id++;
+    b->rng[i] = (uint32_t)rand() | 1;  // xorshift state must be nonzero
+    b->spawn_x[i] = x;
+    b->spawn_y[i] = y;
+    b->spawn_z[i] = z;
+    bobba_reset(i);
+
+    slot_index_put(&bobba_id_index, b->entity_id[i], i);
+    bobba_set_live(i);
+    return i;
+}
+
+// Initialize a Bobba at a position
+void spawn_bobba(float x, float y, float z) {
+    int i = add_bobba(x, y, z);
+    if (i < 0) return;
+
+    LOG(LOG_INFO, "Spawned Bobba %u at (%.1f, %.1f, %.1f)\n", bobbas.entity_id[i], x, y, z);
+}
+
+// Scatter count Bobbas at random positions around the origin
+void spawn_bobba_population(int count) {
+    int spawned = 0;
+    for (int n = 0; n < count; n++) {
+        float x = ((float)rand() / RAND_MAX - 0.5f) * BOBBA_SPAWN_SPREAD;
+        float z = ((float)rand() / RAND_MAX - 0.5f) * BOBBA_SPAWN_SPREAD;
+        if (add_bobba(x, 0.0f, z) < 0) break;
+        spawned++;
+    }
+
+    LOG(LOG_INFO, "Spawned %d more Bobbas within %.0fm of the origin\n", spawned, BOBBA_SPAWN_SPREAD / 2);
+}
+
+// Calculate distance between two 3D points
+float distance_3d(float x1, float y1, float z1, float x2, float y2, float z2) {
+    float dx = x2 - x1;
+    float dy = y2 - y1;
+    float dz = z2 - z1;
+    return sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+typedef struct {
+    Player *player;
+    float dist;
+} NearestPlayer;
+
+static void visit_nearest_player(Player *player, float dist, void *ctx) {
+    NearestPlayer *nearest = (NearestPlayer*)ctx;
+    if (dist < nearest->dist) {
+        nearest->dist = dist;
+        nearest->player = player;
+    }
+}
+
+// Find nearest player within max_radius of a position (NULL if none)
+Player* find_nearest_player(float x, float y, float z, float max_radius, float *out_distance) {
+    NearestPlayer nearest = { NULL, 999999.0f };
+    query_players_in_radius(x, y, z, max_radius, visit_nearest_player, &nearest);
+
+    if (out_distance) *out_distance = nearest.dist;
+    return nearest.player;
+}
+
+// Stunned and attacking Bobbas stay put until their state timer fires.
+// Attacks land inside their hit window; any hit is queued on job. Returns 1
+// if the Bobba is held in place for this tick.
+int bobba_update_held(int i, BobbaJob *job) {
+    BobbaStore *b = &bobbas;
+
+    if (b->state[i] == BOBBA_STUNNED) {
+        return 1;
+    }
+
+    if (b->state[i] == BOBBA_ATTACKING) {
+        // Calculate attack progress (0.0 to 1.0)
+        float attack_progress = 1.0f - timer_remaining(bobba_state_timers + i) / BOBBA_ATTACK_DURATION;
+
+        // Check if we're in the hit window and haven't hit yet
+        if (!b->has_hit_this_attack[i] &&
+            attack_progress >= BOBBA_HIT_WINDOW_START &&
+            attack_progress <= BOBBA_HIT_WINDOW_END &&
+            b->target_player_id[i] != 0) {
+
+            // Check if target is still in range
+            Player *target = find_player_by_id(b->target_player_id[i]);
+            if (target && target->active) {
+                float dist = distance_3d(b->pos_x[i], b->pos_y[i], b->pos_z[i],
+                                         target->data.pos_x, target->data.pos_y, target->data.pos_z);
+
+                if (dist <= BOBBA_ATTACK_DISTANCE * 2.0f) {  // Slightly larger hit range
+                    // Calculate knockback direction (from Bobba to player)
+                    float dx = target->data.pos_x - b->pos_x[i];
+                    float dy = 0.3f;  // Slight upward component
+                    float dz = target->data.pos_z - b->pos_z[i];
+                    float len = sqrt(dx*dx + dz*dz);
+                    if (len > 0.01f) {
+                        dx /= len;
+                        dz /= len;
+                    }
+
+                    // Mark as hit and queue damage
+                    b->has_hit_this_attack[i] = 1;
+                    PendingHit *hit = &bobba_hits[job->begin + job->hit_count++];
+                    hit->target_player_id = b->target_player_id[i];
+                    hit->attacker_entity_id = b->entity_id[i];
+                    hit->damage = BOBBA_ATTACK_DAMAGE;
+                    hit->knockback_x = dx * BOBBA_KNOCKBACK_FORCE;
+                    hit->knockback_y = dy * BOBBA_KNOCKBACK_FORCE;
+                    hit->knockback_z = dz * BOBBA_KNOCKBACK_FORCE;
+                }
+            }
+        }
+        return 1;
+    }
+
+    return 0;
+
+}
+
+// Pick the AI level of detail for a Bobba that just thought, given its
+// nearest player within BOBBA_LOSE_RADIUS (ignored while it is busy with one)
+static inline void bobba_update_lod(int i, float nearest_dist) {
+    BobbaStore *b = &bobbas;
+
+    if (b->target_player_id[i] != 0 || b->state[i] != BOBBA_ROAMING ||
+        nearest_dist <= BOBBA_LOSE_RADIUS) {
+        b->lod_tier[i] = AI_LOD_NEAR;
+        b->lod_wait[i] = 0;
+    } else if (players_possibly_near(b->pos_x[i], b->pos_z[i])) {
+        b->lod_tier[i] = AI_LOD_MID;
+        b->lod_wait[i] = ai_lod_period(AI_LOD_MID_RATE) - 1;
+    } else {
+        b->lod_tier[i] = AI_LOD_FAR;
+        b->lod_wait[i] = ai_lod_period(AI_LOD_FAR_RATE) - 1;
+    }
+}
+
+// Decide this step's target and state, and queue movement for the move
+// kernel. Attacks started here get their timer once job is done.
+void bobba_plan(int i, BobbaJob *job) {
+    BobbaStore *b = &bobbas;
+
+    // Target distance was filled in by the distance kernel
+    float dist_to_target = 999999.0f;
+    float nearest_dist = 999999.0f;
+    Player *target = NULL;
+
+    if (b->target_slot[i] >= 0) {
+        target = &players[b->target_slot[i]];
+        dist_to_target = b->target_dist[i];
+        // Lose target if too far
+        if (dist_to_target > BOBBA_LOSE_RADIUS) {
+            b->target_player_id[i] = 0;
+            target = NULL;
+            b->state[i] = BOBBA_ROAMING;
+            bobba_pick_roam_direction(i);
+        }
+    }
+
+    // Look for new target if none. The search reaches out to the lose radius
+    // so the same query also picks the level of detail.
+    if (b->target_player_id[i] == 0) {
+        Player *nearest = find_nearest_player(b->pos_x[i], b->pos_y[i], b->pos_z[i],
+                                              BOBBA_LOSE_RADIUS, &dist_to_target);
+        nearest_dist = dist_to_target;
+        if (nearest && dist_to_target <= BOBBA_DETECTION_RADIUS) {
+            b->target_player_id[i] = nearest->player_id;
+            target = nearest;
+            b->state[i] = BOBBA_CHASING;
+        }
+    }
+
+    // State machine
+    switch (b->state[i]) {
+        case BOBBA_ROAMING:
+            // Move in roam direction
+            b->move_kind[i] = BOBBA_MOVE_ROAM;
+            b->move_dx[i] = b->roam_dir_x[i];
+            b->move_dz[i] = b->roam_dir_z[i];
+            b->move_step[i] = BOBBA_ROAM_SPEED * b->ai_delta[i];
+            break;
+
+        case BOBBA_CHASING:
+            if (!target) {
+                b->state[i] = BOBBA_ROAMING;
+                break;
+            }
+
+            // Attack if close enough
+            if (dist_to_target <= BOBBA_ATTACK_DISTANCE) {
+                b->state[i] = BOBBA_ATTACKING;
+                b->has_hit_this_attack[i] = 0;  // Reset hit flag for new attack
+                bobba_attack_starts[job->begin + job->attack_count++] = i;
+                break;
+            }
+
+            // Move toward target
+            b->move_kind[i] = BOBBA_MOVE_CHASE;
+            b->move_dx[i] = target->data.pos_x - b->pos_x[i];
+            b->move_dz[i] = target->data.pos_z - b->pos_z[i];
+            b->move_step[i] = BOBBA_CHASE_SPEED * b->ai_delta[i];
+            break;
+
+        case BOBBA_ATTACKING:
+            // Handled by bobba_update_held
+            break;
+
+        case BOBBA_IDLE:
+            // Do nothing, wait for player
+            break;
+
+        case BOBBA_STUNNED:
+            // Handled by bobba_update_held
+            break;
+    }
+
+    bobba_update_lod(i, nearest_dist);
+}
+
+// Face the way the move kernel moved
+void bobba_finish_move(int i) {
+    BobbaStore *b = &bobbas;
+
+    if (b->move_kind[i] == BOBBA_MOVE_ROAM) {
+        // Face roam direction
+        b->rot_y[i] = b->roam_rot[i];
+    } else if (b->move_kind[i] == BOBBA_MOVE_CHASE && (b->face_x[i] != 0 || b->face_z[i] != 0)) {
+        b->rot_y[i] = atan2f(b->face_x[i], b->face_z[i]);
+    }
+}
+
+// Run the AI for one job's slot range. Branchy per-Bobba decisions run
+// over the live slots due a step this tick; distances and movement run as
+// kernels over the whole range, where lanes that aren't taking part have a
+// zero step.
+static void run_bobba_job(void *ctx, int job_index) {
+    BobbaStore *b = &bobbas;
+    BobbaJob *job = &bobba_jobs[job_index];
+    float delta = *(const float*)ctx;
+    int begin = job->begin;
+    int count = job->end - job->begin;
+    int32_t *thinking = b->thinking + begin;  // This job's share of the scratch list
+
+    job->hit_count = 0;
+    job->attack_count = 0;
+
+    // Timers, and gather target positions for the distance kernel
+    int thinking_count = 0;
+    for (int i = begin; i < job->end; i++) {
+        b->move_kind[i] = BOBBA_MOVE_NONE;
+        b->move_step[i] = 0;
+        if (!bobba_active(i)) continue;
+
+        // Level of detail: skipped updates add up into the next step's delta
+        b->lod_elapsed[i] += delta;
+        if (b->lod_wait[i] > 0) {
+            b->lod_wait[i]--;
+            continue;
+        }
+        b->ai_delta[i] = b->lod_elapsed[i];
+        b->lod_elapsed[i] = 0;
+
+        if (bobba_update_held(i, job)) {
+            b->lod_tier[i] = AI_LOD_NEAR;  // Busy with a player; lod_wait stays 0
+            continue;
+        }
+
+        thinking[thinking_count++] = i;
+        b->target_slot[i] = -1;
+        if (b->target_player_id[i] != 0) {
+            Player *target = find_player_by_id(b->target_player_id[i]);
+            if (target && target->active) {
+                b->target_slot[i] = target - players;
+                b->target_x[i] = target->data.pos_x;
+                b->target_y[i] = target->data.pos_y;
+                b->target_z[i] = target->data.pos_z;
+            } else {
+                b->target_player_id[i] = 0;
+            }
+        }
+    }
+
+    bobba_target_distance(count, b->pos_x + begin, b->pos_y + begin, b->pos_z + begin,
+                          b->target_x + begin, b->target_y + begin, b->target_z + begin,
+                          b->target_dist + begin);
+
+    for (int n = 0; n < thinking_count; n++) {
+        bobba_plan(thinking[n], job);
+    }
+
+    bobba_move(count, b->move_step + begin, b->move_dx + begin, b->move_dz + begin,
+               b->pos_x + begin, b->pos_z + begin, b->face_x + begin, b->face_z + begin);
+
+    for (int n = 0; n < thinking_count; n++) {
+        bobba_finish_move(thinking[n]);
+    }
+}
+
+// Split the Bobba slots into jobs and start them on the job system. Must be
+// followed by end_bobba_update; the caller may run other AI in between.
+void begin_bobba_update(float delta) {
+    BobbaStore *b = &bobbas;
+    bobba_job_count = 0;
+
+    // TEST_MULTIPLAYER mode: skip AI, just idle in place
+    if (test_multiplayer) {
+        for (int n = 0; n < b->live_count; n++) {
+            b->state[b->live[n]] = BOBBA_IDLE;
+        }
+        return;
+    }
+
+    int per_job = (b->spawned + JOB_MAX_BATCH - 1) / JOB_MAX_BATCH;
+    if (per_job < BOBBA_JOB_MIN_SLOTS) per_job = BOBBA_JOB_MIN_SLOTS;
+
+    for (int begin = 0; begin < b->spawned; begin += per_job) {
+        BobbaJob *job = &bobba_jobs[bobba_job_count++];
+        job->begin = begin;
+        job->end = (begin + per_job < b->spawned) ? begin + per_job : b->spawned;
+    }
+
+    bobba_tick_delta = delta;
+    job_batch_begin(run_bobba_job, &bobba_tick_delta, bobba_job_count);
+}
+
+// Finish the Bobba jobs, then arm timers for the attacks they started and
+// send their hits, in slot order so the outcome doesn't depend on which
+// thread ran what
+void end_bobba_update(void) {
+    if (bobba_job_count == 0) return;
+    job_batch_wait();
+
+    for (int j = 0; j < bobba_job_count; j++) {
+        const BobbaJob *job = &bobba_jobs[j];
+        for (int a = 0; a < job->attack_count; a++) {
+            timer_schedule(bobba_state_timers + bobba_attack_starts[job->begin + a],
+                           BOBBA_ATTACK_DURATION);
+        }
+        for (int h = 0; h < job->hit_count; h++) {
+            const PendingHit *hit = &bobba_hits[job->begin + h];
+            send_player_damage(hit->target_player_id, hit->damage, hit->attacker_entity_id,
+                               hit->knockback_x, hit->knockback_y, hit->knockback_z);
+        }
+    }
+}
+
+// Respawn all Bobbas (reset health, position, state)
+void respawn_all_bobbas() {
+
+    // Every slot handed out so far comes back, including dead ones
+    for (int i = 0; i < bobbas.spawned; i++) {
+        bobba_reset(i);
+        bobba_set_live(i);
+    }
+
+    LOG(LOG_INFO, "Respawned %d Bobbas at their spawn points\n", bobbas.spawned);
+
+}
+
+// Reset all players' health and respawn positions
+void respawn_all_players() {
+
+    for (int i = 0; i < max_players; i++) {
+        if (players[i].active) {
+            // Reset health
+            players[i].data.health = 100.0f;
+            players[i].data.state = STATE_IDLE;
+
+            // Generate new spawn position
+            generate_spawn_position(&players[i].data.pos_x,
+                                    &players[i].data.pos_y,
+                                    &players[i].data.pos_z);
+
+            LOG(LOG_INFO, "Respawned player %u at (%.1f, %.1f, %.1f)\n",
+                          players[i].player_id,
+                          players[i].data.pos_x, players[i].data.pos_y, players[i].data.pos_z);
+        }
+    }
+
+}
+
+// Handle game restart request - broadcast to all players and respawn entities
+void handle_game_restart(uint32_t reason, uint32_t requester_id) {
+    LOG(LOG_INFO, "=== GAME RESTART ===\n");
+    LOG(LOG_INFO, "Requested by player %u (reason: %u)\n", requester_id, reason);
+
+    // Respawn all entities
+    respawn_all_bobbas();
+    respawn_all_players();
+
+    // Build restart packet to broadcast
+    GameRestartPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.header.type = PKT_GAME_RESTART;
+    packet.header.sequence = ++state_sequence;
+    packet.header.player_id = 0;  // From server
+    packet.reason = reason;
+
+    // Broadcast to all players. Reliable sends restage their own copy, so
+    // the shared one goes out first.
+    const void *staged = sendq_stage(&packet, sizeof(packet));
+    int player_count = 0;
+    int unreliable_count = 0;
+    for (int i = 0; i < max_players; i++) {
+        if (players[i].active && !(players[i].caps & CAP_RELIABLE)) {
+            sendq_push_player(&players[i], staged, sizeof(packet));
+            player_count++;
+        }
+    }
+    for (int i = 0; i < max_players; i++) {
+        if (players[i].active && (players[i].caps & CAP_RELIABLE)) {
+            if (reliable_send(&players[i], &packet, sizeof(packet)) < 0) {
+                sendq_send_player(&players[i], &packet, sizeof(packet));
+                unreliable_count++;
+            }
+            player_count++;
+        }
+    }
+
+    LOG(LOG_INFO, "Game restart broadcast sent to %d players (%d outside their reliable channel)\n",
+                  player_count, unreliable_count);
+
+    // Immediately broadcast updated entity state so clients see respawned entities
+    broadcast_entity_state();
+    broadcast_world_state();
+
+    LOG(LOG_INFO, "=== RESTART COMPLETE ===\n");
+}
+
+// Wire form of every live entity, rebuilt each entity broadcast
+static EntityData *entity_data;
+static int entity_data_capacity;
+
+// Scratch space for one encoding's datagrams (see init_entity_state)
+static uint8_t *entity_chunk_buf;
+static uint16_t *entity_chunk_lens;  // Two rows of entity_max_chunks: legacy, quantized
+static int entity_max_chunks;
+
+// Allocate entity broadcast buffers for every Bobba slot plus the Dragons
+int init_entity_state(void) {
+    entity_data_capacity = bobbas.capacity + MAX_DRAGONS;
+
+    // Quantized state is split to fit MAX_DATAGRAM_BYTES; the legacy packet
+    // is always one (possibly larger) datagram
+    int per_chunk = (MAX_DATAGRAM_BYTES - sizeof(EntityStateQHeader)) / ENTITY_Q_ENTRY_MAX_BYTES;
+    entity_max_chunks = (entity_data_capacity + per_chunk - 1) / per_chunk;
+
+    size_t buf_size = (size_t)entity_max_chunks * MAX_DATAGRAM_BYTES;
+    if (buf_size < sizeof(EntityStatePacket)) buf_size = sizeof(EntityStatePacket);
+    entity_data = calloc(entity_data_capacity, sizeof(EntityData));
+    entity_chunk_buf = malloc(buf_size);
+    entity_chunk_lens = malloc(2 * entity_max_chunks * sizeof(uint16_t));
+    return (entity_data && entity_chunk_buf && entity_chunk_lens) ? 0 : -1;
+}
+
+// Fill entity_data from the live Dragons and Bobbas. Returns the count.
+// Dragons go first so a legacy packet cut to MAX_ENTITIES keeps them.
+int collect_entity_data(void) {
+    int idx = 0;
+
+    // Add Dragons
+    for (int i = 0; i < MAX_DRAGONS; i++) {
+        if (dragons[i].active) {
+            EntityData *e = &entity_data[idx++];
+            e->entity_type = ENTITY_DRAGON;
+            e->entity_id = dragons[i].entity_id;
+            e->pos_x = dragons[i].pos_x;
+            e->pos_y = dragons[i].pos_y;
+            e->pos_z = dragons[i].pos_z;
+            e->rot_y = dragons[i].rot_y;
+            e->state = dragons[i].state;
+            e->health = dragons[i].health;
+            // Extra data for dragon: lap_count and patrol_angle
+            e->extra1 = dragons[i].laps_completed;
+            e->extra2 = dragons[i].patrol_angle;
+        }
+    }
+
+    // Add Bobbas
+    for (int n = 0; n < bobbas.live_count; n++) {
+        int i = bobbas.live[n];
+        EntityData *e = &entity_data[idx++];
+        memset(e, 0, sizeof(*e));
+        e->entity_type = ENTITY_BOBBA;
+        e->entity_id = bobbas.entity_id[i];
+        e->pos_x = bobbas.pos_x[i];
+        e->pos_y = bobbas.pos_y[i];
+        e->pos_z = bobbas.pos_z[i];
+        e->rot_y = bobbas.rot_y[i];
+        e->state = bobbas.state[i];
+        e->health = bobbas.health[i];
+    }
+
+    return idx;
+}
+
+// Fill a legacy entity state packet with the first MAX_ENTITIES entries of
+// entity_data. Returns the datagram length.
+size_t build_entity_state_packet(uint8_t *out, int count, uint32_t sequence) {
+    EntityStatePacket *packet = (EntityStatePacket*)out;
+    int n = count;
+    if (n > MAX_ENTITIES) n = MAX_ENTITIES;
+
+    packet->header.type = PKT_ENTITY_STATE;
+    packet->header.sequence = sequence;
+    packet->header.player_id = 0;  // From server
+    packet->entity_count = n;
+    memcpy(packet->entities, entity_data, n * sizeof(EntityData));
+
+    return offsetof(EntityStatePacket, entities) + n * sizeof(EntityData);
+}
+
+// Bit-pack entity_data from first for CAP_QUANTIZED clients, filling at
+// most MAX_DATAGRAM_BYTES, and set *next past the entries written.
+// Returns the datagram length.
+size_t encode_entity_state_q(uint8_t *out, int count, uint32_t sequence,
+                             int first, int *next) {
+    EntityStateQHeader *hdr = (EntityStateQHeader*)out;
+    hdr->header.type = PKT_ENTITY_STATE_Q;
+    hdr->header.sequence = sequence;
+    hdr->header.player_id = 0;  // From server
+
+    BitWriter w;
+    bw_init(&w, out + sizeof(EntityStateQHeader), MAX_DATAGRAM_BYTES - sizeof(EntityStateQHeader));
+
+    int i = first;
+    while (i < count && i - first < ENTITY_Q_CHUNK_MAX_ENTRIES &&
+           bw_length(&w) + ENTITY_Q_ENTRY_MAX_BYTES <= w.capacity) {
+        const EntityData *e = &entity_data[i++];
+        bw_write(&w, e->entity_type, 2);
+        bw_write_varuint(&w, e->entity_id);
+        bw_write(&w, quantize_range(e->pos_x, QUANT_POS_XZ_MIN, QUANT_POS_XZ_MAX, QUANT_POS_XZ_BITS),
+                 QUANT_POS_XZ_BITS);
+        bw_write(&w, quantize_range(e->pos_y, QUANT_POS_Y_MIN, QUANT_POS_Y_MAX, QUANT_POS_Y_BITS),
+                 QUANT_POS_Y_BITS);
+        bw_write(&w, quantize_range(e->pos_z, QUANT_POS_XZ_MIN, QUANT_POS_XZ_MAX, QUANT_POS_XZ_BITS),
+                 QUANT_POS_XZ_BITS);
+        bw_write(&w, quantize_angle(e->rot_y, QUANT_ROT_BITS), QUANT_ROT_BITS);
+        bw_write(&w, e->state, 3);
+        bw_write(&w, quantize_uint(e->health, QUANT_ENTITY_HEALTH_BITS), QUANT_ENTITY_HEALTH_BITS);
+        if (e->entity_type == ENTITY_DRAGON) {
+            bw_write_varuint(&w, e->extra1);
+            bw_write(&w, quantize_angle(e->extra2, QUANT_ROT_BITS), QUANT_ROT_BITS);
+        }
+    }
+
+    hdr->entity_count = i - first;
+    *next = i;
+    return sizeof(EntityStateQHeader) + bw_finish(&w);
+}
+
+// Encode entity_data in one form (the quantized one as consecutive
+// datagrams) and stage it
+void stage_entity_chunks(StagedChunks *chunks, int quantized, int count, uint32_t sequence) {
+    size_t len = 0;
+    int n = 0;
+    int next = 0;
+
+    if (!quantized) {
+        len = build_entity_state_packet(entity_chunk_buf, count, sequence);
+        chunks->chunk_lens[n++] = len;
+    } else {
+        while (next < count) {
+            size_t chunk_len = encode_entity_state_q(entity_chunk_buf + len, count, sequence,
+                                                     next, &next);
+            chunks->chunk_lens[n++] = chunk_len;
+            len += chunk_len;
+        }
+    }
+
+    chunks->chunk_count = n;
+    staged_set(&chunks->payload, entity_chunk_buf, len);
+}
+
+// Broadcast entity state to all players
+void broadcast_entity_state() {
+
+    int entity_count = collect_entity_data();
+    if (entity_count == 0) {
+            return;
+    }
+    uint32_t sequence = ++state_sequence;
+
+    // Serialize each encoding once, then fan out the same datagrams to every
+    // recipient. Each form is only built if someone needs it.
+    StagedChunks legacy = { { 0 }, 0, entity_chunk_lens };
+    StagedChunks quantized = { { 0 }, 0, entity_chunk_lens + entity_max_chunks };
+
+    // Send to all active players
+    for (int i = 0; i < max_players; i++) {
+        if (!players[i].active) continue;
+
+        StagedChunks *form = (players[i].caps & CAP_QUANTIZED) ? &quantized : &legacy;
+        if (!staged_valid(&form->payload)) {
+            stage_entity_chunks(form, form == &quantized, entity_count, sequence);
+        }
+        sendq_push_chunks_player(form, &players[i]);
+    }
+
+    // Also send to all spectators (so they can see entities before joining)
+    for (int i = 0; i < MAX_SPECTATORS; i++) {
+        if (spectators[i].active) {
+            if (!staged_valid(&legacy.payload)) {
+                stage_entity_chunks(&legacy, 0, entity_count, sequence);
+            }
+            sendq_push_chunks(&legacy, &spectators[i].addr);
+        }
+    }
+
+}
+
+// Send damage to a specific player (called when entity attacks player)
+void send_player_damage(uint32_t target_player_id, float damage, uint32_t attacker_entity_id,
+                        float knockback_x, float knockback_y, float knockback_z) {
+
+    Player *target = find_player_by_id(target_player_id);
+    if (target && target->active) {
+        PlayerDamagePacket packet;
+        memset(&packet, 0, sizeof(packet));
+        packet.header.type = PKT_PLAYER_DAMAGE;
+        packet.header.sequence = ++state_sequence;
+        packet.header.player_id = 0;  // From server
+        packet.target_player_id = target_player_id;
+        packet.damage = damage;
+        packet.attacker_entity_id = attacker_entity_id;
+        packet.knockback_x = knockback_x;
+        packet.knockback_y = knockback_y;
+        packet.knockback_z = knockback_z;
+
+        if (!(target->caps & CAP_RELIABLE) || reliable_send(target, &packet, sizeof(packet)) < 0) {
+            sendq_send_player(target, &packet, sizeof(packet));
+        }
+
+        LOG(LOG_DEBUG, "Sent player damage: player %u takes %.1f damage from entity %u\n",
+                       target_player_id, damage, attacker_entity_id);
+    }
+
+}
+
+// Handle entity damage from a player
+void handle_entity_damage_server(uint32_t entity_id, float damage, uint32_t attacker_id) {
+    LOG(LOG_DEBUG, ">>> ENTITY DAMAGE: entity=%u damage=%.1f attacker=%u\n", entity_id, damage, attacker_id);
+
+    int i = slot_index_find(&bobba_id_index, entity_id);
+    if (i >= 0 && bobba_active(i)) {
+        bobbas.health[i] -= damage;
+        bobbas.state[i] = BOBBA_STUNNED;
+        timer_schedule(bobba_state_timers + i, 0.5f);  // Replaces any attack in progress
+        bobbas.lod_tier[i] = AI_LOD_NEAR;  // React from the next update on
+        bobbas.lod_wait[i] = 0;
+
+        // Switch target to attacker
+        bobbas.target_player_id[i] = attacker_id;
+
+        LOG(LOG_DEBUG, "Bobba %u took %.1f damage from player %u (health: %.1f)\n",
+                       entity_id, damage, attacker_id, bobbas.health[i]);
+
+        if (bobbas.health[i] <= 0) {
+            LOG(LOG_INFO, "Bobba %u died! Broadcasting restart to all players.\n", entity_id);
+            bobba_set_dead(i);
+            // Server broadcasts restart - don't wait for client request
+            handle_game_restart(1, 0);  // reason=1 (Bobba died), requester=0 (server)
+        }
+        return;
+    }
+    LOG(LOG_WARN, ">>> Entity %u not found in Bobbas\n", entity_id);
+
+    // Also check dragons
+    for (int i = 0; i < MAX_DRAGONS; i++) {
+        if (dragons[i].active && dragons[i].entity_id == entity_id) {
+            dragons[i].health -= damage;
+            LOG(LOG_DEBUG, "Dragon %u took %.1f damage from player %u (health: %.1f)\n",
+                           entity_id, damage, attacker_id, dragons[i].health);
+
+            if (dragons[i].health <= 0) {
+                LOG(LOG_INFO, "Dragon %u died!\n", entity_id);
+                dragons[i].active = 0;
+            }
+            break;
+        }
+    }
+
+}
+
+// =============================================================================
+// DRAGON AI (Server-authoritative)
+// =============================================================================
+
+static int32_t dragon_timers;      // Wait/attack timer of dragons[i] is dragon_timers + i
+
+// Wait or attack over
+void dragon_state_timer_expired(int i) {
+    ServerDragon *dragon = &dragons[i];
+    if (!dragon->active) return;
+
+    if (dragon->state == DRAGON_WAIT) {
+        dragon->state = DRAGON_TAKING_OFF;
+        LOG(LOG_INFO, "Dragon %u taking off!\n", dragon->entity_id);
+    } else if (dragon->state == DRAGON_ATTACKING) {
+        // Check if player still in range
+        float dist = 999999.0f;
+        Player *target = find_player_by_id(dragon->target_player_id);
+        if (target && target->active) {
+            dist = distance_3d(dragon->pos_x, dragon->pos_y, dragon->pos_z,
+                               target->data.pos_x, target->data.pos_y, target->data.pos_z);
+        }
+
+        if (dist < DRAGON_ATTACK_RANGE) {
+            // Attack again
+            timer_schedule(dragon_timers + i, 2.0f);
+        } else {
+            // Return to wait state
+            dragon->state = DRAGON_WAIT;
+            timer_schedule(dragon_timers + i, DRAGON_WAIT_TIME);
+        }
+    }
+}
+
+int init_dragon_timers(void) {
+    dragon_timers = timer_create_range(dragon_state_timer_expired, MAX_DRAGONS);
+    return dragon_timers;
+}
+
+// Initialize a Dragon
+void spawn_dragon(float center_x, float center_z) {
+
+    for (int i = 0; i < MAX_DRAGONS; i++) {
+        if (!dragons[i].active) {
+            memset(&dragons[i], 0, sizeof(ServerDragon));
+            dragons[i].entity_id = next_entity_id++;
+            dragons[i].patrol_center_x = center_x;
+            dragons[i].patrol_center_z = center_z;
+            dragons[i].patrol_angle = 0.0f;
+
+            // Start at patrol position
+            dragons[i].pos_x = center_x + DRAGON_PATROL_RADIUS;
+            dragons[i].pos_y = DRAGON_PATROL_HEIGHT;
+            dragons[i].pos_z = center_z;
+            dragons[i].rot_y = 0;
+            dragons[i].state = DRAGON_PATROL;
+            dragons[i].health = 500.0f;
+            dragons[i].active = 1;
+            dragons[i].laps_completed = 0;
+
+            LOG(LOG_INFO, "Spawned Dragon %u at (%.1f, %.1f, %.1f), patrol center (%.1f, %.1f)\n",
+                          dragons[i].entity_id, dragons[i].pos_x, dragons[i].pos_y, dragons[i].pos_z,
+                          center_x, center_z);
+            break;
+        }
+    }
+
+}
+
+// Get dragon patrol position based on angle
+void get_dragon_patrol_position(ServerDragon *dragon, float *out_x, float *out_y, float *out_z) {
+    // Oval patrol path with slight height variation
+    *out_x = dragon->patrol_center_x + cos(dragon->patrol_angle) * DRAGON_PATROL_RADIUS;
+    *out_z = dragon->patrol_center_z + sin(dragon->patrol_angle) * DRAGON_PATROL_RADIUS * 0.7f;  // Oval
+    *out_y = DRAGON_PATROL_HEIGHT + sin(dragon->patrol_angle * 2) * 5.0f;  // Gentle undulation
+}
+
+// Update a single Dragon's AI
+void update_dragon_ai(ServerDragon *dragon, float delta) {
+    if (!dragon->active) return;
+
+    // TEST_MULTIPLAYER mode: skip AI, just patrol (no attacks)
+    if (test_multiplayer) {
+        dragon->state = DRAGON_PATROL;
+        // Still update patrol position for visual interest
+        dragon->patrol_angle += DRAGON_PATROL_SPEED * delta / DRAGON_PATROL_RADIUS;
+        if (dragon->patrol_angle > 2.0f * M_PI) {
+            dragon->patrol_angle -= 2.0f * M_PI;
+        }
+        float target_x, target_y, target_z;
+        get_dragon_patrol_position(dragon, &target_x, &target_y, &target_z);
+        dragon->pos_x = target_x;
+        dragon->pos_y = target_y;
+        dragon->pos_z = target_z;
+        return;
+    }
+
+    switch (dragon->state) {
+        case DRAGON_PATROL: {
+            // Move along circular patrol path
+            dragon->patrol_angle += (DRAGON_PATROL_SPEED / DRAGON_PATROL_RADIUS) * delta;
+
+            // Check for lap completion
+            if (dragon->patrol_angle >= 2.0f * M_PI) {
+                dragon->patrol_angle -= 2.0f * M_PI;
+                dragon->laps_completed++;
+                LOG(LOG_INFO, "Dragon %u completed lap %d\n", dragon->entity_id, dragon->laps_completed);
+
+                // Land after specified laps
+                if (dragon->laps_completed >= DRAGON_LAPS_BEFORE_LANDING) {
+                    dragon->laps_completed = 0;
+                    dragon->state = DRAGON_FLYING_TO_LAND;
+                    LOG(LOG_INFO, "Dragon %u flying to landing spot\n", dragon->entity_id);
+                }
+            }
+
+            // Move towards patrol position
+            float target_x, target_y, target_z;
+            get_dragon_patrol_position(dragon, &target_x, &target_y, &target_z);
+
+            float dx = target_x - dragon->pos_x;
+            float dy = target_y - dragon->pos_y;
+            float dz = target_z - dragon->pos_z;
+            float len = sqrt(dx*dx + dy*dy + dz*dz);
+
+            if (len > 0.1f) {
+                dx /= len; dy /= len; dz /= len;
+                dragon->pos_x += dx * DRAGON_PATROL_SPEED * delta;
+                dragon->pos_y += dy * DRAGON_PATROL_SPEED * delta;
+                dragon->pos_z += dz * DRAGON_PATROL_SPEED * delta;
+                dragon->rot_y = atan2(dx, dz);
+            }
+            break;
+        }
+
+        case DRAGON_FLYING_TO_LAND: {
+            // Fly towards landing spot (approach from above)
+            float approach_x = DRAGON_LANDING_SPOT_X;
+            float approach_y = DRAGON_LANDING_SPOT_Y + 20.0f;  // Approach from above
+            float approach_z = DRAGON_LANDING_SPOT_Z;
+
+            float dx = approach_x - dragon->pos_x;
+            float dy = approach_y - dragon->pos_y;
             float dz = approach_z - dragon->pos_z;
             float dist = sqrt(dx*dx + dy*dy + dz*dz);
 
-            if (dist > 0.1f) {
-                dx /= dist; dy /= dist; dz /= dist;
-                dragon->pos_x += dx * DRAGON_PATROL_SPEED * delta;
-                dragon->pos_y += dy * DRAGON_PATROL_SPEED * delta;
-                dragon->pos_z += dz * DRAGON_PATROL_SPEED * delta;
-                dragon->rot_y = atan2(dx, dz);
-            }
+            if (dist > 0.1f) {
+                dx /= dist; dy /= dist; dz /= dist;
+                dragon->pos_x += dx * DRAGON_PATROL_SPEED * delta;
+                dragon->pos_y += dy * DRAGON_PATROL_SPEED * delta;
+                dragon->pos_z += dz * DRAGON_PATROL_SPEED * delta;
+                dragon->rot_y = atan2(dx, dz);
+            }
+
+            // Start landing descent when close
+            if (dist < 10.0f) {
+                dragon->state = DRAGON_LANDING;
+                LOG(LOG_INFO, "Dragon %u starting landing descent\n", dragon->entity_id);
+            }
+            break;
+        }
+
+        case DRAGON_LANDING: {
+            // Descend towards landing spot
+            float dx = DRAGON_LANDING_SPOT_X - dragon->pos_x;
+            float dy = DRAGON_LANDING_SPOT_Y - dragon->pos_y;
+            float dz = DRAGON_LANDING_SPOT_Z - dragon->pos_z;
+            float dist = sqrt(dx*dx + dy*dy + dz*dz);
+
+            // Slow down as we approach
+            float speed = fminf(dist * 0.5f, DRAGON_PATROL_SPEED);
+            speed = fmaxf(speed, 2.0f);
+
+            if (dist > 0.1f) {
+                dx /= dist; dy /= dist; dz /= dist;
+                dragon->pos_x += dx * speed * delta;
+                dragon->pos_y += dy * speed * delta;
+                dragon->pos_z += dz * speed * delta;
+            }
+
+            // Check if landed
+            if (dist < 5.0f) {
+                dragon->pos_x = DRAGON_LANDING_SPOT_X;
+                dragon->pos_y = DRAGON_LANDING_SPOT_Y;
+                dragon->pos_z = DRAGON_LANDING_SPOT_Z;
+                dragon->state = DRAGON_WAIT;
+                timer_schedule(dragon_timers + (dragon - dragons), DRAGON_WAIT_TIME);
+                LOG(LOG_INFO, "Dragon %u landed! Waiting for %.1f seconds\n",
+                              dragon->entity_id, DRAGON_WAIT_TIME);
+            }
+            break;
+        }
+
+        case DRAGON_WAIT: {
+            // Check for nearby player to attack (dragon_state_timer_expired
+            // ends the wait)
+            float nearest_dist = 999999.0f;
+            Player *nearest = find_nearest_player(dragon->pos_x, dragon->pos_y, dragon->pos_z,
+                                                  DRAGON_ATTACK_RANGE, &nearest_dist);
+
+            if (nearest && nearest_dist < DRAGON_ATTACK_RANGE) {
+                dragon->state = DRAGON_ATTACKING;
+                timer_schedule(dragon_timers + (dragon - dragons), 2.0f);  // Attack duration
+                dragon->target_player_id = nearest->player_id;
+                LOG(LOG_INFO, "Dragon %u attacking player %u!\n", dragon->entity_id, nearest->player_id);
+            }
+            break;
+        }
+
+        case DRAGON_ATTACKING:
+            // Handled by dragon_state_timer_expired
+            break;
+
+        case DRAGON_TAKING_OFF: {
+            // Rise up
+            dragon->pos_y += 15.0f * delta;
+
+            // Check if high enough to resume patrol
+            if (dragon->pos_y >= DRAGON_PATROL_HEIGHT * 0.8f) {
+                dragon->state = DRAGON_PATROL;
+                dragon->patrol_angle = 0.0f;  // Reset patrol angle
+                LOG(LOG_INFO, "Dragon %u resuming patrol\n", dragon->entity_id);
+            }
+            break;
+        }
+    }
+}
+
+// Update all Dragons
+void update_all_dragons(float delta) {
+    // Note: entities_mutex and players_mutex should already be held
+    for (int i = 0; i < MAX_DRAGONS; i++) {
+        if (dragons[i].active) {
+            update_dragon_ai(&dragons[i], delta);
+        }
+    }
+}
+
+// Update all entity AI. Bobba jobs fan out across the job system while
+// this thread runs the Dragons (which log and only read player state), then
+// helps finish the Bobbas.
+void update_all_entities(float delta) {
+    begin_bobba_update(delta);
+    update_all_dragons(delta);
+    end_bobba_update();
+}
+
+// =============================================================================
+// ANIMATION INTERNING
+// =============================================================================
+
+// Animation names are interned once; player state, snapshots and compact
+// packets carry the small ID instead of the 32-byte string.
+#define ANIM_HASH_SIZE (MAX_ANIMATIONS * 2)  // Power of two, load factor <= 0.5
+
+static char anim_table[MAX_ANIMATIONS][ANIM_NAME_LEN];
+static int anim_count = 1;                  // ID 0 is the empty/unknown name
+static int anim_announced = 1;              // IDs below this were already broadcast
+static uint16_t anim_hash[ANIM_HASH_SIZE];  // name -> ID, linear probing, 0 = empty
+
+// FNV-1a over the name bytes
+static uint32_t anim_name_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Look up an animation name, adding it if new. The name need not be
+// NUL-terminated within its ANIM_NAME_LEN buffer. The table is shared and
+// never shrinks, so a player (owner, NULL for the server) may only add
+// ANIM_MAX_PER_PLAYER names. Returns 0 for an empty name, when the table
+// is full or when the owner has used up its share.
+uint16_t intern_animation(const char *name, Player *owner) {
+    size_t len = strnlen(name, ANIM_NAME_LEN - 1);
+    if (len == 0) return 0;
+
+    uint32_t h = anim_name_hash(name, len) & (ANIM_HASH_SIZE - 1);
+    while (anim_hash[h] != 0) {
+        uint16_t id = anim_hash[h];
+        if (memcmp(anim_table[id], name, len) == 0 && anim_table[id][len] == '\0') {
+            return id;
+        }
+        h = (h + 1) & (ANIM_HASH_SIZE - 1);
+    }
+
+    if (anim_count >= MAX_ANIMATIONS) {
+        static int full_logged = 0;
+        if (!full_logged) {
+            full_logged = 1;
+            LOG(LOG_WARN, "Animation table full (%d names); new animations are sent as ID 0\n",
+                MAX_ANIMATIONS);
+        }
+        return 0;
+    }
+    if (owner && owner->anims_interned >= ANIM_MAX_PER_PLAYER) {
+        if (owner->anims_interned == ANIM_MAX_PER_PLAYER) {
+            owner->anims_interned++;  // Log once
+            LOG(LOG_WARN, "Player %u sent more than %d animation names; ignoring new ones\n",
+                owner->player_id, ANIM_MAX_PER_PLAYER);
+        }
+        return 0;
+    }
+    if (owner) owner->anims_interned++;
+
+    uint16_t id = anim_count++;
+    memcpy(anim_table[id], name, len);
+    anim_table[id][len] = '\0';
+    anim_hash[h] = id;
+
+    LOG(LOG_INFO, "Interned animation '%s' as ID %u\n", anim_table[id], id);
+    return id;
+}
+
+static inline const char* anim_name_of(uint16_t id) {
+    return id < anim_count ? anim_table[id] : "";
+}
+
+// Fill one PKT_ANIM_DICT datagram with entries starting at *first (up to
+// last, exclusive). Advances *first past what fit. Returns the length.
+size_t build_anim_dict_chunk(uint8_t *out, int *first, int last) {
+    AnimDictHeader *hdr = (AnimDictHeader*)out;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->header.type = PKT_ANIM_DICT;
+    hdr->header.sequence = state_sequence;
+    hdr->header.player_id = 0;  // From server
+
+    size_t len = sizeof(AnimDictHeader);
+    while (*first < last && hdr->entry_count < UINT8_MAX) {
+        uint16_t id = (uint16_t)*first;
+        uint8_t name_len = (uint8_t)strlen(anim_table[id]);
+        if (len + 3 + name_len > ANIM_DICT_MAX_BYTES) break;
+
+        memcpy(out + len, &id, 2);
+        out[len + 2] = name_len;
+        memcpy(out + len + 3, anim_table[id], name_len);
+        len += 3 + name_len;
+        hdr->entry_count++;
+        (*first)++;
+    }
+    return len;
+}
+
+// Send the whole table to one client (at join, or when it asks)
+void send_anim_dict(Player *player) {
+    int next = 1;
+    while (next < anim_count) {
+        uint8_t buf[ANIM_DICT_MAX_BYTES];
+        size_t len = build_anim_dict_chunk(buf, &next, anim_count);
+        sendq_send_player(player, buf, len);
+    }
+}
+
+// Broadcast names interned since the last announcement to CAP_ANIM_IDS clients
+void announce_new_animations(void) {
+    while (anim_announced < anim_count) {
+        uint8_t buf[ANIM_DICT_MAX_BYTES];
+        size_t len = build_anim_dict_chunk(buf, &anim_announced, anim_count);
+        const void *staged = sendq_stage(buf, len);
+        for (int i = 0; i < max_players; i++) {
+            if (players[i].active && (players[i].caps & CAP_ANIM_IDS)) {
+                sendq_push_player(&players[i], staged, len);
+            }
+        }
+    }
+}
+
+// =============================================================================
+// SNAPSHOT DELTA COMPRESSION
+// =============================================================================
+
+// A player as recorded in a snapshot: PlayerData minus the name string
+typedef struct {
+    uint32_t player_id;
+    float pos_x, pos_y, pos_z;
+    float rot_y;
+    float health;
+    uint16_t anim_id;
+    uint8_t state;
+    uint8_t combat_mode;
+    uint8_t character_class;
+} SnapshotPlayer;
+
+// One broadcast's worth of player state, sorted by player_id so a delta can
+// be built with a single merge walk against the baseline
+typedef struct {
+    uint32_t seq;              // 0 = empty slot
+    int count;
+    SnapshotPlayer *players;   // max_players entries
+} Snapshot;
+
+// PKT_WORLD_DELTA encoding options (also used as world state variant keys)
+#define WORLD_VARIANT_LEGACY    (1u << 0)  // Full PKT_WORLD_STATE instead of a delta
+#define WORLD_VARIANT_QUANTIZED (1u << 1)
+#define WORLD_VARIANT_ANIM_IDS  (1u << 2)
+
+static Snapshot snapshot_ring[SNAPSHOT_RING_SIZE];
+static uint32_t snapshot_sequence = 0;
+
+// Scratch space for one world state variant's datagrams, sized for the
+// largest roster split into the smallest chunks (see init_world_state)
+static uint8_t *world_chunk_buf;
+static uint16_t *world_chunk_lens;   // WORLD_VARIANT_MAX rows of world_max_chunks
+static int world_max_chunks;
+
+// Look up a snapshot still held in the ring (NULL if evicted or unknown)
+Snapshot* find_snapshot(uint32_t seq) {
+    if (seq == 0) return NULL;
+    Snapshot *snap = &snapshot_ring[seq % SNAPSHOT_RING_SIZE];
+    return snap->seq == seq ? snap : NULL;
+}
+
+// Capture the current player state into the next ring slot
+Snapshot* capture_snapshot(void) {
+    uint32_t seq = ++snapshot_sequence;
+    if (seq == 0) seq = ++snapshot_sequence;  // 0 is reserved for "none"
+
+    Snapshot *snap = &snapshot_ring[seq % SNAPSHOT_RING_SIZE];
+    snap->seq = seq;
+    snap->count = 0;
+
+    for (int i = 0; i < max_players; i++) {
+        if (!players[i].active) continue;
+
+        // Insertion sort by player_id (IDs are mostly ascending already)
+        int j = snap->count++;
+        while (j > 0 && snap->players[j - 1].player_id > players[i].player_id) {
+            snap->players[j] = snap->players[j - 1];
+            j--;
+        }
+
+        const PlayerState *pd = &players[i].data;
+        SnapshotPlayer *sp = &snap->players[j];
+        sp->player_id = players[i].player_id;
+        sp->pos_x = pd->pos_x;
+        sp->pos_y = pd->pos_y;
+        sp->pos_z = pd->pos_z;
+        sp->rot_y = pd->rot_y;
+        sp->health = pd->health;
+        sp->anim_id = players[i].anim_id;
+        sp->state = pd->state;
+        sp->combat_mode = pd->combat_mode;
+        sp->character_class = pd->character_class;
+    }
+
+    return snap;
+}
+
+// A player's fields at wire precision, so deltas only fire on changes the
+// client can actually see
+typedef struct {
+    uint32_t pos_x, pos_y, pos_z;
+    uint32_t rot_y;
+    uint32_t health;
+} QuantizedPlayer;
+
+void quantize_player(const SnapshotPlayer *pd, QuantizedPlayer *q) {
+    q->pos_x = quantize_range(pd->pos_x, QUANT_POS_XZ_MIN, QUANT_POS_XZ_MAX, QUANT_POS_XZ_BITS);
+    q->pos_y = quantize_range(pd->pos_y, QUANT_POS_Y_MIN, QUANT_POS_Y_MAX, QUANT_POS_Y_BITS);
+    q->pos_z = quantize_range(pd->pos_z, QUANT_POS_XZ_MIN, QUANT_POS_XZ_MAX, QUANT_POS_XZ_BITS);
+    q->rot_y = quantize_angle(pd->rot_y, QUANT_ROT_BITS);
+    q->health = quantize_uint(pd->health, QUANT_PLAYER_HEALTH_BITS);
+}
+
+// Which fields of cur differ from base (at wire precision)
+uint8_t delta_field_mask(const SnapshotPlayer *cur, const SnapshotPlayer *base, int quantized) {
+    uint8_t mask = 0;
+
+    if (quantized) {
+        QuantizedPlayer qc, qb;
+        quantize_player(cur, &qc);
+        quantize_player(base, &qb);
+        if (qc.pos_x != qb.pos_x || qc.pos_y != qb.pos_y || qc.pos_z != qb.pos_z)
+            mask |= DELTA_FIELD_POS;
+        if (qc.rot_y != qb.rot_y)
+            mask |= DELTA_FIELD_ROT;
+        if (qc.health != qb.health)
+            mask |= DELTA_FIELD_HEALTH;
+    } else {
+        if (cur->pos_x != base->pos_x || cur->pos_y != base->pos_y || cur->pos_z != base->pos_z)
+            mask |= DELTA_FIELD_POS;
+        if (cur->rot_y != base->rot_y)
+            mask |= DELTA_FIELD_ROT;
+        if (cur->health != base->health)
+            mask |= DELTA_FIELD_HEALTH;
+    }
+
+    if (cur->state != base->state || cur->combat_mode != base->combat_mode ||
+        cur->character_class != base->character_class)
+        mask |= DELTA_FIELD_STATE;
+    if (cur->anim_id != base->anim_id)
+        mask |= DELTA_FIELD_ANIM;
+    return mask;
+}
+
+// Write the fields named by mask, encoded per WORLD_VARIANT_* flags
+void write_player_fields(BitWriter *w, const SnapshotPlayer *pd, uint8_t mask, uint32_t flags) {
+    int quantized = (flags & WORLD_VARIANT_QUANTIZED) != 0;
+    QuantizedPlayer q;
+    if (quantized) quantize_player(pd, &q);
+
+    if (mask & DELTA_FIELD_POS) {
+        if (quantized) {
+            bw_write(w, q.pos_x, QUANT_POS_XZ_BITS);
+            bw_write(w, q.pos_y, QUANT_POS_Y_BITS);
+            bw_write(w, q.pos_z, QUANT_POS_XZ_BITS);
+        } else {
+            bw_write_f32(w, pd->pos_x);
+            bw_write_f32(w, pd->pos_y);
+            bw_write_f32(w, pd->pos_z);
+        }
+    }
+    if (mask & DELTA_FIELD_ROT) {
+        if (quantized) bw_write(w, q.rot_y, QUANT_ROT_BITS);
+        else bw_write_f32(w, pd->rot_y);
+    }
+    if (mask & DELTA_FIELD_STATE) {
+        if (quantized) {
+            bw_write(w, pd->state, QUANT_STATE_BITS);
+            bw_write(w, pd->combat_mode, QUANT_COMBAT_BITS);
+            bw_write(w, pd->character_class, QUANT_CLASS_BITS);
+        } else {
+            bw_write(w, pd->state, 8);
+            bw_write(w, pd->combat_mode, 8);
+            bw_write(w, pd->character_class, 8);
+        }
+    }
+    if (mask & DELTA_FIELD_HEALTH) {
+        if (quantized) bw_write(w, q.health, QUANT_PLAYER_HEALTH_BITS);
+        else bw_write_f32(w, pd->health);
+    }
+    if (mask & DELTA_FIELD_ANIM) {
+        if (flags & WORLD_VARIANT_ANIM_IDS) {
+            bw_write_varuint(w, pd->anim_id);
+        } else {
+            const char *name = anim_name_of(pd->anim_id);
+            size_t len = strlen(name);
+            bw_write(w, (uint32_t)len, 5);
+            bw_write_bytes(w, name, len);
+        }
+    }
+}
+
+// Position of the first entry with player_id >= id
+int snapshot_lower_bound(const Snapshot *snap, uint32_t id) {
+    int lo = 0, hi = snap->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (snap->players[mid].player_id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Encode cur relative to base (NULL = full snapshot) into one PKT_WORLD_DELTA
+// chunk starting at entry first, filling at most MAX_DATAGRAM_BYTES. Sets
+// *next to the first entry left for the following chunk. The caller fills
+// in chunk_index/chunk_count. Returns the datagram length.
+size_t encode_world_delta(uint8_t *out, const Snapshot *cur, const Snapshot *base,
+                          uint32_t flags, int first, int *next) {
+    WorldDeltaHeader *hdr = (WorldDeltaHeader*)out;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->header.type = PKT_WORLD_DELTA;
+    hdr->header.sequence = state_sequence;
+    hdr->header.player_id = 0;  // From server
+    hdr->snapshot_seq = cur->seq;
+    hdr->baseline_seq = base ? base->seq : 0;
+    hdr->player_count = cur->count;
+    hdr->first_index = first;
+
+    BitWriter w;
+    bw_init(&w, out + sizeof(WorldDeltaHeader), MAX_DATAGRAM_BYTES - sizeof(WorldDeltaHeader));
+
+    uint32_t prev_id = 0;
+    int b = 0;
+    if (base && first < cur->count) {
+        b = snapshot_lower_bound(base, cur->players[first].player_id);
+    }
+
+    int i = first;
+    while (i < cur->count && i - first < DELTA_CHUNK_MAX_ENTRIES &&
+           bw_length(&w) + DELTA_ENTRY_MAX_BYTES <= w.capacity) {
+        const SnapshotPlayer *pd = &cur->players[i];
+
+        // Advance the baseline cursor to this player_id (both lists sorted)
+        const SnapshotPlayer *prev = NULL;
+        if (base) {
+            while (b < base->count && base->players[b].player_id < pd->player_id) b++;
+            if (b < base->count && base->players[b].player_id == pd->player_id) {
+                prev = &base->players[b];
+            }
+        }
+
+        uint8_t mask = prev ? delta_field_mask(pd, prev, flags & WORLD_VARIANT_QUANTIZED)
+                            : DELTA_FIELD_ALL;
+        bw_write_varuint(&w, pd->player_id - prev_id);
+        bw_write(&w, mask, DELTA_FIELD_BITS);
+        write_player_fields(&w, pd, mask, flags);
+        prev_id = pd->player_id;
+        i++;
+    }
+
+    hdr->entry_count = i - first;
+    *next = i;
+    return sizeof(WorldDeltaHeader) + bw_finish(&w);
+}
+
+// Record a client's snapshot ack so later deltas use it as the baseline
+void handle_snapshot_ack(SnapshotAckPacket *pkt, struct sockaddr_in *client_addr) {
+    Player *player = find_player_by_id(pkt->header.player_id);
+    if (!player || !(player->caps & CAP_DELTA_SNAPSHOT)) {
+        return;
+    }
+
+    // Verify address matches
+    if (player->addr.sin_addr.s_addr != client_addr->sin_addr.s_addr ||
+        player->addr.sin_port != client_addr->sin_port) {
+        return;
+    }
+
+    // Only move forward (acks can arrive out of order) and never past what we sent
+    uint32_t seq = pkt->snapshot_seq;
+    if ((int32_t)(seq - player->acked_snapshot) > 0 &&
+        (int32_t)(seq - snapshot_sequence) <= 0) {
+        player->acked_snapshot = seq;
+    }
+}
+
+// Apply a reliable channel ack from a CAP_RELIABLE player
+void handle_reliable_ack(const PacketHeader *header, const ReliableAck *ack,
+                         struct sockaddr_in *client_addr) {
+    Player *player = find_player_by_id(header->player_id);
+    if (!player || !(player->caps & CAP_RELIABLE)) {
+        return;
+    }
+
+    // Verify address matches
+    if (player->addr.sin_addr.s_addr != client_addr->sin_addr.s_addr ||
+        player->addr.sin_port != client_addr->sin_port) {
+        return;
+    }
+
+    reliable_handle_ack(player, ack);
+}
+
+// Fill a legacy world state packet with the first WORLD_STATE_MAX_PLAYERS
+// snapshot entries. Returns the datagram length, trimmed to the populated
+// player slots.
+size_t build_world_state_packet(WorldStatePacket *packet, const Snapshot *snap) {
+    // Player slots are fully overwritten below; only clear the fixed part
+    memset(packet, 0, offsetof(WorldStatePacket, players));
+
+    packet->header.type = PKT_WORLD_STATE;
+    packet->header.sequence = state_sequence;
+    packet->header.player_id = 0;  // From server
+    packet->state_seq = state_sequence;
+
+    int count = snap->count;
+    if (count > WORLD_STATE_MAX_PLAYERS) count = WORLD_STATE_MAX_PLAYERS;
+
+    for (int i = 0; i < count; i++) {
+        const SnapshotPlayer *sp = &snap->players[i];
+        PlayerData *pd = &packet->players[i];
+        pd->player_id = sp->player_id;
+        pd->pos_x = sp->pos_x;
+        pd->pos_y = sp->pos_y;
+        pd->pos_z = sp->pos_z;
+        pd->rot_y = sp->rot_y;
+        pd->state = sp->state;
+        pd->combat_mode = sp->combat_mode;
+        pd->character_class = sp->character_class;
+        pd->health = sp->health;
+        // Names are only expanded for legacy recipients
+        strncpy(pd->anim_name, anim_name_of(sp->anim_id), sizeof(pd->anim_name));
+        pd->active = 1;
+    }
+    packet->player_count = count;
+
+    return offsetof(WorldStatePacket, players) + count * sizeof(PlayerData);
+}
+
+// World state encodings staged during one broadcast, keyed by baseline
+// sequence + WORLD_VARIANT_* flags. Recipients sharing a variant share one
+// copy. Bounded by every baseline (plus "full") in each delta encoding,
+// plus legacy.
+#define WORLD_VARIANT_MAX ((SNAPSHOT_RING_SIZE + 1) * 4 + 1)
+
+typedef struct {
+    uint32_t baseline_seq;
+    uint32_t flags;
+    StagedChunks chunks;       // chunk_lens is a row of world_chunk_lens
+} WorldVariant;
+
+// Allocate snapshot storage and world state scratch space for max_players
+int init_world_state(void) {
+    for (int i = 0; i < SNAPSHOT_RING_SIZE; i++) {
+        snapshot_ring[i].players = calloc(max_players, sizeof(SnapshotPlayer));
+        if (!snapshot_ring[i].players) return -1;
+    }
+
+    // Deltas are split to fit MAX_DATAGRAM_BYTES; the legacy packet is
+    // always one (possibly larger) datagram
+    int per_chunk = (MAX_DATAGRAM_BYTES - sizeof(WorldDeltaHeader)) / DELTA_ENTRY_MAX_BYTES;
+    world_max_chunks = (max_players + per_chunk - 1) / per_chunk;
+    if (world_max_chunks < 1) world_max_chunks = 1;
+
+    size_t buf_size = (size_t)world_max_chunks * MAX_DATAGRAM_BYTES;
+    if (buf_size < sizeof(WorldStatePacket)) buf_size = sizeof(WorldStatePacket);
+    world_chunk_buf = malloc(buf_size);
+    world_chunk_lens = malloc((size_t)WORLD_VARIANT_MAX * world_max_chunks * sizeof(uint16_t));
+    return (world_chunk_buf && world_chunk_lens) ? 0 : -1;
+}
+
+// Encode a snapshot as one variant's chunks and stage them as a single block
+void stage_world_variant(WorldVariant *variant, const Snapshot *snap, const Snapshot *base) {
+    size_t len = 0;
+    int count = 0;
+    int next = 0;
+
+    if (variant->flags & WORLD_VARIANT_LEGACY) {
+        len = build_world_state_packet((WorldStatePacket*)world_chunk_buf, snap);
+        variant->chunks.chunk_lens[count++] = len;
+    } else {
+        do {
+            size_t chunk_len = encode_world_delta(world_chunk_buf + len, snap, base,
+                                                  variant->flags, next, &next);
+            variant->chunks.chunk_lens[count++] = chunk_len;
+            len += chunk_len;
+        } while (next < snap->count);
+
+        uint8_t *out = world_chunk_buf;
+        for (int c = 0; c < count; c++) {
+            WorldDeltaHeader *hdr = (WorldDeltaHeader*)out;
+            hdr->chunk_index = c;
+            hdr->chunk_count = count;
+            out += variant->chunks.chunk_lens[c];
+        }
+    }
+
+    variant->chunks.chunk_count = count;
+    staged_set(&variant->chunks.payload, world_chunk_buf, len);
+}
+
+// Broadcast world state to all players
+void broadcast_world_state() {
+    Snapshot *snap = capture_snapshot();
+    state_sequence++;
+
+    // Dictionary entries go out ahead of the deltas that reference them
+    announce_new_animations();
+
+    WorldVariant variants[WORLD_VARIANT_MAX];
+    int variant_count = 0;
+
+    int total = max_players + MAX_SPECTATORS;
+    for (int r = 0; r < total; r++) {
+        Player *player = NULL;
+        const struct sockaddr_in *addr;
+        uint32_t flags = WORLD_VARIANT_LEGACY;
+        Snapshot *base = NULL;
+
+        if (r < max_players) {
+            player = &players[r];
+            if (!player->active) continue;
+            addr = &player->addr;
+            if (player->caps & (CAP_DELTA_SNAPSHOT | CAP_QUANTIZED | CAP_ANIM_IDS)) {
+                flags = 0;
+                if (player->caps & CAP_QUANTIZED) flags |= WORLD_VARIANT_QUANTIZED;
+                if (player->caps & CAP_ANIM_IDS) flags |= WORLD_VARIANT_ANIM_IDS;
+                // Fall back to a full snapshot if the baseline has left the ring
+                if (player->caps & CAP_DELTA_SNAPSHOT) {
+                    base = find_snapshot(player->acked_snapshot);
+                }
+            }
+        } else {
+            // Spectators can't ack, so they always get the legacy packet
+            Spectator *spec = &spectators[r - max_players];
+            if (!spec->active) continue;
+            addr = &spec->addr;
+        }
+
+        uint32_t baseline_seq = base ? base->seq : 0;
+        int v = 0;
+        while (v < variant_count &&
+               (variants[v].baseline_seq != baseline_seq || variants[v].flags != flags)) v++;
+        if (v == variant_count) {
+            variants[v].baseline_seq = baseline_seq;
+            variants[v].flags = flags;
+            variants[v].chunks.payload.staged = NULL;
+            variants[v].chunks.chunk_lens = &world_chunk_lens[v * world_max_chunks];
+            variant_count++;
+        }
+
+        WorldVariant *variant = &variants[v];
+        if (!staged_valid(&variant->chunks.payload)) {
+            stage_world_variant(variant, snap, base);
+        }
+        if (player) {
+            sendq_push_chunks_player(&variant->chunks, player);
+        } else {
+            sendq_push_chunks(&variant->chunks, addr);
+        }
+    }
+
+}
+
+// Tell a player their ID and spawn point
+void send_join_ack(Player *player) {
+    JoinAckPacket ack;
+    memset(&ack, 0, sizeof(ack));
+    ack.header.type = PKT_JOIN_ACK;
+    ack.header.player_id = player->player_id;
+    ack.header.sequence = (uint32_t)time(NULL);
+    ack.assigned_id = player->player_id;
+    const PlayerState *ps = &player->data;
+    ack.data.player_id = player->player_id;
+    ack.data.pos_x = ps->pos_x;
+    ack.data.pos_y = ps->pos_y;
+    ack.data.pos_z = ps->pos_z;
+    ack.data.rot_y = ps->rot_y;
+    ack.data.state = ps->state;
+    ack.data.combat_mode = ps->combat_mode;
+    ack.data.character_class = ps->character_class;
+    ack.data.health = ps->health;
+    strncpy(ack.data.anim_name, anim_name_of(player->anim_id), sizeof(ack.data.anim_name));
+    ack.data.active = 1;
+
+    if (!(player->caps & CAP_RELIABLE) || reliable_send(player, &ack, sizeof(ack)) < 0) {
+        sendq_send_player(player, &ack, sizeof(ack));
+    }
+    LOG(LOG_DEBUG, "Sent JOIN_ACK to player %u\n", player->player_id);
+}
+
+// Handle join request
+void handle_join(JoinPacket *pkt, uint32_t caps, uint32_t epoch, struct sockaddr_in *client_addr) {
+
+    // Remove from spectators if they were spectating
+    int spec = find_spectator_by_addr(client_addr);
+    if (spec >= 0) {
+        spectators[spec].active = 0;
+        slot_index_remove(&spectator_addr_index, addr_key(client_addr));
+        LOG(LOG_INFO, "Spectator promoted to player\n");
+    }
+
+    // Check if already connected
+    Player *existing = find_player_by_addr(client_addr);
+    if (existing) {
+        LOG(LOG_INFO, "Player %s reconnected (ID: %u)\n", existing->name, existing->player_id);
+        existing->last_seen = sim_seconds();
+        // A JOIN naming the current channel is a retry or a duplicate: its
+        // JOIN_ACK is already in flight on the channel. Any other epoch is a
+        // new channel, and a stopped one starts over; both get the JOIN_ACK
+        // again.
+        const ReliableChannel *ch = &reliable_channels[existing - players];
+        int same_channel = (existing->caps & CAP_RELIABLE) && (caps & CAP_RELIABLE) &&
+                           ch->epoch == epoch && !ch->stopped;
+        // A restarted client has lost its baselines and dictionary
+        existing->caps = caps;
+        existing->acked_snapshot = 0;
+        if ((caps & CAP_RELIABLE) && !same_channel) {
+            reliable_reset(existing, epoch);
+            send_join_ack(existing);
+        }
+        if (caps & CAP_ANIM_IDS) {
+            send_anim_dict(existing);
+        }
+            return;
+    }
+
+    // Find free slot
+    int slot = find_free_slot();
+    if (slot < 0) {
+        LOG(LOG_WARN, "Server full, rejecting player %s\n", pkt->player_name);
+            return;
+    }
+
+    // Initialize new player
+    Player *player = &players[slot];
+    memset(player, 0, sizeof(Player));
+
+    player->player_id = next_player_id++;
+    strncpy(player->name, pkt->player_name, sizeof(player->name) - 1);
+    player->addr = *client_addr;
+    player->last_seen = sim_seconds();
+    activate_player(player);
+    player->caps = caps;
+    player->acked_snapshot = 0;
+    reliable_reset(player, epoch);
+
+    // Set initial player data
+    generate_spawn_position(&player->data.pos_x, &player->data.pos_y, &player->data.pos_z);
+    player->data.rot_y = 0;
+    player->data.state = STATE_IDLE;
+    player->data.combat_mode = 1;  // Armed by default
+    player->data.character_class = 1;  // Archer by default
+    player->data.health = 100.0f;
+    player->anim_id = intern_animation("Idle", NULL);
+
+    LOG(LOG_INFO, "Player %s joined (ID: %u) at position (%.1f, %.1f, %.1f) caps=0x%x - Total players: %d\n",
+                  player->name, player->player_id,
+                  player->data.pos_x, player->data.pos_y, player->data.pos_z,
+                  caps, count_active_players());
+
+    // Send JOIN_ACK to the new player
+    send_join_ack(player);
+
+    // Give ID-aware clients the table before any delta references it
+    if (caps & CAP_ANIM_IDS) {
+        send_anim_dict(player);
+    }
+
+    // Send initial world state to new player
+    broadcast_world_state();
+}
+
+// Handle player update
+void handle_update(UpdatePacket *pkt, struct sockaddr_in *client_addr) {
+
+    Player *player = find_player_by_id(pkt->header.player_id);
+    if (!player) {
+            return;
+    }
+
+    // Verify address matches
+    if (player->addr.sin_addr.s_addr != client_addr->sin_addr.s_addr ||
+        player->addr.sin_port != client_addr->sin_port) {
+            return;
+    }
+
+    // Update player data. The animation name is interned rather than
+    // copied; the common case (unchanged animation) is a single compare.
+    PlayerState *pd = &player->data;
+    pd->pos_x = pkt->data.pos_x;
+    pd->pos_y = pkt->data.pos_y;
+    pd->pos_z = pkt->data.pos_z;
+    pd->rot_y = pkt->data.rot_y;
+    pd->state = pkt->data.state;
+    pd->combat_mode = pkt->data.combat_mode;
+    pd->character_class = pkt->data.character_class;
+    pd->health = pkt->data.health;
+    if (strncmp(pkt->data.anim_name, anim_name_of(player->anim_id), ANIM_NAME_LEN) != 0) {
+        player->anim_id = intern_animation(pkt->data.anim_name, player);
+    }
+    player->last_seen = sim_seconds();
+
+}
+
+// Handle compact player update (animation already interned by the client)
+void handle_compact_update(CompactUpdatePacket *pkt, struct sockaddr_in *client_addr) {
+
+    Player *player = find_player_by_id(pkt->header.player_id);
+    if (!player) {
+        return;
+    }
+
+    // Verify address matches
+    if (player->addr.sin_addr.s_addr != client_addr->sin_addr.s_addr ||
+        player->addr.sin_port != client_addr->sin_port) {
+        return;
+    }
 
-            // Start landing descent when close
-            if (dist < 10.0f) {
-                dragon->state = DRAGON_LANDING;
-                printf("Dragon %u starting landing descent\n", dragon->entity_id);
-            }
-            break;
-        }
+    PlayerState *pd = &player->data;
+    pd->pos_x = pkt->pos_x;
+    pd->pos_y = pkt->pos_y;
+    pd->pos_z = pkt->pos_z;
+    pd->rot_y = pkt->rot_y;
+    pd->state = pkt->state;
+    pd->combat_mode = pkt->combat_mode;
+    pd->character_class = pkt->character_class;
+    pd->health = pkt->health;
+    if (pkt->anim_id < anim_count) {
+        player->anim_id = pkt->anim_id;
+    }
+    player->last_seen = sim_seconds();
 
-        case DRAGON_LANDING: {
-            // Descend towards landing spot
-            float dx = DRAGON_LANDING_SPOT_X - dragon->pos_x;
-            float dy = DRAGON_LANDING_SPOT_Y - dragon->pos_y;
-            float dz = DRAGON_LANDING_SPOT_Z - dragon->pos_z;
-            float dist = sqrt(dx*dx + dy*dy + dz*dz);
+}
 
-            // Slow down as we approach
-            float speed = fminf(dist * 0.5f, DRAGON_PATROL_SPEED);
-            speed = fmaxf(speed, 2.0f);
+// Handle a client asking for the full animation table
+void handle_anim_dict_request(struct sockaddr_in *client_addr) {
+    Player *player = find_player_by_addr(client_addr);
+    if (player && (player->caps & CAP_ANIM_IDS)) {
+        send_anim_dict(player);
+    }
+}
 
-            if (dist > 0.1f) {
-                dx /= dist; dy /= dist; dz /= dist;
-                dragon->pos_x += dx * speed * delta;
-                dragon->pos_y += dy * speed * delta;
-                dragon->pos_z += dz * speed * delta;
-            }
+// Handle spectate request
+void handle_spectate(PacketHeader *hdr, struct sockaddr_in *client_addr) {
 
-            // Check if landed
-            if (dist < 5.0f) {
-                dragon->pos_x = DRAGON_LANDING_SPOT_X;
-                dragon->pos_y = DRAGON_LANDING_SPOT_Y;
-                dragon->pos_z = DRAGON_LANDING_SPOT_Z;
-                dragon->state = DRAGON_WAIT;
-                dragon->wait_timer = 0.0f;
-                printf("Dragon %u landed! Waiting for %.1f seconds\n",
-                       dragon->entity_id, DRAGON_WAIT_TIME);
-            }
+    // Check if already a spectator
+    int existing = find_spectator_by_addr(client_addr);
+    if (existing >= 0) {
+        spectators[existing].last_seen = sim_seconds();
+        return;
+    }
+
+    // Find free slot
+    int slot = -1;
+    for (int i = 0; i < MAX_SPECTATORS; i++) {
+        if (!spectators[i].active) {
+            slot = i;
             break;
         }
+    }
 
-        case DRAGON_WAIT: {
-            dragon->wait_timer += delta;
+    if (slot < 0) {
+        LOG(LOG_WARN, "Too many spectators, rejecting\n");
+            return;
+    }
 
-            // Check for nearby player to attack
-            float nearest_dist = 999999.0f;
-            Player *nearest = find_nearest_player(dragon->pos_x, dragon->pos_y, dragon->pos_z, &nearest_dist);
+    // Add spectator
+    spectators[slot].addr = *client_addr;
+    spectators[slot].last_seen = sim_seconds();
+    spectators[slot].active = 1;
+    slot_index_put(&spectator_addr_index, addr_key(client_addr), slot);
 
-            if (nearest && nearest_dist < DRAGON_ATTACK_RANGE) {
-                dragon->state = DRAGON_ATTACKING;
-                dragon->attack_timer = 2.0f;  // Attack duration
-                dragon->target_player_id = nearest->player_id;
-                printf("Dragon %u attacking player %u!\n", dragon->entity_id, nearest->player_id);
-                break;
-            }
+    LOG(LOG_INFO, "Spectator connected from %s:%d\n",
+                  inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
 
-            // Check if wait time complete
-            if (dragon->wait_timer >= DRAGON_WAIT_TIME) {
-                dragon->state = DRAGON_TAKING_OFF;
-                printf("Dragon %u taking off!\n", dragon->entity_id);
-            }
-            break;
-        }
+    // Send SPECTATE_ACK
+    PacketHeader ack;
+    ack.type = PKT_SPECTATE_ACK;
+    ack.sequence = hdr->sequence;
+    ack.player_id = 0;
+    sendq_send(&ack, sizeof(ack), client_addr);
+    LOG(LOG_DEBUG, "Sent SPECTATE_ACK\n");
 
-        case DRAGON_ATTACKING: {
-            dragon->attack_timer -= delta;
+}
 
-            if (dragon->attack_timer <= 0) {
-                // Check if player still in range
-                float dist = 999999.0f;
-                Player *target = find_player_by_id(dragon->target_player_id);
-                if (target && target->active) {
-                    dist = distance_3d(dragon->pos_x, dragon->pos_y, dragon->pos_z,
-                                       target->data.pos_x, target->data.pos_y, target->data.pos_z);
-                }
+// Handle player leave
+void handle_leave(PacketHeader *hdr, struct sockaddr_in *client_addr) {
+    (void)client_addr;  // Unused parameter
 
-                if (dist < DRAGON_ATTACK_RANGE) {
-                    // Attack again
-                    dragon->attack_timer = 2.0f;
-                } else {
-                    // Return to wait state
-                    dragon->state = DRAGON_WAIT;
-                    dragon->wait_timer = 0.0f;
-                }
-            }
-            break;
-        }
+    Player *player = find_player_by_id(hdr->player_id);
+    if (player) {
+        LOG(LOG_INFO, "Player %s left (ID: %u)\n", player->name, player->player_id);
+        deactivate_player(player);
+    }
 
-        case DRAGON_TAKING_OFF: {
-            // Rise up
-            dragon->pos_y += 15.0f * delta;
+    broadcast_world_state();
+}
 
-            // Check if high enough to resume patrol
-            if (dragon->pos_y >= DRAGON_PATROL_HEIGHT * 0.8f) {
-                dragon->state = DRAGON_PATROL;
-                dragon->patrol_angle = 0.0f;  // Reset patrol angle
-                printf("Dragon %u resuming patrol\n", dragon->entity_id);
-            }
-            break;
-        }
+// Cleanup timed out players
+// Timeout timer for a player slot. Packets only refresh last_seen, so the
+// timer is armed from the last time it was checked and re-armed here until
+// the player has really been quiet for PLAYER_TIMEOUT_SEC.
+void player_timeout_expired(int slot) {
+    Player *player = &players[slot];
+    if (!player->active) return;
+
+    time_t idle = sim_seconds() - player->last_seen;
+    if (idle > PLAYER_TIMEOUT_SEC) {
+        LOG(LOG_INFO, "Player %s timed out (ID: %u)\n", player->name, player->player_id);
+        deactivate_player(player);
+    } else {
+        timer_schedule(player_timers + slot, PLAYER_TIMEOUT_SEC + 1 - idle);
     }
 }
 
-// Update all Dragons
-void update_all_dragons(float delta) {
-    // Note: entities_mutex and players_mutex should already be held
-    for (int i = 0; i < MAX_DRAGONS; i++) {
-        if (dragons[i].active) {
-            update_dragon_ai(&dragons[i], delta);
+int init_player_timeouts(void) {
+    player_timers = timer_create_range(player_timeout_expired, max_players);
+    return player_timers;
+}
+
+// Relay entity state from host to all other clients
+void relay_entity_state(void *packet, size_t len, struct sockaddr_in *sender_addr) {
+
+    const void *staged = sendq_stage(packet, len);
+    for (int i = 0; i < max_players; i++) {
+        if (players[i].active) {
+            // Skip the sender (host)
+            if (players[i].addr.sin_addr.s_addr == sender_addr->sin_addr.s_addr &&
+                players[i].addr.sin_port == sender_addr->sin_port) {
+                continue;
+            }
+            sendq_push_player(&players[i], staged, len);
         }
     }
-}
 
-// Broadcast world state to all players
-void broadcast_world_state() {
-    WorldStatePacket packet;
-    memset(&packet, 0, sizeof(packet));
+}
 
-    packet.header.type = PKT_WORLD_STATE;
-    packet.header.sequence = ++state_sequence;
-    packet.header.player_id = 0;  // From server
-    packet.state_seq = state_sequence;
+// Relay arrow spawn to all clients except sender
+void relay_arrow_spawn(ArrowSpawnPacket *pkt, size_t len, struct sockaddr_in *sender_addr) {
 
+    LOG(LOG_DEBUG, "Relaying arrow spawn (id=%u) from player %u to %d clients\n",
+                   pkt->arrow_id, pkt->shooter_id, count_active_players() - 1);
 
-    int count = 0;
-    for (int i = 0; i < MAX_PLAYERS && count < MAX_PLAYERS; i++) {
+    const void *staged = sendq_stage(pkt, len);
+    for (int i = 0; i < max_players; i++) {
         if (players[i].active) {
-            packet.players[count] = players[i].data;
-            count++;
+            // Skip the sender
+            if (players[i].addr.sin_addr.s_addr == sender_addr->sin_addr.s_addr &&
+                players[i].addr.sin_port == sender_addr->sin_port) {
+                continue;
+            }
+            sendq_push_player(&players[i], staged, len);
         }
     }
-    packet.player_count = count;
 
-    // Send to all active players
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+}
+
+// Relay arrow hit to all clients except sender
+void relay_arrow_hit(ArrowHitPacket *pkt, size_t len, struct sockaddr_in *sender_addr) {
+
+    LOG(LOG_DEBUG, "Relaying arrow hit (id=%u) at (%.1f, %.1f, %.1f)\n",
+                   pkt->arrow_id, pkt->hit_x, pkt->hit_y, pkt->hit_z);
+
+    const void *staged = sendq_stage(pkt, len);
+    for (int i = 0; i < max_players; i++) {
         if (players[i].active) {
-            sendto(server_socket, &packet, sizeof(packet), 0,
-                   (struct sockaddr*)&players[i].addr, sizeof(players[i].addr));
+            // Skip the sender
+            if (players[i].addr.sin_addr.s_addr == sender_addr->sin_addr.s_addr &&
+                players[i].addr.sin_port == sender_addr->sin_port) {
+                continue;
+            }
+            sendq_push_player(&players[i], staged, len);
         }
     }
 
-    // Send to all spectators
-    for (int i = 0; i < MAX_SPECTATORS; i++) {
-        if (spectators[i].active) {
-            sendto(server_socket, &packet, sizeof(packet), 0,
-                   (struct sockaddr*)&spectators[i].addr, sizeof(spectators[i].addr));
+}
+
+// Relay entity damage to host (first/lowest ID player)
+void relay_entity_damage(EntityDamagePacket *pkt, size_t len, struct sockaddr_in *sender_addr) {
+
+    // Find host (lowest player ID)
+    Player *host = NULL;
+    uint32_t lowest_id = UINT32_MAX;
+    for (int i = 0; i < max_players; i++) {
+        if (players[i].active && players[i].player_id < lowest_id) {
+            lowest_id = players[i].player_id;
+            host = &players[i];
         }
     }
 
+    if (host) {
+        LOG(LOG_DEBUG, "Relaying entity damage (entity=%u, damage=%.1f) to host %u\n",
+                       pkt->entity_id, pkt->damage, host->player_id);
+        sendq_send_player(host, pkt, len);
+    }
+
 }
 
-// Handle join request
-void handle_join(JoinPacket *pkt, struct sockaddr_in *client_addr) {
+// Answer a PKT_STATS query. Anyone may ask; the padding requirement keeps
+// the reply no larger than the query.
+void handle_stats_query(const PacketHeader *query, ssize_t recv_len, struct sockaddr_in *client_addr) {
+    if (recv_len < (ssize_t)sizeof(StatsPacket)) {
+        return;
+    }
 
-    // Remove from spectators if they were spectating
+    StatsSummary summary = stats_summary;
+    uint64_t now_ns = monotonic_ns();
+    if (summary.window_ms == 0) {
+        stats_summarize(&stats_window, now_ns, &summary);
+    }
+
+    int spectator_count = 0;
     for (int i = 0; i < MAX_SPECTATORS; i++) {
-        if (spectators[i].active &&
-            spectators[i].addr.sin_addr.s_addr == client_addr->sin_addr.s_addr &&
-            spectators[i].addr.sin_port == client_addr->sin_port) {
-            spectators[i].active = 0;
-            printf("Spectator promoted to player\n");
-            break;
-        }
+        spectator_count += spectators[i].active;
+    }
+    int dragon_count = 0;
+    for (int i = 0; i < MAX_DRAGONS; i++) {
+        dragon_count += dragons[i].active;
     }
 
-    // Check if already connected
-    Player *existing = find_player_by_addr(client_addr);
-    if (existing) {
-        printf("Player %s reconnected (ID: %u)\n", existing->name, existing->player_id);
-        existing->last_seen = time(NULL);
-            return;
+    StatsPacket pkt;
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.header.type = PKT_STATS;
+    pkt.header.sequence = query->sequence;
+    pkt.header.player_id = 0;
+    pkt.uptime_sec = (uint32_t)((now_ns - metrics.start_ns) / 1000000000ULL);
+    pkt.players = (uint16_t)count_active_players();
+    pkt.max_players = (uint16_t)max_players;
+    pkt.spectators = (uint16_t)spectator_count;
+    pkt.bobbas = (uint16_t)bobbas.live_count;
+    pkt.dragons = (uint16_t)dragon_count;
+    pkt.tick_rate = (uint16_t)sim_tick_rate;
+    pkt.window_ms = summary.window_ms;
+    pkt.ticks_per_sec = summary.ticks_per_sec;
+    pkt.tick_avg_us = summary.tick_avg_us;
+    pkt.tick_p99_us = summary.tick_p99_us;
+    pkt.tick_max_us = summary.tick_max_us;
+    pkt.tick_overruns = summary.tick_overruns;
+    pkt.rx_packets_per_sec = summary.rx_packets_per_sec;
+    pkt.tx_packets_per_sec = summary.tx_packets_per_sec;
+    pkt.rx_socket_drops = metrics.rx_socket_drops;
+
+    sendq_send(&pkt, sizeof(pkt), client_addr);
+}
+
+// Dispatch a single received datagram to its handler
+void dispatch_packet(char *buffer, ssize_t recv_len, struct sockaddr_in *client_addr) {
+    if (recv_len < (ssize_t)sizeof(PacketHeader)) {
+        return;
     }
 
-    // Find free slot
-    int slot = find_free_slot();
-    if (slot < 0) {
-        printf("Server full, rejecting player %s\n", pkt->player_name);
-            return;
+    PacketHeader *header = (PacketHeader*)buffer;
+
+    switch (header->type) {
+        case PKT_JOIN:
+            if (recv_len >= (ssize_t)sizeof(JoinPacket)) {
+                uint32_t caps = 0;
+                uint32_t epoch = 0;
+                if (recv_len >= (ssize_t)offsetof(JoinCapsPacket, reliable_epoch)) {
+                    caps = ((JoinCapsPacket*)buffer)->caps;
+                }
+                if (recv_len >= (ssize_t)sizeof(JoinCapsPacket)) {
+                    epoch = ((JoinCapsPacket*)buffer)->reliable_epoch;
+                }
+                // A reliable channel can't be told apart from earlier ones
+                // without an epoch
+                if (epoch == 0) {
+                    caps &= ~CAP_RELIABLE;
+                }
+                handle_join((JoinPacket*)buffer, caps, epoch, client_addr);
+            }
+            break;
+
+        case PKT_UPDATE:
+            if (recv_len >= (ssize_t)sizeof(UpdatePacket)) {
+                handle_update((UpdatePacket*)buffer, client_addr);
+            }
+            if (recv_len >= (ssize_t)(sizeof(UpdatePacket) + sizeof(ReliableAck))) {
+                handle_reliable_ack(header, (ReliableAck*)(buffer + sizeof(UpdatePacket)), client_addr);
+            }
+            break;
+
+        case PKT_UPDATE_COMPACT:
+            if (recv_len >= (ssize_t)sizeof(CompactUpdatePacket)) {
+                handle_compact_update((CompactUpdatePacket*)buffer, client_addr);
+            }
+            if (recv_len >= (ssize_t)(sizeof(CompactUpdatePacket) + sizeof(ReliableAck))) {
+                handle_reliable_ack(header, (ReliableAck*)(buffer + sizeof(CompactUpdatePacket)), client_addr);
+            }
+            break;
+
+        case PKT_RELIABLE:
+            if (recv_len >= (ssize_t)(sizeof(PacketHeader) + sizeof(ReliableAck))) {
+                handle_reliable_ack(header, (ReliableAck*)(buffer + sizeof(PacketHeader)), client_addr);
+            }
+            break;
+
+        case PKT_ANIM_DICT:
+            handle_anim_dict_request(client_addr);
+            break;
+
+        case PKT_LEAVE:
+            handle_leave(header, client_addr);
+            break;
+
+        case PKT_ACK:
+            if (recv_len >= (ssize_t)sizeof(SnapshotAckPacket)) {
+                handle_snapshot_ack((SnapshotAckPacket*)buffer, client_addr);
+            }
+            if (recv_len >= (ssize_t)(sizeof(SnapshotAckPacket) + sizeof(ReliableAck))) {
+                handle_reliable_ack(header, (ReliableAck*)(buffer + sizeof(SnapshotAckPacket)), client_addr);
+            }
+            break;
+
+        case PKT_PING: {
+            // Respond with pong
+            PacketHeader pong;
+            pong.type = PKT_PONG;
+            pong.player_id = header->player_id;
+            pong.sequence = header->sequence;
+            sendq_send(&pong, sizeof(pong), client_addr);
+            break;
+        }
+
+        case PKT_STATS:
+            handle_stats_query(header, recv_len, client_addr);
+            break;
+
+        case PKT_ENTITY_DAMAGE:
+            if (recv_len >= (ssize_t)sizeof(EntityDamagePacket)) {
+                EntityDamagePacket *dmg = (EntityDamagePacket*)buffer;
+                handle_entity_damage_server(dmg->entity_id, dmg->damage, dmg->attacker_id);
+            }
+            break;
+
+        case PKT_ARROW_SPAWN:
+            if (recv_len >= (ssize_t)sizeof(ArrowSpawnPacket)) {
+                relay_arrow_spawn((ArrowSpawnPacket*)buffer, recv_len, client_addr);
+            }
+            break;
+
+        case PKT_ARROW_HIT:
+            if (recv_len >= (ssize_t)sizeof(ArrowHitPacket)) {
+                relay_arrow_hit((ArrowHitPacket*)buffer, recv_len, client_addr);
+            }
+            break;
+
+        case PKT_HEARTBEAT:
+            // Just update last_seen (already done by finding player)
+            break;
+
+        case PKT_SPECTATE:
+            handle_spectate(header, client_addr);
+            break;
+
+        case PKT_GAME_RESTART:
+            if (recv_len >= (ssize_t)sizeof(GameRestartPacket)) {
+                GameRestartPacket *restart = (GameRestartPacket*)buffer;
+                handle_game_restart(restart->reason, header->player_id);
+            }
+            break;
+
+        default:
+            break;
     }
+}
 
-    // Initialize new player
-    Player *player = &players[slot];
-    memset(player, 0, sizeof(Player));
+// =============================================================================
+// SESSION RECORDING
+// =============================================================================
 
-    player->player_id = next_player_id++;
-    strncpy(player->name, pkt->player_name, sizeof(player->name) - 1);
-    player->addr = *client_addr;
-    player->last_seen = time(NULL);
-    player->active = 1;
+// --record appends every received datagram to a memory-mapped log;
+// --replay feeds a log back through dispatch_packet. Datagrams are replayed
+// before the same simulation step they originally preceded, with the same
+// srand() seed and simulation options, so the replayed world ends in the
+// same state (compare the state hashes both print).
+typedef struct {
+    int fd;
+    uint8_t *base;             // Mapping of the whole file
+    size_t size;               // File and mapping size
+    size_t used;               // Header plus records written so far
+    uint64_t start_ns;
+} Recording;
 
-    // Set initial player data
-    player->data.player_id = player->player_id;
-    generate_spawn_position(&player->data.pos_x, &player->data.pos_y, &player->data.pos_z);
-    player->data.rot_y = 0;
-    player->data.state = STATE_IDLE;
-    player->data.combat_mode = 1;  // Armed by default
-    player->data.character_class = 1;  // Archer by default
-    player->data.health = 100.0f;
-    strncpy(player->data.anim_name, "Idle", sizeof(player->data.anim_name));
-    player->data.active = 1;
+static Recording recording = { .fd = -1 };
+
+// Replay source: a read-only mapping and a cursor into it
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    size_t offset;             // Next record
+    uint64_t records_left;
+    RecordingHeader header;
+} ReplayLog;
+
+static ReplayLog replay_log;
 
-    printf("Player %s joined (ID: %u) at position (%.1f, %.1f, %.1f) - Total players: %d\n",
-           player->name, player->player_id,
-           player->data.pos_x, player->data.pos_y, player->data.pos_z,
-           count_active_players());
-    fflush(stdout);
+static inline RecordingHeader *recording_header(void) {
+    return (RecordingHeader*)recording.base;
+}
 
-    // Send JOIN_ACK to the new player
-    JoinAckPacket ack;
-    memset(&ack, 0, sizeof(ack));
-    ack.header.type = PKT_JOIN_ACK;
-    ack.header.player_id = player->player_id;
-    ack.header.sequence = (uint32_t)time(NULL);
-    ack.assigned_id = player->player_id;
-    ack.data = player->data;
+int open_recording(const char *path, const RecordingHeader *header) {
+    recording.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (recording.fd < 0) return -1;
 
-    sendto(server_socket, &ack, sizeof(ack), 0,
-           (struct sockaddr*)client_addr, sizeof(*client_addr));
-    printf("Sent JOIN_ACK to player %u\n", player->player_id);
-    fflush(stdout);
+    recording.size = RECORDING_GROW_BYTES;
+    if (ftruncate(recording.fd, recording.size) < 0) {
+        close(recording.fd);
+        recording.fd = -1;
+        return -1;
+    }
+    recording.base = mmap(NULL, recording.size, PROT_READ | PROT_WRITE, MAP_SHARED, recording.fd, 0);
+    if (recording.base == MAP_FAILED) {
+        close(recording.fd);
+        recording.fd = -1;
+        return -1;
+    }
 
-    // Send initial world state to new player
-    broadcast_world_state();
+    memcpy(recording.base, header, sizeof(*header));
+    recording.used = sizeof(*header);
+    recording.start_ns = monotonic_ns();
+    return 0;
 }
 
-// Handle player update
-void handle_update(UpdatePacket *pkt, struct sockaddr_in *client_addr) {
+// Stop recording, after a write error or at shutdown
+void close_recording(uint64_t end_step) {
+    if (recording.fd < 0) return;
 
-    Player *player = find_player_by_id(pkt->header.player_id);
-    if (!player) {
-            return;
+    recording_header()->end_step = end_step;
+    munmap(recording.base, recording.size);
+    if (ftruncate(recording.fd, recording.used) < 0) {
+        LOG(LOG_WARN, "Can't trim the recording: %s", strerror(errno));
     }
+    close(recording.fd);
+    recording.fd = -1;
+}
 
-    // Verify address matches
-    if (player->addr.sin_addr.s_addr != client_addr->sin_addr.s_addr ||
-        player->addr.sin_port != client_addr->sin_port) {
+// Append one received datagram. Growing the file remaps it, so only offsets
+// into the mapping are kept across calls.
+void recording_append(const void *data, size_t len, const struct sockaddr_in *from) {
+    size_t need = sizeof(RecordEntry) + len;
+    if (recording.used + need > recording.size) {
+        size_t new_size = recording.size + RECORDING_GROW_BYTES;
+        void *base = MAP_FAILED;
+        if (ftruncate(recording.fd, new_size) == 0) {
+            base = mremap(recording.base, recording.size, new_size, MREMAP_MAYMOVE);
+        }
+        if (base == MAP_FAILED) {
+            LOG(LOG_ERROR, "Recording stopped, can't grow the log: %s", strerror(errno));
+            close_recording(0);
             return;
+        }
+        recording.base = base;
+        recording.size = new_size;
     }
 
-    // Update player data
-    player->data = pkt->data;
-    player->data.player_id = player->player_id;  // Ensure ID is preserved
-    player->last_seen = time(NULL);
-
+    RecordEntry entry;
+    entry.time_ns = monotonic_ns() - recording.start_ns;
+    entry.step = sim_clock_steps();
+    entry.addr = from->sin_addr.s_addr;
+    entry.port = from->sin_port;
+    entry.len = (uint16_t)len;
+    memcpy(recording.base + recording.used, &entry, sizeof(entry));
+    memcpy(recording.base + recording.used + sizeof(entry), data, len);
+    recording.used += need;
+
+    RecordingHeader *header = recording_header();
+    header->record_count++;
+    header->data_bytes += need;
 }
 
-// Handle spectate request
-void handle_spectate(PacketHeader *hdr, struct sockaddr_in *client_addr) {
+// Map a recording for replay and check its header
+int open_replay(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
 
-    // Check if already a spectator
-    for (int i = 0; i < MAX_SPECTATORS; i++) {
-        if (spectators[i].active &&
-            spectators[i].addr.sin_addr.s_addr == client_addr->sin_addr.s_addr &&
-            spectators[i].addr.sin_port == client_addr->sin_port) {
-            spectators[i].last_seen = time(NULL);
-                    return;
-        }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(RecordingHeader)) {
+        close(fd);
+        return -1;
     }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+
+    ReplayLog *log = &replay_log;
+    log->base = base;
+    log->size = st.st_size;
+    memcpy(&log->header, base, sizeof(log->header));
+    if (memcmp(log->header.magic, RECORDING_MAGIC, sizeof(log->header.magic)) != 0 ||
+        log->header.data_bytes > log->size - sizeof(RecordingHeader)) {
+        munmap(base, st.st_size);
+        return -1;
+    }
+    log->offset = sizeof(RecordingHeader);
+    log->records_left = log->header.record_count;
+    return 0;
+}
 
-    // Find free slot
-    int slot = -1;
-    for (int i = 0; i < MAX_SPECTATORS; i++) {
-        if (!spectators[i].active) {
-            slot = i;
-            break;
-        }
+// Peek at the next replayed datagram. Returns 0 at the end of the log.
+int replay_peek(RecordEntry *entry, const uint8_t **payload) {
+    ReplayLog *log = &replay_log;
+    if (log->records_left == 0 || log->offset + sizeof(RecordEntry) > log->size) {
+        return 0;
     }
+    memcpy(entry, log->base + log->offset, sizeof(*entry));
+    if (log->offset + sizeof(RecordEntry) + entry->len > log->size) {
+        return 0;
+    }
+    *payload = log->base + log->offset + sizeof(RecordEntry);
+    return 1;
+}
 
-    if (slot < 0) {
-        printf("Too many spectators, rejecting\n");
-            return;
+void replay_advance(void) {
+    RecordEntry entry;
+    memcpy(&entry, replay_log.base + replay_log.offset, sizeof(entry));
+    replay_log.offset += sizeof(entry) + entry.len;
+    replay_log.records_left--;
+}
+
+static inline uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
     }
+    return hash;
+}
 
-    // Add spectator
-    spectators[slot].addr = *client_addr;
-    spectators[slot].last_seen = time(NULL);
-    spectators[slot].active = 1;
+// Hash of the simulated world (players, Bobbas, Dragons) for comparing a
+// recorded session with its replay
+uint64_t world_state_hash(void) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
 
-    printf("Spectator connected from %s:%d\n",
-           inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
-    fflush(stdout);
+    for (int i = 0; i < max_players; i++) {
+        if (!players[i].active) continue;
+        hash = fnv1a(hash, &players[i].player_id, sizeof(players[i].player_id));
+        hash = fnv1a(hash, &players[i].data.pos_x, 3 * sizeof(float));
+        hash = fnv1a(hash, &players[i].data.health, sizeof(float));
+    }
 
-    // Send SPECTATE_ACK
-    PacketHeader ack;
-    ack.type = PKT_SPECTATE_ACK;
-    ack.sequence = hdr->sequence;
-    ack.player_id = 0;
-    sendto(server_socket, &ack, sizeof(ack), 0,
-           (struct sockaddr*)client_addr, sizeof(*client_addr));
-    printf("Sent SPECTATE_ACK\n");
-    fflush(stdout);
+    BobbaStore *b = &bobbas;
+    for (int n = 0; n < b->live_count; n++) {
+        int i = b->live[n];
+        hash = fnv1a(hash, &b->entity_id[i], sizeof(b->entity_id[i]));
+        hash = fnv1a(hash, &b->pos_x[i], sizeof(float));
+        hash = fnv1a(hash, &b->pos_y[i], sizeof(float));
+        hash = fnv1a(hash, &b->pos_z[i], sizeof(float));
+        hash = fnv1a(hash, &b->rot_y[i], sizeof(float));
+        hash = fnv1a(hash, &b->health[i], sizeof(float));
+        hash = fnv1a(hash, &b->state[i], sizeof(b->state[i]));
+        hash = fnv1a(hash, &b->target_player_id[i], sizeof(b->target_player_id[i]));
+    }
 
+    for (int i = 0; i < MAX_DRAGONS; i++) {
+        if (!dragons[i].active) continue;
+        hash = fnv1a(hash, &dragons[i].entity_id, sizeof(dragons[i].entity_id));
+        hash = fnv1a(hash, &dragons[i].pos_x, sizeof(float));
+        hash = fnv1a(hash, &dragons[i].pos_y, sizeof(float));
+        hash = fnv1a(hash, &dragons[i].pos_z, sizeof(float));
+        hash = fnv1a(hash, &dragons[i].state, sizeof(dragons[i].state));
+        hash = fnv1a(hash, &dragons[i].health, sizeof(float));
+    }
+    return hash;
 }
 
-// Handle player leave
-void handle_leave(PacketHeader *hdr, struct sockaddr_in *client_addr) {
-    (void)client_addr;  // Unused parameter
+// =============================================================================
+// BATCHED RECEIVE
+// =============================================================================
 
-    Player *player = find_player_by_id(hdr->player_id);
-    if (player) {
-        printf("Player %s left (ID: %u)\n", player->name, player->player_id);
-        player->active = 0;
+// Pre-allocated recvmmsg state, reused every drain
+static char recv_buffers[RECV_BATCH_SIZE][BUFFER_SIZE];
+static struct sockaddr_in recv_addrs[RECV_BATCH_SIZE];
+static struct iovec recv_iovecs[RECV_BATCH_SIZE];
+static struct mmsghdr recv_msgs[RECV_BATCH_SIZE];
+static char recv_controls[RECV_BATCH_SIZE][CMSG_SPACE(sizeof(uint32_t))];
+
+// Wire the message headers to their buffers once at startup, and ask the
+// kernel to report receive queue overflows with each datagram
+void init_recv_batch(void) {
+    memset(recv_msgs, 0, sizeof(recv_msgs));
+    for (int i = 0; i < RECV_BATCH_SIZE; i++) {
+        recv_iovecs[i].iov_base = recv_buffers[i];
+        recv_iovecs[i].iov_len = BUFFER_SIZE;
+        recv_msgs[i].msg_hdr.msg_iov = &recv_iovecs[i];
+        recv_msgs[i].msg_hdr.msg_iovlen = 1;
+        recv_msgs[i].msg_hdr.msg_name = &recv_addrs[i];
+        recv_msgs[i].msg_hdr.msg_control = recv_controls[i];
     }
 
-    broadcast_world_state();
+    int on = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
 }
 
-// Cleanup timed out players
-void cleanup_inactive_players() {
-    time_t now = time(NULL);
+// SO_RXQ_OVFL: the socket's running count of datagrams dropped because the
+// receive queue was full, attached once it is nonzero
+static void recv_note_drops(struct msghdr *hdr) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            if (drops > metrics.rx_socket_drops) metrics.rx_socket_drops = drops;
+        }
+    }
+}
+
+// Drain pending datagrams in batches and dispatch all of them.
+// Returns the number of datagrams processed.
+int receive_packets(void) {
+    int total = 0;
+
+    for (int batch = 0; batch < RECV_MAX_BATCHES; batch++) {
+        // recvmmsg overwrites msg_namelen and msg_controllen with the
+        // actual sizes
+        for (int i = 0; i < RECV_BATCH_SIZE; i++) {
+            recv_msgs[i].msg_hdr.msg_namelen = sizeof(recv_addrs[i]);
+            recv_msgs[i].msg_hdr.msg_controllen = sizeof(recv_controls[i]);
+        }
+
+        int n = recvmmsg(server_socket, recv_msgs, RECV_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        metrics.rx_syscalls++;
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG(LOG_ERROR, "recvmmsg: %s", strerror(errno));
+            }
+            break;
+        }
 
+        for (int i = 0; i < n; i++) {
+            uint8_t type = recv_msgs[i].msg_len > 0 ? (uint8_t)recv_buffers[i][0] : 0;
+            metrics.rx_packets[type]++;
+            metrics.rx_bytes[type] += recv_msgs[i].msg_len;
+            if (recording.fd >= 0) {
+                recording_append(recv_buffers[i], recv_msgs[i].msg_len, &recv_addrs[i]);
+            }
+            dispatch_packet(recv_buffers[i], recv_msgs[i].msg_len, &recv_addrs[i]);
+        }
+        metrics.rx_datagrams += n;
+        recv_note_drops(&recv_msgs[n - 1].msg_hdr);
+        hist_record(&metrics.recv_batch, n);
+        total += n;
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active && (now - players[i].last_seen) > PLAYER_TIMEOUT_SEC) {
-            printf("Player %s timed out (ID: %u)\n", players[i].name, players[i].player_id);
-            players[i].active = 0;
+        // A short batch means the socket is drained
+        if (n < RECV_BATCH_SIZE) {
+            break;
         }
     }
 
+    return total;
 }
 
-// Relay entity state from host to all other clients
-void relay_entity_state(void *packet, size_t len, struct sockaddr_in *sender_addr) {
+// =============================================================================
+// EVENT LOOP TIMING
+// =============================================================================
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active) {
-            // Skip the sender (host)
-            if (players[i].addr.sin_addr.s_addr == sender_addr->sin_addr.s_addr &&
-                players[i].addr.sin_port == sender_addr->sin_port) {
-                continue;
-            }
-            sendto(server_socket, packet, len, 0,
-                   (struct sockaddr*)&players[i].addr, sizeof(players[i].addr));
-        }
+// Current CLOCK_MONOTONIC time in nanoseconds
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Arm the timerfd to fire once at an absolute monotonic deadline
+void arm_timer(int timer_fd, uint64_t deadline_ns) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = deadline_ns / 1000000000ULL;
+    spec.it_value.tv_nsec = deadline_ns % 1000000000ULL;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+// Step a periodic deadline forward without accumulating drift. If we fell
+// more than a full period behind, restart the cadence from now instead of
+// firing a burst of catch-up iterations.
+uint64_t advance_deadline(uint64_t deadline_ns, uint64_t interval_ms, uint64_t now_ns) {
+    deadline_ns += interval_ms * NS_PER_MS;
+    if (deadline_ns <= now_ns) {
+        deadline_ns = now_ns + interval_ms * NS_PER_MS;
     }
+    return deadline_ns;
+}
 
+// Fixed-timestep simulation clock. Wall time accumulates and is consumed in
+// whole steps, so the AI always sees the same delta however late the loop
+// wakes; simulation time (and with it the timer wheel) advances by exactly
+// one step per update.
+typedef struct {
+    uint64_t step_ns;            // Length of one step
+    float step_seconds;          // Delta handed to the AI each step
+    uint64_t last_ns;            // Wall time folded into the accumulator so far
+    uint64_t accumulator_ns;     // Wall time not yet simulated
+    uint64_t steps;              // Steps run since startup (simulation time)
+
+    // Overrun accounting, reset each stats print
+    uint64_t period_steps;
+    uint64_t overruns;           // Steps whose own work took longer than step_ns
+    uint64_t dropped_steps;      // Steps skipped because a stall needed more than SIM_MAX_SUBSTEPS
+    uint64_t work_ns;
+    uint64_t max_work_ns;
+} SimClock;
+
+static SimClock sim_clock;
+
+void init_sim_clock(int tick_rate, uint64_t now_ns) {
+    memset(&sim_clock, 0, sizeof(sim_clock));
+    sim_clock.step_ns = 1000000000ULL / tick_rate;
+    sim_clock.step_seconds = 1.0f / tick_rate;
+    sim_clock.last_ns = now_ns;
 }
 
-// Relay arrow spawn to all clients except sender
-void relay_arrow_spawn(ArrowSpawnPacket *pkt, size_t len, struct sockaddr_in *sender_addr) {
+// Fold the wall time since the last call into the accumulator and take out
+// the steps that are due. After a stall at most SIM_MAX_SUBSTEPS run; the
+// rest of the backlog is dropped so the simulation doesn't spiral trying to
+// catch up.
+int sim_clock_due_steps(uint64_t now_ns) {
+    SimClock *c = &sim_clock;
+    if (now_ns > c->last_ns) {
+        c->accumulator_ns += now_ns - c->last_ns;
+        c->last_ns = now_ns;
+    }
 
-    printf("Relaying arrow spawn (id=%u) from player %u to %d clients\n",
-           pkt->arrow_id, pkt->shooter_id, count_active_players() - 1);
-    fflush(stdout);
+    uint64_t due = c->accumulator_ns / c->step_ns;
+    if (due > SIM_MAX_SUBSTEPS) {
+        c->dropped_steps += due - SIM_MAX_SUBSTEPS;
+        metrics.sim_dropped_steps += due - SIM_MAX_SUBSTEPS;
+        c->accumulator_ns -= (due - SIM_MAX_SUBSTEPS) * c->step_ns;
+        due = SIM_MAX_SUBSTEPS;
+    }
+    c->accumulator_ns -= due * c->step_ns;
+    return (int)due;
+}
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active) {
-            // Skip the sender
-            if (players[i].addr.sin_addr.s_addr == sender_addr->sin_addr.s_addr &&
-                players[i].addr.sin_port == sender_addr->sin_port) {
-                continue;
-            }
-            sendto(server_socket, pkt, len, 0,
-                   (struct sockaddr*)&players[i].addr, sizeof(players[i].addr));
+// Account for one finished step and the time its work took
+void sim_clock_step_done(uint64_t work_ns) {
+    SimClock *c = &sim_clock;
+    c->steps++;
+    c->period_steps++;
+    c->work_ns += work_ns;
+    if (work_ns > c->max_work_ns) c->max_work_ns = work_ns;
+    int overrun = work_ns > c->step_ns;
+    c->overruns += overrun;
+    metrics.sim_overruns += overrun;
+    metrics.sim_steps++;
+    hist_record(&metrics.phase_ns[PHASE_SIM_STEP], work_ns);
+    stats_window_record_step(work_ns, overrun);
+}
+
+// Simulation time in milliseconds (drives the timer wheel)
+static inline uint64_t sim_clock_ms(void) {
+    return sim_clock.steps * 1000 / sim_tick_rate;
+}
+
+static inline uint64_t sim_clock_steps(void) {
+    return sim_clock.steps;
+}
+
+// Whole seconds of simulation time. Player activity is stamped with this
+// rather than the wall clock so timeouts replay exactly.
+static inline time_t sim_seconds(void) {
+    return (time_t)(sim_clock_ms() / 1000);
+}
+
+// Monotonic deadline at which the next step becomes due
+static inline uint64_t sim_clock_next_deadline(void) {
+    return sim_clock.last_ns + (sim_clock.step_ns - sim_clock.accumulator_ns);
+}
+
+// Run one fixed simulation step: AI timers and player timeouts, then the AI
+void run_sim_step(void) {
+    uint64_t step_start = monotonic_ns();
+    advance_timers(sim_clock_ms());
+    rebuild_player_grid();
+    uint64_t ai_start = monotonic_ns();
+    update_all_entities(sim_clock.step_seconds);
+    sim_clock_step_done(metrics_phase_end(PHASE_AI_UPDATE, ai_start) - step_start);
+}
+
+// Print and reset the step timing counters
+void print_sim_stats(void) {
+    SimClock *c = &sim_clock;
+    if (c->period_steps == 0) {
+        return;
+    }
+    LOG(LOG_INFO, "Sim: %llu steps at %d Hz, avg %llu us, max %llu us, %llu overruns, %llu dropped\n",
+                  (unsigned long long)c->period_steps, sim_tick_rate,
+                  (unsigned long long)(c->work_ns / c->period_steps / 1000),
+                  (unsigned long long)(c->max_work_ns / 1000),
+                  (unsigned long long)c->overruns, (unsigned long long)c->dropped_steps);
+    c->period_steps = 0;
+    c->overruns = 0;
+    c->dropped_steps = 0;
+    c->work_ns = 0;
+    c->max_work_ns = 0;
+}
+
+// Per-type packet counters, skipping types never seen
+static void metrics_write_packet_counters(FILE *f, const char *name, const char *help,
+                                          const uint64_t *by_type) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    uint64_t other = 0;
+    for (int type = 0; type < 256; type++) {
+        if (!by_type[type]) continue;
+        if (packet_type_names[type]) {
+            fprintf(f, "%s{type=\"%s\"} %llu\n", name, packet_type_names[type],
+                    (unsigned long long)by_type[type]);
+        } else {
+            other += by_type[type];
         }
     }
+    if (other) {
+        fprintf(f, "%s{type=\"other\"} %llu\n", name, (unsigned long long)other);
+    }
+}
 
+// Prometheus histogram series with one bucket per power of two from
+// 2^min_log2 to 2^max_log2, empty or not, so every dump has the same le
+// labels. scale converts samples to the exported unit (1e-9 for
+// nanoseconds to seconds).
+static void metrics_write_histogram(FILE *f, const char *name, const char *labels,
+                                    const Histogram *h, double scale,
+                                    int min_log2, int max_log2) {
+    const char *sep = labels[0] ? "," : "";
+    uint64_t cumulative = 0;
+    int b = 0;
+
+    for (int k = min_log2; k <= max_log2; k++) {
+        // Powers of two are always bucket boundaries
+        uint64_t bound = 1ull << k;
+        while (b < HIST_BUCKETS && hist_bucket_upper(b) < bound) {
+            cumulative += h->buckets[b++];
+        }
+        fprintf(f, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels, sep,
+                bound * scale, (unsigned long long)cumulative);
+    }
+    fprintf(f, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)h->count);
+    const char *open = labels[0] ? "{" : "";
+    const char *close = labels[0] ? "}" : "";
+    fprintf(f, "%s_sum%s%s%s %.9g\n", name, open, labels, close, h->sum * scale);
+    fprintf(f, "%s_count%s%s%s %llu\n", name, open, labels, close, (unsigned long long)h->count);
 }
 
-// Relay arrow hit to all clients except sender
-void relay_arrow_hit(ArrowHitPacket *pkt, size_t len, struct sockaddr_in *sender_addr) {
+// Rewrite --metrics-file. The file is replaced by rename so a scraper (for
+// example node_exporter's textfile collector) never reads a partial dump.
+void write_metrics_file(void) {
+    if (!metrics_path) return;
 
-    printf("Relaying arrow hit (id=%u) at (%.1f, %.1f, %.1f)\n",
-           pkt->arrow_id, pkt->hit_x, pkt->hit_y, pkt->hit_z);
-    fflush(stdout);
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", metrics_path);
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        LOG(LOG_WARN, "Can't write metrics to %s: %s", tmp_path, strerror(errno));
+        return;
+    }
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active) {
-            // Skip the sender
-            if (players[i].addr.sin_addr.s_addr == sender_addr->sin_addr.s_addr &&
-                players[i].addr.sin_port == sender_addr->sin_port) {
-                continue;
-            }
-            sendto(server_socket, pkt, len, 0,
-                   (struct sockaddr*)&players[i].addr, sizeof(players[i].addr));
-        }
+    metrics_write_packet_counters(f, "lob_rx_packets_total", "Datagrams received by packet type.",
+                                  metrics.rx_packets);
+    metrics_write_packet_counters(f, "lob_rx_bytes_total", "Bytes received by packet type.",
+                                  metrics.rx_bytes);
+    metrics_write_packet_counters(f, "lob_tx_packets_total", "Datagrams sent by packet type.",
+                                  metrics.tx_packets);
+    metrics_write_packet_counters(f, "lob_tx_bytes_total", "Bytes sent by packet type.",
+                                  metrics.tx_bytes);
+
+    fprintf(f, "# HELP lob_rx_syscalls_total recvmmsg calls.\n# TYPE lob_rx_syscalls_total counter\n"
+               "lob_rx_syscalls_total %llu\n", (unsigned long long)metrics.rx_syscalls);
+    fprintf(f, "# HELP lob_tx_syscalls_total sendmmsg calls.\n# TYPE lob_tx_syscalls_total counter\n"
+               "lob_tx_syscalls_total %llu\n", (unsigned long long)metrics.tx_syscalls);
+    fprintf(f, "# HELP lob_rx_socket_drops_total Datagrams dropped by a full socket receive queue.\n"
+               "# TYPE lob_rx_socket_drops_total counter\nlob_rx_socket_drops_total %u\n",
+            metrics.rx_socket_drops);
+    fprintf(f, "# HELP lob_tx_errors_total Datagrams sendmmsg refused.\n# TYPE lob_tx_errors_total counter\n"
+               "lob_tx_errors_total %llu\n", (unsigned long long)metrics.tx_errors);
+
+    fprintf(f, "# HELP lob_phase_seconds Time spent per event loop phase.\n# TYPE lob_phase_seconds histogram\n");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        char labels[64];
+        snprintf(labels, sizeof(labels), "phase=\"%s\"", phase_names[phase]);
+        metrics_write_histogram(f, "lob_phase_seconds", labels, &metrics.phase_ns[phase], 1e-9,
+                                PHASE_HIST_MIN_LOG2, PHASE_HIST_MAX_LOG2);
+    }
+    fprintf(f, "# HELP lob_recv_batch_datagrams Datagrams returned per recvmmsg call.\n"
+               "# TYPE lob_recv_batch_datagrams histogram\n");
+    metrics_write_histogram(f, "lob_recv_batch_datagrams", "", &metrics.recv_batch, 1.0, 0, BATCH_HIST_MAX_LOG2);
+    fprintf(f, "# HELP lob_send_queue_datagrams Datagrams queued per send flush.\n"
+               "# TYPE lob_send_queue_datagrams histogram\n");
+    metrics_write_histogram(f, "lob_send_queue_datagrams", "", &metrics.send_batch, 1.0, 0, BATCH_HIST_MAX_LOG2);
+
+    fprintf(f, "# HELP lob_reliable_messages_total Messages sent on reliable channels.\n"
+               "# TYPE lob_reliable_messages_total counter\nlob_reliable_messages_total %llu\n",
+            (unsigned long long)metrics.reliable_sent);
+    fprintf(f, "# HELP lob_reliable_retransmits_total Reliable messages sent again after a timeout.\n"
+               "# TYPE lob_reliable_retransmits_total counter\nlob_reliable_retransmits_total %llu\n",
+            (unsigned long long)metrics.reliable_retransmits);
+    fprintf(f, "# HELP lob_reliable_overflows_total Reliable messages sent unreliably on a full window.\n"
+               "# TYPE lob_reliable_overflows_total counter\nlob_reliable_overflows_total %llu\n",
+            (unsigned long long)metrics.reliable_overflows);
+    fprintf(f, "# HELP lob_reliable_channel_failures_total Reliable channels stopped on a message out of retries.\n"
+               "# TYPE lob_reliable_channel_failures_total counter\nlob_reliable_channel_failures_total %llu\n",
+            (unsigned long long)metrics.reliable_failures);
+    fprintf(f, "# HELP lob_bundled_packets_total Packets coalesced into PKT_BUNDLE datagrams.\n"
+               "# TYPE lob_bundled_packets_total counter\nlob_bundled_packets_total %llu\n",
+            (unsigned long long)metrics.bundled_packets);
+
+    fprintf(f, "# HELP lob_sim_steps_total Fixed simulation steps run.\n# TYPE lob_sim_steps_total counter\n"
+               "lob_sim_steps_total %llu\n", (unsigned long long)metrics.sim_steps);
+    fprintf(f, "# HELP lob_sim_overruns_total Steps that took longer than one period.\n"
+               "# TYPE lob_sim_overruns_total counter\nlob_sim_overruns_total %llu\n",
+            (unsigned long long)metrics.sim_overruns);
+    fprintf(f, "# HELP lob_sim_dropped_steps_total Steps skipped to recover from stalls.\n"
+               "# TYPE lob_sim_dropped_steps_total counter\nlob_sim_dropped_steps_total %llu\n",
+            (unsigned long long)metrics.sim_dropped_steps);
+    fprintf(f, "# HELP lob_sim_tick_rate_hz Configured simulation rate.\n# TYPE lob_sim_tick_rate_hz gauge\n"
+               "lob_sim_tick_rate_hz %d\n", sim_tick_rate);
+
+    int spectator_count = 0;
+    for (int i = 0; i < MAX_SPECTATORS; i++) {
+        spectator_count += spectators[i].active;
+    }
+    int dragon_count = 0;
+    for (int i = 0; i < MAX_DRAGONS; i++) {
+        dragon_count += dragons[i].active;
+    }
+    fprintf(f, "# HELP lob_players Connected players.\n# TYPE lob_players gauge\nlob_players %d\n",
+            count_active_players());
+    fprintf(f, "# HELP lob_spectators Connected spectators.\n# TYPE lob_spectators gauge\nlob_spectators %d\n",
+            spectator_count);
+    fprintf(f, "# HELP lob_entities Live AI entities by type.\n# TYPE lob_entities gauge\n"
+               "lob_entities{type=\"bobba\"} %d\nlob_entities{type=\"dragon\"} %d\n",
+            bobbas.live_count, dragon_count);
+
+    unsigned log_depth = atomic_load_explicit(&log_ring.tail, memory_order_relaxed) -
+                         atomic_load_explicit(&log_ring.head, memory_order_relaxed);
+    fprintf(f, "# HELP lob_log_queue_records Log records waiting for the writer thread.\n"
+               "# TYPE lob_log_queue_records gauge\nlob_log_queue_records %u\n", log_depth);
+    fprintf(f, "# HELP lob_log_dropped_total Log records dropped on a full ring.\n"
+               "# TYPE lob_log_dropped_total counter\nlob_log_dropped_total %lu\n",
+            atomic_load_explicit(&log_ring.dropped, memory_order_relaxed));
+    fprintf(f, "# HELP lob_send_arena_peak_bytes Most payload bytes staged in one tick.\n"
+               "# TYPE lob_send_arena_peak_bytes gauge\nlob_send_arena_peak_bytes %zu\n",
+            metrics.send_arena_peak);
+
+    if (fclose(f) != 0 || rename(tmp_path, metrics_path) != 0) {
+        LOG(LOG_WARN, "Can't write metrics to %s: %s", metrics_path, strerror(errno));
+    }
+}
+
+// Create and bind the game socket. Returns -1 (after reporting why) on failure.
+int open_server_socket(int port) {
+    server_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (server_socket < 0) {
+        perror("Failed to create socket");
+        return -1;
     }
 
+    // Allow address reuse
+    int opt = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // Bind to port
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Failed to bind socket");
+        close(server_socket);
+        server_socket = -1;
+        return -1;
+    }
+    return 0;
 }
 
-// Relay entity damage to host (first/lowest ID player)
-void relay_entity_damage(EntityDamagePacket *pkt, size_t len, struct sockaddr_in *sender_addr) {
+// Feed a recording (see open_replay) back through dispatch_packet, each
+// datagram just before the simulation step it originally preceded. Steps
+// are paced at the tick rate, or run back to back with fast set. Replies
+// are counted but not sent. Returns the process exit code.
+int run_replay(int fast) {
+    static char buffer[BUFFER_SIZE];
+    const RecordingHeader *header = &replay_log.header;
+    uint64_t datagrams = 0;
+    uint64_t next_broadcast_ms = BROADCAST_INTERVAL_MS;
+    uint64_t start_ns = monotonic_ns();
+    init_sim_clock(sim_tick_rate, start_ns);
 
-    // Find host (lowest player ID)
-    Player *host = NULL;
-    uint32_t lowest_id = UINT32_MAX;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (players[i].active && players[i].player_id < lowest_id) {
-            lowest_id = players[i].player_id;
-            host = &players[i];
+    while (running) {
+        uint64_t step = sim_clock.steps;
+        RecordEntry entry;
+        const uint8_t *payload;
+        int more;
+        while ((more = replay_peek(&entry, &payload)) && entry.step <= step) {
+            struct sockaddr_in from;
+            memset(&from, 0, sizeof(from));
+            from.sin_family = AF_INET;
+            from.sin_addr.s_addr = entry.addr;
+            from.sin_port = entry.port;
+            size_t len = entry.len < BUFFER_SIZE ? entry.len : BUFFER_SIZE;
+            memcpy(buffer, payload, len);
+            dispatch_packet(buffer, len, &from);
+            replay_advance();
+            datagrams++;
         }
-    }
 
-    if (host) {
-        printf("Relaying entity damage (entity=%u, damage=%.1f) to host %u\n",
-               pkt->entity_id, pkt->damage, host->player_id);
-        fflush(stdout);
-        sendto(server_socket, pkt, len, 0,
-               (struct sockaddr*)&host->addr, sizeof(host->addr));
+        // Stop where the session stopped, or after the last datagram of a
+        // log that was cut short
+        if (header->end_step ? step >= header->end_step : !more) {
+            break;
+        }
+
+        if (!fast) {
+            uint64_t due_ns = start_ns + (step + 1) * sim_clock.step_ns;
+            struct timespec ts = { due_ns / 1000000000ULL, due_ns % 1000000000ULL };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+
+        // World state goes out on its own cadence, as in the event loop
+        if (sim_clock_ms() >= next_broadcast_ms) {
+            broadcast_world_state();
+            next_broadcast_ms = sim_clock_ms() + BROADCAST_INTERVAL_MS;
+        }
+        run_sim_step();
+        broadcast_entity_state();
+        reliable_resend_due(monotonic_ns());
+        sendq_end_tick();
     }
 
+    double seconds = (monotonic_ns() - start_ns) / 1e9;
+    LOG(LOG_INFO, "Replayed %llu datagrams over %llu steps in %.3f s (%.0f steps/s, %.0f datagrams/s), state hash %016llx",
+        (unsigned long long)datagrams, (unsigned long long)sim_clock.steps, seconds,
+        sim_clock.steps / seconds, datagrams / seconds, (unsigned long long)world_state_hash());
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
     int port = DEFAULT_PORT;
+    int bobba_count = 1;
+    int allow_simd = 1;
+    int ai_threads = 0;  // 0 = one per CPU, up to JOB_DEFAULT_WORKERS
+    int level = LOG_INFO;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    int replay_fast = 0;
+    uint32_t seed = (uint32_t)time(NULL);
 
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--test-multiplayer") == 0) {
             test_multiplayer = 1;
             printf("TEST_MULTIPLAYER mode enabled - enemy AI disabled\n");
+        } else if (strcmp(argv[i], "--no-simd") == 0) {
+            allow_simd = 0;
+        } else if (strcmp(argv[i], "--bobbas") == 0 && i + 1 < argc) {
+            bobba_count = atoi(argv[++i]);
+            if (bobba_count < 1 || bobba_count > MAX_BOBBAS_LIMIT) {
+                fprintf(stderr, "--bobbas must be between 1 and %d\n", MAX_BOBBAS_LIMIT);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            ai_threads = atoi(argv[++i]);
+            if (ai_threads < 1 || ai_threads > JOB_MAX_WORKERS) {
+                fprintf(stderr, "--threads must be between 1 and %d\n", JOB_MAX_WORKERS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            level = log_level_from_name(argv[++i]);
+            if (level < 0) {
+                fprintf(stderr, "--log-level must be error, warn, info or debug\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay-fast") == 0) {
+            replay_fast = 1;
+        } else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+            metrics_path = argv[++i];
+        } else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            sim_tick_rate = atoi(argv[++i]);
+            if (sim_tick_rate < 1 || sim_tick_rate > MAX_TICK_RATE) {
+                fprintf(stderr, "--tick-rate must be between 1 and %d\n", MAX_TICK_RATE);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max-players") == 0 && i + 1 < argc) {
+            max_players = atoi(argv[++i]);
+            if (max_players < 1 || max_players > MAX_PLAYERS_LIMIT) {
+                fprintf(stderr, "--max-players must be between 1 and %d\n", MAX_PLAYERS_LIMIT);
+                return 1;
+            }
         } else if (argv[i][0] != '-') {
             port = atoi(argv[i]);
         }
     }
 
+    log_configure(level);
+
+    // A replay recreates the recorded session's world: same seed and options
+    if (replay_path) {
+        if (open_replay(replay_path) < 0) {
+            fprintf(stderr, "Can't read recording %s\n", replay_path);
+            return 1;
+        }
+        const RecordingHeader *header = &replay_log.header;
+        seed = header->seed;
+        sim_tick_rate = header->tick_rate;
+        max_players = header->max_players;
+        bobba_count = header->bobba_count;
+        test_multiplayer = header->test_multiplayer;
+        allow_simd = header->allow_simd;
+        record_path = NULL;
+    }
+
     // Initialize random seed
-    srand(time(NULL));
+    srand(seed);
 
     // Setup signal handler
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
-    // Create UDP socket
-    server_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (server_socket < 0) {
-        perror("Failed to create socket");
+    // A replay sends nowhere, so it needs no socket
+    if (!replay_path && open_server_socket(port) < 0) {
         return 1;
     }
 
-    // Allow address reuse
-    int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Initialize players and entities arrays
+    players = calloc(max_players, sizeof(Player));
+    reliable_channels = calloc(max_players, sizeof(ReliableChannel));
+    bundles = calloc(max_players, sizeof(Bundle));
+    if (!players || !reliable_channels || !bundles) {
+        fprintf(stderr, "Out of memory for %d players\n", max_players);
+        return 1;
+    }
+    memset(dragons, 0, sizeof(dragons));
 
-    // Bind to port
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
+    if (ai_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        ai_threads = (cpus < 1) ? 1 : (cpus > JOB_DEFAULT_WORKERS) ? JOB_DEFAULT_WORKERS : (int)cpus;
+    }
 
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Failed to bind socket");
+    init_bobba_kernels(allow_simd);
+    int bobba_capacity = bobba_count > DEFAULT_MAX_BOBBAS ? bobba_count : DEFAULT_MAX_BOBBAS;
+    int timer_capacity = max_players + 2 * bobba_capacity + MAX_DRAGONS;
+    if (!players || init_world_state() < 0 || init_player_grid() < 0 ||
+        init_timer_wheel(timer_capacity, 0) < 0 ||
+        init_player_timeouts() < 0 || init_dragon_timers() < 0 ||
+        init_bobba_store(bobba_capacity) < 0 || init_entity_state() < 0 ||
+        slot_index_init(&player_addr_index, max_players) < 0 ||
+        slot_index_init(&player_id_index, max_players) < 0 ||
+        slot_index_init(&spectator_addr_index, MAX_SPECTATORS) < 0 ||
+        init_job_system(ai_threads) < 0) {
+        fprintf(stderr, "Failed to allocate player storage\n");
         close(server_socket);
         return 1;
     }
 
-    // Initialize players and entities arrays
-    memset(players, 0, sizeof(players));
-    memset(bobbas, 0, sizeof(bobbas));
-    memset(dragons, 0, sizeof(dragons));
-
     printf("===========================================\n");
     printf("  Douglass The Keeper - Game Server\n");
     printf("===========================================\n");
-    printf("Listening on UDP port %d\n", port);
-    printf("Max players: %d\n", MAX_PLAYERS);
+    if (replay_path) {
+        printf("Replaying %s: %llu datagrams, %llu steps, seed %u%s\n", replay_path,
+               (unsigned long long)replay_log.header.record_count,
+               (unsigned long long)replay_log.header.end_step, seed,
+               replay_fast ? " (as fast as possible)" : "");
+    } else {
+        printf("Listening on UDP port %d\n", port);
+    }
+    printf("Max players: %d\n", max_players);
+    printf("Bobbas: %d (%s kernels)\n", bobba_count, bobba_kernel_name);
+    printf("AI threads: %d\n", job_system.worker_count);
     printf("Broadcast interval: %d ms\n", BROADCAST_INTERVAL_MS);
-    printf("Entity update interval: %d ms\n", ENTITY_UPDATE_INTERVAL_MS);
+    printf("Simulation tick rate: %d Hz\n", sim_tick_rate);
     printf("Player timeout: %d seconds\n", PLAYER_TIMEOUT_SEC);
+    printf("Log level: %s\n", log_level_names[level]);
+    if (metrics_path) {
+        printf("Metrics: %s every %d seconds\n", metrics_path, METRICS_INTERVAL_SEC);
+    }
+    if (record_path) {
+        printf("Recording received datagrams to %s\n", record_path);
+    }
     printf("Press Ctrl+C to stop\n");
     printf("===========================================\n\n");
     fflush(stdout);
 
+    // From here on all output goes through the log writer thread
+    if (init_logger() < 0) {
+        fprintf(stderr, "Failed to start log writer\n");
+        close(server_socket);
+        return 1;
+    }
+
     // Spawn initial entities
     spawn_bobba(5.0f, 0.0f, 5.0f);    // Bobba near spawn point
+    if (bobba_count > 1) {
+        spawn_bobba_population(bobba_count - 1);
+    }
     spawn_dragon(0.0f, 10.0f);        // Dragon patrolling around center
 
+    init_metrics();
+
+    if (replay_path) {
+        int rc = run_replay(replay_fast);
+        shutdown_job_system();
+        shutdown_logger();
+        return rc;
+    }
+
     // Set socket to non-blocking for single-threaded event loop
     int flags = fcntl(server_socket, F_GETFL, 0);
     fcntl(server_socket, F_SETFL, flags | O_NONBLOCK);
 
-    // Timing for periodic updates
-    struct timespec last_broadcast, last_entity_update, last_cleanup, now;
-    clock_gettime(CLOCK_MONOTONIC, &last_broadcast);
-    last_entity_update = last_broadcast;
-    last_cleanup = last_broadcast;
+    init_recv_batch();
+
+    if (record_path) {
+        RecordingHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+        header.seed = seed;
+        header.tick_rate = (uint16_t)sim_tick_rate;
+        header.max_players = (uint16_t)max_players;
+        header.bobba_count = (uint16_t)bobba_count;
+        header.test_multiplayer = (uint8_t)test_multiplayer;
+        header.allow_simd = (uint8_t)allow_simd;
+        header.start_unix_sec = (uint64_t)time(NULL);
+        if (open_recording(record_path, &header) < 0) {
+            fprintf(stderr, "Can't record to %s: %s\n", record_path, strerror(errno));
+            close(server_socket);
+            return 1;
+        }
+    }
+
+    // Event loop: the socket and a single timerfd armed to the next deadline
+    int epoll_fd = epoll_create1(0);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (epoll_fd < 0 || timer_fd < 0) {
+        perror("Failed to create epoll/timerfd");
+        close(server_socket);
+        return 1;
+    }
 
-    char buffer[BUFFER_SIZE];
-    struct sockaddr_in client_addr;
-    socklen_t addr_len;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = server_socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    // Deadlines for periodic work (CLOCK_MONOTONIC, nanoseconds)
+    uint64_t now = monotonic_ns();
+    uint64_t next_broadcast = now + BROADCAST_INTERVAL_MS * NS_PER_MS;
+    uint64_t next_net_stats = now + NET_STATS_INTERVAL_SEC * 1000 * NS_PER_MS;
+    uint64_t next_metrics = metrics_path ? now + METRICS_INTERVAL_SEC * 1000 * NS_PER_MS : UINT64_MAX;
+    init_sim_clock(sim_tick_rate, now);
+    uint64_t armed_deadline = 0;
 
     // Single-threaded main loop
-    printf("Starting single-threaded event loop...\n");
-    fflush(stdout);
+    LOG(LOG_INFO, "Starting single-threaded event loop...\n");
 
     while (running) {
-        clock_gettime(CLOCK_MONOTONIC, &now);
-
-        // Calculate elapsed times in milliseconds
-        long broadcast_elapsed = (now.tv_sec - last_broadcast.tv_sec) * 1000 +
-                                 (now.tv_nsec - last_broadcast.tv_nsec) / 1000000;
-        long entity_elapsed = (now.tv_sec - last_entity_update.tv_sec) * 1000 +
-                              (now.tv_nsec - last_entity_update.tv_nsec) / 1000000;
-        long cleanup_elapsed = (now.tv_sec - last_cleanup.tv_sec) * 1000 +
-                               (now.tv_nsec - last_cleanup.tv_nsec) / 1000000;
-
-        // Receive packets (non-blocking)
-        addr_len = sizeof(client_addr);
-        ssize_t recv_len = recvfrom(server_socket, buffer, BUFFER_SIZE, 0,
-                                    (struct sockaddr*)&client_addr, &addr_len);
-
-        if (recv_len > 0) {
-            // Process received packet
-            if (recv_len >= (ssize_t)sizeof(PacketHeader)) {
-                PacketHeader *header = (PacketHeader*)buffer;
-
-                switch (header->type) {
-                    case PKT_JOIN:
-                        if (recv_len >= (ssize_t)sizeof(JoinPacket)) {
-                            handle_join((JoinPacket*)buffer, &client_addr);
-                        }
-                        break;
-
-                    case PKT_UPDATE:
-                        if (recv_len >= (ssize_t)sizeof(UpdatePacket)) {
-                            handle_update((UpdatePacket*)buffer, &client_addr);
-                        }
-                        break;
-
-                    case PKT_LEAVE:
-                        handle_leave(header, &client_addr);
-                        break;
-
-                    case PKT_PING: {
-                        // Respond with pong
-                        PacketHeader pong;
-                        pong.type = PKT_PONG;
-                        pong.player_id = header->player_id;
-                        pong.sequence = header->sequence;
-                        sendto(server_socket, &pong, sizeof(pong), 0,
-                               (struct sockaddr*)&client_addr, sizeof(client_addr));
-                        break;
-                    }
+        // Sleep until a packet arrives or the earliest deadline passes
+        uint64_t deadline = next_broadcast;
+        uint64_t next_step = sim_clock_next_deadline();
+        if (next_step < deadline) deadline = next_step;
+        if (next_net_stats < deadline) deadline = next_net_stats;
+        if (next_metrics < deadline) deadline = next_metrics;
+        if (reliable_next_deadline() < deadline) deadline = reliable_next_deadline();
+        if (deadline != armed_deadline) {
+            arm_timer(timer_fd, deadline);
+            armed_deadline = deadline;
+        }
 
-                    case PKT_ENTITY_DAMAGE:
-                        if (recv_len >= (ssize_t)sizeof(EntityDamagePacket)) {
-                            EntityDamagePacket *dmg = (EntityDamagePacket*)buffer;
-                            handle_entity_damage_server(dmg->entity_id, dmg->damage, dmg->attacker_id);
-                        }
-                        break;
-
-                    case PKT_ARROW_SPAWN:
-                        if (recv_len >= (ssize_t)sizeof(ArrowSpawnPacket)) {
-                            relay_arrow_spawn((ArrowSpawnPacket*)buffer, recv_len, &client_addr);
-                        }
-                        break;
-
-                    case PKT_ARROW_HIT:
-                        if (recv_len >= (ssize_t)sizeof(ArrowHitPacket)) {
-                            relay_arrow_hit((ArrowHitPacket*)buffer, recv_len, &client_addr);
-                        }
-                        break;
-
-                    case PKT_HEARTBEAT:
-                        // Just update last_seen (already done by finding player)
-                        break;
-
-                    case PKT_SPECTATE:
-                        handle_spectate(header, &client_addr);
-                        break;
-
-                    case PKT_GAME_RESTART:
-                        if (recv_len >= (ssize_t)sizeof(GameRestartPacket)) {
-                            GameRestartPacket *restart = (GameRestartPacket*)buffer;
-                            handle_game_restart(restart->reason, header->player_id);
-                        }
-                        break;
-
-                    default:
-                        break;
-                }
+        struct epoll_event events[2];
+        int n = epoll_wait(epoll_fd, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;  // Signal: re-check running
+            LOG(LOG_ERROR, "epoll_wait: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == server_socket) {
+                // Drain the socket before running the simulation
+                uint64_t recv_start = monotonic_ns();
+                receive_packets();
+                metrics_phase_end(PHASE_RECV, recv_start);
+            } else if (events[i].data.fd == timer_fd) {
+                uint64_t expirations;
+                ssize_t r = read(timer_fd, &expirations, sizeof(expirations));
+                (void)r;
             }
         }
 
+        now = monotonic_ns();
+
         // Periodic world state broadcast
-        if (broadcast_elapsed >= BROADCAST_INTERVAL_MS) {
+        if (now >= next_broadcast) {
             broadcast_world_state();
-            last_broadcast = now;
+            metrics_phase_end(PHASE_WORLD_BROADCAST, now);
+            next_broadcast = advance_deadline(next_broadcast, BROADCAST_INTERVAL_MS, now);
         }
 
-        // Periodic entity AI update
-        if (entity_elapsed >= ENTITY_UPDATE_INTERVAL_MS) {
-            float delta = entity_elapsed / 1000.0f;
-            update_all_bobbas(delta);
-            update_all_dragons(delta);
+        // Fixed-timestep entity AI: run every step that is due, each with
+        // the same delta, then send the resulting state once
+        int steps = sim_clock_due_steps(now);
+        for (int step = 0; step < steps; step++) {
+            run_sim_step();
+        }
+        if (steps > 0) {
+            uint64_t broadcast_start = monotonic_ns();
             broadcast_entity_state();
-            last_entity_update = now;
+            metrics_phase_end(PHASE_ENTITY_BROADCAST, broadcast_start);
 
             // Debug: print Bobba state every second
             static int debug_counter = 0;
-            if (++debug_counter >= 20) {  // 20 * 50ms = 1 second
-                debug_counter = 0;
-                for (int i = 0; i < MAX_BOBBAS; i++) {
-                    if (bobbas[i].active) {
-                        const char *state_names[] = {"ROAMING", "CHASING", "ATTACKING", "IDLE", "STUNNED"};
-                        printf("Bobba[%u]: state=%s pos=(%.1f,%.1f,%.1f) hp=%.0f target=%u\n",
-                               bobbas[i].entity_id,
-                               state_names[bobbas[i].state],
-                               bobbas[i].pos_x, bobbas[i].pos_y, bobbas[i].pos_z,
-                               bobbas[i].health, bobbas[i].target_player_id);
-                        fflush(stdout);
+            debug_counter += steps;
+            int dump = debug_counter >= sim_tick_rate;
+            if (dump) debug_counter = 0;
+            if (dump && log_level >= LOG_DEBUG) {
+                const char *state_names[] = {"ROAMING", "CHASING", "ATTACKING", "IDLE", "STUNNED"};
+                if (bobbas.live_count <= DEFAULT_MAX_BOBBAS) {
+                    for (int n = 0; n < bobbas.live_count; n++) {
+                        int i = bobbas.live[n];
+                        LOG(LOG_DEBUG, "Bobba[%u]: state=%s pos=(%.1f,%.1f,%.1f) hp=%.0f target=%u\n",
+                                       bobbas.entity_id[i],
+                                       state_names[bobbas.state[i]],
+                                       bobbas.pos_x[i], bobbas.pos_y[i], bobbas.pos_z[i],
+                                       bobbas.health[i], bobbas.target_player_id[i]);
+                    }
+                } else {
+                    // Too many to list: summarize by state
+                    int by_state[5] = { 0 };
+                    int by_tier[3] = { 0 };
+                    for (int n = 0; n < bobbas.live_count; n++) {
+                        by_state[bobbas.state[bobbas.live[n]]]++;
+                        by_tier[bobbas.lod_tier[bobbas.live[n]]]++;
                     }
+                    LOG(LOG_DEBUG, "Bobbas: %d live (%s %d, %s %d, %s %d, %s %d, %s %d) AI LOD near/mid/far %d/%d/%d\n",
+                                   bobbas.live_count,
+                                   state_names[0], by_state[0], state_names[1], by_state[1],
+                                   state_names[2], by_state[2], state_names[3], by_state[3],
+                                   state_names[4], by_state[4],
+                                   by_tier[AI_LOD_NEAR], by_tier[AI_LOD_MID], by_tier[AI_LOD_FAR]);
                 }
             }
         }
 
-        // Periodic cleanup of inactive players
-        if (cleanup_elapsed >= 1000) {  // Every second
-            cleanup_inactive_players();
-            last_cleanup = now;
+        // Periodic syscall counters
+        if (now >= next_net_stats) {
+            print_net_stats();
+            print_sim_stats();
+            next_net_stats = advance_deadline(next_net_stats, NET_STATS_INTERVAL_SEC * 1000, now);
         }
 
-        // Small sleep to avoid busy-waiting (1ms)
-        usleep(1000);
+        // Prometheus dump for --metrics-file
+        if (now >= next_metrics) {
+            write_metrics_file();
+            next_metrics = advance_deadline(next_metrics, METRICS_INTERVAL_SEC * 1000, now);
+        }
+
+        reliable_resend_due(now);
+
+        // Flush everything queued this tick in as few syscalls as possible
+        uint64_t flush_start = monotonic_ns();
+        sendq_end_tick();
+        metrics_phase_end(PHASE_SEND_FLUSH, flush_start);
     }
 
+    LOG(LOG_INFO, "Shutting down server...");
+    if (recording.fd >= 0) {
+        LOG(LOG_INFO, "Recorded %llu datagrams over %llu steps, state hash %016llx",
+            (unsigned long long)recording_header()->record_count,
+            (unsigned long long)sim_clock.steps, (unsigned long long)world_state_hash());
+        close_recording(sim_clock.steps);
+    }
+    shutdown_job_system();
+    shutdown_logger();
+    close(timer_fd);
+    close(epoll_fd);
     close(server_socket);
     printf("Server stopped.\n");
     return 0;
@@ -0,0 +1,99 @@
+/*
+ * Douglass The Keeper - Log-linear histograms
+ *
+ * Fixed-size histograms of uint64_t samples (nanoseconds, byte counts,
+ * queue depths) shared by game_server.c and bot_client.c. Values below
+ * HIST_SUB_BUCKETS are counted exactly; above that every power of two is
+ * split into HIST_SUB_BUCKETS linear buckets, so a reported percentile is
+ * within 1/HIST_SUB_BUCKETS (12.5%) of the true value over the full 64-bit
+ * range. Recording is a handful of instructions and never allocates.
+ *
+ * Not thread-safe: give each thread its own histogram and merge them.
+ *
+ * Header-only: every function is static inline.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define HIST_SUB_BITS     3
+#define HIST_SUB_BUCKETS  (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS      ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+static inline void hist_reset(Histogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline int hist_bucket(uint64_t value) {
+    if (value < HIST_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_BUCKETS + (int)((value >> shift) - HIST_SUB_BUCKETS);
+}
+
+// Largest value that lands in bucket
+static inline uint64_t hist_bucket_upper(int bucket) {
+    if (bucket < HIST_SUB_BUCKETS) {
+        return (uint64_t)bucket;
+    }
+    int shift = bucket / HIST_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t)(bucket % HIST_SUB_BUCKETS) + HIST_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+static inline void hist_record(Histogram *h, uint64_t value) {
+    h->buckets[hist_bucket(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+static inline void hist_merge(Histogram *dst, const Histogram *src) {
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        dst->buckets[b] += src->buckets[b];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+static inline uint64_t hist_mean(const Histogram *h) {
+    return h->count ? h->sum / h->count : 0;
+}
+
+// Value at quantile q (0..1): the upper bound of the bucket holding that
+// rank, clamped to the largest sample seen. 0 for an empty histogram.
+static inline uint64_t hist_percentile(const Histogram *h, double q) {
+    if (h->count == 0) return 0;
+
+    uint64_t rank = (uint64_t)(q * h->count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->count) rank = h->count;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t upper = hist_bucket_upper(b);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+#endif // HISTOGRAM_H
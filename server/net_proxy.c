@@ -0,0 +1,627 @@
+/*
+ * UDP Impairment Proxy - a bad network on one box
+ *
+ * Relays datagrams between clients (bot_client, Godot) and game_server,
+ * adding latency, jitter, loss, duplication and reordering in both
+ * directions. Each client gets its own upstream socket, so the server still
+ * sees one address per client. Datagrams move in recvmmsg/sendmmsg batches
+ * and wait in a heap ordered by release time (woken by a timerfd), so the
+ * relay keeps up with far more traffic than a single game_server sends.
+ *
+ * Impairments are drawn from a seeded PRNG; --seed makes a run repeatable
+ * for the same traffic.
+ *
+ * Compile: gcc -O2 -o net_proxy net_proxy.c
+ * Run: ./net_proxy [listen_port] [server_ip] [server_port] [--latency MS]
+ *                  [--jitter MS] [--loss PCT] [--dup PCT] [--reorder PCT]
+ *                  [--reorder-ms MS] [--seed N]
+ * Example: ./net_proxy 7778 127.0.0.1 7777 --latency 40 --jitter 10 --loss 2
+ *          ./bot_client --swarm 50 1 127.0.0.1 7778
+ */
+
+#define _GNU_SOURCE  // recvmmsg, sendmmsg
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+
+#define DEFAULT_LISTEN_PORT 7778
+#define DEFAULT_SERVER "127.0.0.1"
+#define DEFAULT_SERVER_PORT 7777
+#define DEFAULT_REORDER_MS 20     // Extra hold for a reordered datagram
+
+#define MAX_SESSIONS 4096         // Clients relayed at once
+#define SESSION_BUCKETS 8192      // Client address hash table size
+#define SESSION_IDLE_SEC 60       // Forget clients silent this long
+#define MAX_QUEUED 65536          // Datagrams held at once; more are dropped
+#define MAX_DATAGRAM 2048
+#define IO_BATCH 64               // Datagrams per recvmmsg/sendmmsg
+#define SOCKET_BUFFER_BYTES (4 * 1024 * 1024)
+#define REPORT_INTERVAL_SEC 5
+
+#define EPOLL_LISTEN  UINT32_MAX  // epoll tags; anything else is a session index
+#define EPOLL_TIMER   (UINT32_MAX - 1)
+
+enum { DIR_UP, DIR_DOWN };        // Client -> server, server -> client
+static const char *dir_names[] = { "up", "down" };
+
+typedef struct {
+    struct sockaddr_in client_addr;
+    int sock;                     // Connected to the server
+    int active;
+    int next;                     // Hash chain, -1 = end
+    uint32_t generation;          // Bumped on reuse so queued datagrams for a dead session are dropped
+    uint64_t last_active_ns;
+} Session;
+
+typedef struct {
+    uint64_t release_ns;
+    uint64_t order;               // FIFO among equal release times
+    int session;
+    uint32_t generation;
+    int dir;
+    uint16_t len;
+    uint8_t data[MAX_DATAGRAM];
+} Packet;
+
+typedef struct {
+    uint64_t received;
+    uint64_t forwarded;
+    uint64_t lost;                // Dropped by --loss
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t overflow;            // Dropped because MAX_QUEUED were held
+    uint64_t send_errors;
+} DirStats;
+
+// A sendmmsg batch on one socket. Packets go back to the pool once sent.
+typedef struct {
+    int sock;
+    int count;
+    struct mmsghdr msgs[IO_BATCH];
+    struct iovec iov[IO_BATCH];
+    Packet *packets[IO_BATCH];
+} SendBatch;
+
+static volatile int running = 1;
+
+// Impairment settings
+static uint64_t latency_ns = 0;
+static uint64_t jitter_ns = 0;
+static uint64_t reorder_ns = DEFAULT_REORDER_MS * 1000000ULL;
+static double loss_pct = 0.0;
+static double dup_pct = 0.0;
+static double reorder_pct = 0.0;
+static uint64_t rng_state;
+
+static int listen_sock = -1;
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static struct sockaddr_in server_addr;
+
+static Session sessions[MAX_SESSIONS];
+static int session_buckets[SESSION_BUCKETS];
+static int session_count = 0;
+
+// Release-time min-heap and a free list of packet buffers
+static Packet *heap[MAX_QUEUED];
+static int heap_size = 0;
+static Packet *free_packets[MAX_QUEUED];
+static int free_count = 0;
+static int packets_allocated = 0;
+static uint64_t packet_order = 0;
+
+static DirStats stats[2];
+
+void signal_handler(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// =============================================================================
+// RANDOMNESS
+// =============================================================================
+
+// xorshift64*: fast, and repeatable from --seed
+uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in [0, 1)
+double rng_unit(void) {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int chance(double pct) {
+    return pct > 0.0 && rng_unit() * 100.0 < pct;
+}
+
+// =============================================================================
+// PACKET QUEUE
+// =============================================================================
+
+Packet* packet_alloc(void) {
+    if (free_count > 0) return free_packets[--free_count];
+    if (packets_allocated == MAX_QUEUED) return NULL;
+
+    Packet *p = malloc(sizeof(Packet));
+    if (p) packets_allocated++;
+    return p;
+}
+
+void packet_free(Packet *p) {
+    free_packets[free_count++] = p;
+}
+
+static inline int packet_before(const Packet *a, const Packet *b) {
+    if (a->release_ns != b->release_ns) return a->release_ns < b->release_ns;
+    return a->order < b->order;
+}
+
+void heap_push(Packet *p) {
+    int i = heap_size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!packet_before(p, heap[parent])) break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = p;
+}
+
+Packet* heap_pop(void) {
+    Packet *top = heap[0];
+    Packet *last = heap[--heap_size];
+
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= heap_size) break;
+        if (child + 1 < heap_size && packet_before(heap[child + 1], heap[child])) child++;
+        if (!packet_before(heap[child], last)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heap_size > 0) heap[i] = last;
+    return top;
+}
+
+// Wake epoll when the earliest held datagram is due (disarmed when none are)
+void arm_timer(void) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (heap_size > 0) {
+        uint64_t due = heap[0]->release_ns;
+        if (due == 0) due = 1;  // Zero would disarm
+        its.it_value.tv_sec = due / 1000000000ULL;
+        its.it_value.tv_nsec = due % 1000000000ULL;
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// =============================================================================
+// SESSIONS
+// =============================================================================
+
+static inline uint32_t addr_hash(const struct sockaddr_in *addr) {
+    uint32_t h = addr->sin_addr.s_addr * 2654435761u ^ addr->sin_port * 40503u;
+    return (h ^ (h >> 16)) % SESSION_BUCKETS;
+}
+
+void set_socket_buffers(int sock) {
+    int bytes = SOCKET_BUFFER_BYTES;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+}
+
+// Session for a client address, creating it (with its upstream socket) on
+// first contact. Returns -1 if the table is full or the socket fails.
+int session_for(const struct sockaddr_in *addr, uint64_t now) {
+    uint32_t bucket = addr_hash(addr);
+    for (int i = session_buckets[bucket]; i >= 0; i = sessions[i].next) {
+        if (sessions[i].client_addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            sessions[i].client_addr.sin_port == addr->sin_port) {
+            return i;
+        }
+    }
+
+    int index = -1;
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (!sessions[i].active) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) return -1;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return -1;
+    set_socket_buffers(sock);
+    if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)index;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    Session *s = &sessions[index];
+    s->client_addr = *addr;
+    s->sock = sock;
+    s->active = 1;
+    s->generation++;
+    s->last_active_ns = now;
+    s->next = session_buckets[bucket];
+    session_buckets[bucket] = index;
+    session_count++;
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+    printf("New client %s:%d (%d relayed)\n", ip, ntohs(addr->sin_port), session_count);
+    return index;
+}
+
+void close_session(int index) {
+    Session *s = &sessions[index];
+    int *link = &session_buckets[addr_hash(&s->client_addr)];
+    while (*link != index) link = &sessions[*link].next;
+    *link = s->next;
+
+    close(s->sock);  // Also removes it from epoll
+    s->active = 0;
+    session_count--;
+}
+
+void expire_sessions(uint64_t now) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].active &&
+            now - sessions[i].last_active_ns >= SESSION_IDLE_SEC * 1000000000ULL) {
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &sessions[i].client_addr.sin_addr, ip, sizeof(ip));
+            printf("Client %s:%d idle, dropped\n", ip, ntohs(sessions[i].client_addr.sin_port));
+            close_session(i);
+        }
+    }
+}
+
+// =============================================================================
+// IMPAIRMENT
+// =============================================================================
+
+void hold_packet(int session, int dir, const uint8_t *data, size_t len, uint64_t now) {
+    Packet *p = packet_alloc();
+    if (!p) {
+        stats[dir].overflow++;
+        return;
+    }
+
+    // Latency +/- jitter, plus the reorder hold for the unlucky ones
+    int64_t delay = (int64_t)latency_ns;
+    if (jitter_ns > 0) {
+        delay += (int64_t)(rng_unit() * 2.0 * jitter_ns) - (int64_t)jitter_ns;
+        if (delay < 0) delay = 0;
+    }
+    if (chance(reorder_pct)) {
+        delay += (int64_t)reorder_ns;
+        stats[dir].reordered++;
+    }
+
+    p->release_ns = now + (uint64_t)delay;
+    p->order = packet_order++;
+    p->session = session;
+    p->generation = sessions[session].generation;
+    p->dir = dir;
+    p->len = (uint16_t)len;
+    memcpy(p->data, data, len);
+    heap_push(p);
+}
+
+void impair(int session, int dir, const uint8_t *data, size_t len, uint64_t now) {
+    stats[dir].received++;
+    if (chance(loss_pct)) {
+        stats[dir].lost++;
+        return;
+    }
+
+    hold_packet(session, dir, data, len, now);
+    if (chance(dup_pct)) {
+        stats[dir].duplicated++;
+        hold_packet(session, dir, data, len, now);
+    }
+}
+
+// =============================================================================
+// BATCHED I/O
+// =============================================================================
+
+static uint8_t recv_buffers[IO_BATCH][MAX_DATAGRAM];
+static struct iovec recv_iov[IO_BATCH];
+static struct mmsghdr recv_msgs[IO_BATCH];
+static struct sockaddr_in recv_addrs[IO_BATCH];
+
+void init_recv_batch(void) {
+    for (int i = 0; i < IO_BATCH; i++) {
+        recv_iov[i].iov_base = recv_buffers[i];
+        recv_iov[i].iov_len = MAX_DATAGRAM;
+        recv_msgs[i].msg_hdr.msg_iov = &recv_iov[i];
+        recv_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+// Drain a socket. Datagrams on the listening socket come from clients;
+// on a session socket, from the server for that session's client.
+void drain_socket(int sock, int session) {
+    int n;
+    do {
+        for (int i = 0; i < IO_BATCH; i++) {
+            recv_msgs[i].msg_hdr.msg_name = &recv_addrs[i];
+            recv_msgs[i].msg_hdr.msg_namelen = sizeof(recv_addrs[i]);
+        }
+        n = recvmmsg(sock, recv_msgs, IO_BATCH, MSG_DONTWAIT, NULL);
+
+        uint64_t now = now_ns();
+        for (int i = 0; i < n; i++) {
+            int s = session;
+            int dir = DIR_DOWN;
+            if (s < 0) {
+                s = session_for(&recv_addrs[i], now);
+                if (s < 0) continue;
+                dir = DIR_UP;
+            }
+            sessions[s].last_active_ns = now;
+            impair(s, dir, recv_buffers[i], recv_msgs[i].msg_len, now);
+        }
+    } while (n == IO_BATCH);
+}
+
+void flush_batch(SendBatch *b, int dir) {
+    if (b->count == 0) return;
+
+    int sent = sendmmsg(b->sock, b->msgs, b->count, 0);
+    if (sent < 0) sent = 0;
+    stats[dir].forwarded += sent;
+    stats[dir].send_errors += b->count - sent;
+
+    for (int i = 0; i < b->count; i++) {
+        packet_free(b->packets[i]);
+    }
+    b->count = 0;
+}
+
+void batch_add(SendBatch *b, int dir, int sock, Packet *p, struct sockaddr_in *to) {
+    if (b->count == IO_BATCH || (b->count > 0 && b->sock != sock)) flush_batch(b, dir);
+
+    int i = b->count++;
+    b->sock = sock;
+    b->packets[i] = p;
+    b->iov[i].iov_base = p->data;
+    b->iov[i].iov_len = p->len;
+    memset(&b->msgs[i], 0, sizeof(b->msgs[i]));
+    b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+    b->msgs[i].msg_hdr.msg_iovlen = 1;
+    b->msgs[i].msg_hdr.msg_name = to;
+    b->msgs[i].msg_hdr.msg_namelen = to ? sizeof(*to) : 0;
+}
+
+// Send every held datagram that is due. Downstream traffic all leaves
+// through the listening socket; upstream goes out each client's session
+// socket, batched while consecutive datagrams share one.
+void release_due(uint64_t now) {
+    static SendBatch down, up;
+
+    while (heap_size > 0 && heap[0]->release_ns <= now) {
+        Packet *p = heap_pop();
+        Session *s = &sessions[p->session];
+        if (!s->active || s->generation != p->generation) {
+            packet_free(p);
+            continue;
+        }
+
+        if (p->dir == DIR_DOWN) {
+            batch_add(&down, DIR_DOWN, listen_sock, p, &s->client_addr);
+        } else {
+            batch_add(&up, DIR_UP, s->sock, p, NULL);
+        }
+    }
+
+    flush_batch(&down, DIR_DOWN);
+    flush_batch(&up, DIR_UP);
+}
+
+// =============================================================================
+// REPORTING
+// =============================================================================
+
+void print_stats(uint64_t interval_ns) {
+    static DirStats last[2];
+    double secs = interval_ns / 1e9;
+
+    for (int d = 0; d < 2; d++) {
+        const DirStats *s = &stats[d];
+        printf("[%-4s] %8.0f pkt/s forwarded | lost %llu, dup %llu, reordered %llu, overflow %llu, send errors %llu\n",
+               dir_names[d], (s->forwarded - last[d].forwarded) / secs,
+               (unsigned long long)(s->lost - last[d].lost),
+               (unsigned long long)(s->duplicated - last[d].duplicated),
+               (unsigned long long)(s->reordered - last[d].reordered),
+               (unsigned long long)(s->overflow - last[d].overflow),
+               (unsigned long long)(s->send_errors - last[d].send_errors));
+        last[d] = *s;
+    }
+    printf("       %d clients, %d datagrams held\n", session_count, heap_size);
+    fflush(stdout);
+}
+
+void print_totals(void) {
+    printf("Totals:\n");
+    for (int d = 0; d < 2; d++) {
+        const DirStats *s = &stats[d];
+        printf("  %-4s received %llu, forwarded %llu, lost %llu, dup %llu, reordered %llu, overflow %llu, send errors %llu\n",
+               dir_names[d], (unsigned long long)s->received, (unsigned long long)s->forwarded,
+               (unsigned long long)s->lost, (unsigned long long)s->duplicated,
+               (unsigned long long)s->reordered, (unsigned long long)s->overflow,
+               (unsigned long long)s->send_errors);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int listen_port = DEFAULT_LISTEN_PORT;
+    const char *server_ip = DEFAULT_SERVER;
+    int server_port = DEFAULT_SERVER_PORT;
+    uint64_t seed = (uint64_t)time(NULL);
+
+    // Positional: [listen_port] [server_ip] [server_port]; flags may appear anywhere
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            latency_ns = (uint64_t)(atof(argv[++i]) * 1e6);
+        } else if (strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) {
+            jitter_ns = (uint64_t)(atof(argv[++i]) * 1e6);
+        } else if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc) {
+            loss_pct = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--dup") == 0 && i + 1 < argc) {
+            dup_pct = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+            reorder_pct = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--reorder-ms") == 0 && i + 1 < argc) {
+            reorder_ns = (uint64_t)(atof(argv[++i]) * 1e6);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (positional == 0) {
+            listen_port = atoi(argv[i]); positional++;
+        } else if (positional == 1) {
+            server_ip = argv[i]; positional++;
+        } else if (positional == 2) {
+            server_port = atoi(argv[i]); positional++;
+        }
+    }
+
+    if (loss_pct < 0 || loss_pct > 100 || dup_pct < 0 || dup_pct > 100 ||
+        reorder_pct < 0 || reorder_pct > 100) {
+        fprintf(stderr, "--loss, --dup and --reorder are percentages (0-100)\n");
+        return 1;
+    }
+    rng_state = seed ? seed : 1;  // xorshift must not start at zero
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(server_port);
+    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "Bad server address %s\n", server_ip);
+        return 1;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    listen_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (listen_sock < 0) {
+        perror("socket");
+        return 1;
+    }
+    int opt = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    set_socket_buffers(listen_sock);
+
+    struct sockaddr_in listen_addr;
+    memset(&listen_addr, 0, sizeof(listen_addr));
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_addr.s_addr = INADDR_ANY;
+    listen_addr.sin_port = htons(listen_port);
+    if (bind(listen_sock, (struct sockaddr*)&listen_addr, sizeof(listen_addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    epoll_fd = epoll_create1(0);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (epoll_fd < 0 || timer_fd < 0) {
+        perror("epoll/timerfd");
+        return 1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = EPOLL_LISTEN;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_sock, &ev);
+    ev.data.u32 = EPOLL_TIMER;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    for (int i = 0; i < SESSION_BUCKETS; i++) session_buckets[i] = -1;
+    init_recv_batch();
+
+    printf("===========================================\n");
+    printf("  UDP Impairment Proxy\n");
+    printf("===========================================\n");
+    printf("Listening on UDP port %d, relaying to %s:%d\n", listen_port, server_ip, server_port);
+    printf("Latency: %.1f ms +/- %.1f ms jitter\n", latency_ns / 1e6, jitter_ns / 1e6);
+    printf("Loss: %.2f%%, duplication: %.2f%%, reordering: %.2f%% (held %.1f ms)\n",
+           loss_pct, dup_pct, reorder_pct, reorder_ns / 1e6);
+    printf("Seed: %llu\n", (unsigned long long)seed);
+    printf("Press Ctrl+C to stop\n");
+    printf("===========================================\n\n");
+
+    struct epoll_event events[IO_BATCH];
+    uint64_t last_report = now_ns();
+
+    while (running) {
+        int n = epoll_wait(epoll_fd, events, IO_BATCH, 1000);
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = events[i].data.u32;
+            if (tag == EPOLL_LISTEN) {
+                drain_socket(listen_sock, -1);
+            } else if (tag == EPOLL_TIMER) {
+                uint64_t expirations;
+                ssize_t r = read(timer_fd, &expirations, sizeof(expirations));
+                (void)r;
+            } else if (sessions[tag].active) {
+                drain_socket(sessions[tag].sock, (int)tag);
+            }
+        }
+
+        uint64_t now = now_ns();
+        release_due(now);
+        arm_timer();
+
+        if (now - last_report >= REPORT_INTERVAL_SEC * 1000000000ULL) {
+            print_stats(now - last_report);
+            expire_sessions(now);
+            last_report = now;
+        }
+    }
+
+    printf("\nProxy shutting down...\n");
+    print_totals();
+
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].active) close_session(i);
+    }
+    while (heap_size > 0) packet_free(heap_pop());
+    for (int i = 0; i < free_count; i++) free(free_packets[i]);
+    close(timer_fd);
+    close(epoll_fd);
+    close(listen_sock);
+    return 0;
+}